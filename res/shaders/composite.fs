@@ -8,12 +8,10 @@ layout(location = 0) in vec2 in_uv;
 
 layout(location = 0) out vec4 out_color;
 
-layout(set = 0, binding = 0) uniform sampler2D composite_in;
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput composite_in;
 
 void main() {
-    vec2 uv = in_uv;
-
-    vec3 in_color = texture(composite_in, uv).rgb;
+    vec3 in_color = subpassLoad(composite_in).rgb;
 
     out_color = vec4(filmic_tone_map(in_color), 1);
 }
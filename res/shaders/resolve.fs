@@ -4,7 +4,7 @@ layout(location = 0) in vec2 in_uv;
 
 layout(location = 0) out vec4 out_color;
 
-layout(set = 0, binding = 0) uniform sampler2DMS pbr_out;
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInputMS pbr_out;
 
 layout(push_constant) uniform Dim {
     vec2 dims;
@@ -25,12 +25,10 @@ vec3 inv_tone_map(vec3 c) {
 }
 
 void main() {
-    ivec2 p = ivec2(in_uv * dims);
-
-    vec3 s0 = texelFetch(pbr_out, p, 0).rgb;
-    vec3 s1 = texelFetch(pbr_out, p, 1).rgb;
-    vec3 s2 = texelFetch(pbr_out, p, 2).rgb;
-    vec3 s3 = texelFetch(pbr_out, p, 3).rgb;
+    vec3 s0 = subpassLoad(pbr_out, 0).rgb;
+    vec3 s1 = subpassLoad(pbr_out, 1).rgb;
+    vec3 s2 = subpassLoad(pbr_out, 2).rgb;
+    vec3 s3 = subpassLoad(pbr_out, 3).rgb;
 
     out_color = vec4(inv_tone_map(tone_map(s0, 0.25) + tone_map(s1, 0.25) + tone_map(s2, 0.25) + tone_map(s3, 0.25)), 1);
 }
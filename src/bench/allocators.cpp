@@ -0,0 +1,83 @@
+#include "gfx/suballocator.hpp"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <spdlog/spdlog.h>
+
+// Churns the allocators with the power of two sized ranges of plant instances and meshlet pages as they grow
+
+static constexpr VkDeviceSize POOL_SIZE = 64 * 1024 * 1024;
+static constexpr VkDeviceSize MIN_RANGE = 256;
+static constexpr uint32_t MAX_ORDER = 8;
+static constexpr uint32_t LIVE_RANGES = 4 * 1024;
+static constexpr uint32_t ITERATIONS = 1000000;
+
+struct Result final {
+    double ns_per_op;
+    uint32_t failures;
+    VkDeviceSize requested;
+    VkDeviceSize reserved;
+};
+
+template <typename Alloc>
+static Result run(Alloc allocator) {
+    std::mt19937 rng{1};
+    std::uniform_int_distribution<uint32_t> order{0, MAX_ORDER};
+
+    std::vector<std::pair<gfx::ContiguousAllocation, VkDeviceSize>> live;
+    live.reserve(LIVE_RANGES);
+
+    Result result = {};
+
+    const auto alloc = [&] {
+        const VkDeviceSize size = MIN_RANGE << order(rng);
+
+        gfx::ContiguousAllocation range;
+        if (!allocator.alloc(size, range))
+            return false;
+
+        live.emplace_back(range, size);
+        return true;
+    };
+
+    // stops short when the pool is full already
+    while (live.size() < LIVE_RANGES / 2 && alloc()) {
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+        // a plant is replaced by one at another growth stage
+        if (!live.empty() && (live.size() >= LIVE_RANGES || rng() % 2)) {
+            const std::size_t idx = rng() % live.size();
+            allocator.free(live[idx].first);
+            live[idx] = live.back();
+            live.pop_back();
+        } else if (!alloc()) {
+            result.failures++;
+        }
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+    result.ns_per_op = std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+
+    for (const auto& [range, size] : live) {
+        result.requested += size;
+        result.reserved += range.size;
+    }
+
+    return result;
+}
+
+static void report(const char* name, const Result& result) {
+    spdlog::info("{:>6}: {:6.1f} ns/op, {:6} failed allocations, {:5.1f}% of the reserved memory requested", name, result.ns_per_op, result.failures,
+        result.reserved ? 100.0 * result.requested / result.reserved : 100.0);
+}
+
+int main() {
+    // the slabs must fit the largest range
+    report("slab", run(gfx::SlabAllocator{static_cast<uint32_t>(POOL_SIZE / (MIN_RANGE << MAX_ORDER)), MIN_RANGE << MAX_ORDER}));
+    report("tlsf", run(gfx::TLSFAllocator{POOL_SIZE, MIN_RANGE}));
+    report("buddy", run(gfx::BuddyAllocator{POOL_SIZE, MIN_RANGE}));
+}
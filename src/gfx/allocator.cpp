@@ -4,6 +4,8 @@
 #include "vk_helpers.hpp"
 #include "context.hpp"
 
+#include <algorithm>
+#include <functional>
 #include <spdlog/spdlog.h>
 
 namespace gfx {
@@ -24,70 +26,38 @@ const Buffer* BufferAllocation::operator->() const {
     return &buffer;
 }
 
-FreeListAllocator::FreeListAllocator(VkDeviceSize size) : size{size} {
-    // initially all the memory is free
-    frees.emplace(size, 0);
-}
-
-bool FreeListAllocator::alloc(VkDeviceSize size, ContiguousAllocation& out) {
-    // no more memory available at all
-    if (frees.empty() || size == 0)
-        return false;
-    VkDeviceSize base = 0;
-    VkDeviceSize total_size = 0;
-    // std::map orders by key ascending
-    for (auto [s, b] : frees) {
-        if (size <= s) {
-            // find smallest memory block possible
-            total_size = s;
-            base = b;
-            break;
+// Takes the least slot given back by an exited thread, or a new one
+struct ArenaThreadSlot final {
+    ArenaThreadSlot() {
+        std::scoped_lock<std::mutex> lock{m};
+        if (free_slots.empty()) {
+            slot = next_slot++;
+        } else {
+            std::pop_heap(free_slots.begin(), free_slots.end(), std::greater<uint32_t>{});
+            slot = free_slots.back();
+            free_slots.pop_back();
         }
     }
-    // no large enough contiguous memory available
-    if (total_size == 0)
-        return false;
-    // erase if contiguous memory all used up
-    if (size == total_size)
-        frees.erase(total_size);
-    // otherwise truncate contiguous memory
-    else
-        frees[total_size] += size;
-    out = {base, size};
-    return true;
-}
-
-void FreeListAllocator::free(ContiguousAllocation alloc) {
-    // make this memory available for alloc
-    frees.emplace(alloc.size, alloc.offset);
-}
-
-VkDeviceSize FreeListAllocator::size_hint() const {
-    return size;
-}
 
-SlabAllocator::SlabAllocator(uint32_t num_blocks, VkDeviceSize slab_size) : num_blocks{num_blocks}, slab_size{slab_size} {
-    slabs.reserve(num_blocks);
-    for (uint32_t i = 0; i < num_blocks; ++i) {
-        slabs.push_back(i * slab_size);
+    ~ArenaThreadSlot() {
+        std::scoped_lock<std::mutex> lock{m};
+        free_slots.push_back(slot);
+        std::push_heap(free_slots.begin(), free_slots.end(), std::greater<uint32_t>{});
     }
-}
 
-bool SlabAllocator::alloc(VkDeviceSize size, ContiguousAllocation& out) {
-    if (slabs.empty())
-        return false;
-    out.offset = slabs.back();
-    out.size = slab_size;
-    slabs.pop_back();
-    return true;
-}
+    ArenaThreadSlot(const ArenaThreadSlot&) = delete;
+    ArenaThreadSlot& operator=(const ArenaThreadSlot&) = delete;
 
-void SlabAllocator::free(ContiguousAllocation alloc) {
-    slabs.push_back(alloc.offset);
-}
+    uint32_t slot;
+
+    static inline std::mutex m;
+    static inline std::vector<uint32_t> free_slots;
+    static inline uint32_t next_slot = 0;
+};
 
-VkDeviceSize SlabAllocator::size_hint() const {
-    return num_blocks * slab_size;
+uint32_t arena_thread_slot() {
+    static thread_local const ArenaThreadSlot slot;
+    return slot.slot;
 }
 
 void Allocator::init(Context& cx) {
@@ -119,6 +89,8 @@ void Allocator::init(Context& cx) {
     allocator_info.pVulkanFunctions = &vk_fns;
 
     vk_log(vmaCreateAllocator(&allocator_info, &allocator));
+
+    dev = cx.dev;
 }
 
 void Allocator::cleanup() {
@@ -178,6 +150,52 @@ Image Allocator::create_image(const VkImageCreateInfo& ici, VmaMemoryUsage usage
     return out;
 }
 
+Image Allocator::create_image(const VkImageCreateInfo& ici) {
+    VkImage image;
+    vk_log(vkCreateImage(dev, &ici, nullptr, &image));
+
+    Image out;
+    out.image = image;
+    out.format = ici.format;
+    out.samples = ici.samples;
+    out.allocation = VK_NULL_HANDLE;
+    out.extent = ici.extent;
+    out.num_mips = ici.mipLevels;
+    out.layers = ici.arrayLayers;
+
+    return out;
+}
+
+VmaAllocation Allocator::alias(const std::vector<Image>& images, VmaMemoryUsage usage) {
+    PK_ASSERT(!images.empty());
+
+    VkMemoryRequirements reqs = {};
+    reqs.memoryTypeBits = ~0u;
+
+    for (const Image& image : images) {
+        VkMemoryRequirements image_reqs;
+        vkGetImageMemoryRequirements(dev, image.image, &image_reqs);
+
+        reqs.size = std::max(reqs.size, image_reqs.size);
+        reqs.alignment = std::max(reqs.alignment, image_reqs.alignment);
+        reqs.memoryTypeBits &= image_reqs.memoryTypeBits;
+    }
+
+    PK_ASSERT(reqs.memoryTypeBits != 0);
+
+    VmaAllocationCreateInfo aci = {};
+    aci.usage = usage;
+
+    VmaAllocation alloc;
+    vk_log(vmaAllocateMemory(allocator, &reqs, &aci, &alloc, nullptr));
+
+    for (const Image& image : images) {
+        vk_log(vmaBindImageMemory(allocator, alloc, image.image));
+    }
+
+    return alloc;
+}
+
 void Allocator::destroy(Buffer buffer) {
     if (buffer.offset > 0) {
         spdlog::warn("destroying a buffer slice");
@@ -190,4 +208,24 @@ void Allocator::destroy(Image image) {
     vmaDestroyImage(allocator, image.image, image.allocation);
 }
 
+void Allocator::destroy(VmaAllocation allocation) {
+    vmaFreeMemory(allocator, allocation);
+}
+
+VkDeviceSize Allocator::device_budget() const {
+    const VkPhysicalDeviceMemoryProperties* props;
+    vmaGetMemoryProperties(allocator, &props);
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetBudget(allocator, budgets);
+
+    VkDeviceSize budget = 0;
+    for (uint32_t i = 0; i < props->memoryHeapCount; ++i) {
+        if ((props->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && budgets[i].budget > budgets[i].usage)
+            budget = std::max(budget, budgets[i].budget - budgets[i].usage);
+    }
+
+    return budget;
+}
+
 } // namespace gfx
@@ -2,20 +2,19 @@
 
 #include "types.hpp"
 #include "def.hpp"
+#include "suballocator.hpp"
 
 #include <vk_mem_alloc.h>
 #include <vector>
-#include <map>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <memory>
 
 namespace gfx {
 
 struct Context;
 
-struct ContiguousAllocation final {
-    VkDeviceSize offset;
-    VkDeviceSize size;
-};
-
 struct BufferAllocation final {
     Buffer buffer;
     ContiguousAllocation alloc;
@@ -27,36 +26,6 @@ struct BufferAllocation final {
     const Buffer* operator->() const;
 };
 
-class FreeListAllocator final {
-  public:
-    FreeListAllocator(VkDeviceSize size);
-
-    bool alloc(VkDeviceSize size, ContiguousAllocation& out);
-    void free(ContiguousAllocation alloc);
-
-    VkDeviceSize size_hint() const;
-
-  private:
-    VkDeviceSize size;
-    // key = size, value = ptr
-    std::map<uint64_t, uint64_t> frees;
-};
-
-class SlabAllocator final {
-  public:
-    SlabAllocator(uint32_t num_blocks, VkDeviceSize slab_size);
-
-    bool alloc(VkDeviceSize size, ContiguousAllocation& out);
-    void free(ContiguousAllocation alloc);
-
-    VkDeviceSize size_hint() const;
-
-  private:
-    uint32_t num_blocks;
-    VkDeviceSize slab_size;
-    std::vector<VkDeviceSize> slabs;
-};
-
 template <typename Alloc>
 class BufferArena final {
   public:
@@ -64,8 +33,26 @@ class BufferArena final {
         PK_ASSERT(size > 0);
 
         ContiguousAllocation block;
-        PK_ASSERT(allocator.alloc(size, block));
+        const bool allocated = allocator.alloc(size, block);
+        PK_ASSERT(allocated);
+
+        return allocation(block, size);
+    }
+
+    // Fails instead when the allocator is out of memory
+    bool alloc(VkDeviceSize size, BufferAllocation& out) {
+        PK_ASSERT(size > 0);
+
+        ContiguousAllocation block;
+        if (!allocator.alloc(size, block))
+            return false;
+
+        out = allocation(block, size);
+        return true;
+    }
 
+    // The slice of the buffer of a block of the allocator
+    BufferAllocation allocation(ContiguousAllocation block, VkDeviceSize size) const {
         Buffer buf = buffer;
         buf.offset += block.offset;
         buf.actual_size = block.size;
@@ -78,6 +65,10 @@ class BufferArena final {
         allocator.free(allocation.alloc);
     }
 
+    const Alloc& get_allocator() const {
+        return allocator;
+    }
+
     Buffer buffer;
 
   private:
@@ -92,6 +83,232 @@ class BufferArena final {
     uint64_t id;
 };
 
+// Index of the calling thread among the running threads that used a ConcurrentBufferArena, assigned on first use.
+// The slots of exited threads are handed out again to the threads that come after them.
+uint32_t arena_thread_slot();
+
+/*
+  A BufferArena that any thread may allocate from and free to, e.g. to reserve the ranges of meshes generated on the workers of the job system.
+
+  Allocations are rounded up to a power of two multiple of min_size. Every thread keeps a few free ranges of each of the smaller sizes to itself,
+  and overflows into (or refills from) a lock-free free list of that size which all the threads share.
+  Only once the shared free list runs dry are new ranges allocated from the underlying allocator, a batch at a time under a lock.
+  Freed ranges are reused for allocations of the same size, rather than returned to the underlying allocator.
+
+  Allocations larger than the largest size go straight to the underlying allocator, under the lock.
+
+  Caches belong to thread slots rather than threads: the ranges left in the cache of an exited thread are picked up by the next thread given its slot.
+  Threads that are done with the arena but keep running (or exit for good) can hand their ranges over to the other threads with flush_thread_cache().
+  Beyond MAX_THREADS threads at once, the rest go without caches.
+*/
+template <typename Alloc>
+class ConcurrentBufferArena final {
+  public:
+    static constexpr uint32_t NUM_SIZES = 16;
+    // larger ranges are only kept in the shared free lists, so that threads don't hoard them
+    static constexpr uint32_t CACHED_SIZES = 8;
+    // threads running past this share the free lists only
+    static constexpr uint32_t MAX_THREADS = 64;
+    static constexpr uint32_t CACHE_SIZE = 8;
+
+    ConcurrentBufferArena(BufferArena<Alloc> arena, VkDeviceSize min_size)
+        : arena{arena}, min_size{min_size}, num_nodes{static_cast<uint32_t>(arena.get_allocator().size_hint() / min_size)},
+          nodes{std::make_unique<Node[]>(num_nodes)}, caches{std::make_unique<ThreadCache[]>(MAX_THREADS)} {
+        PK_ASSERT(min_size > 0);
+
+        // every range fits in a node once it's free, as no more than num_nodes ranges fit in the arena
+        for (uint32_t i = 0; i < num_nodes; ++i) {
+            nodes[i].next.store(i + 1 < num_nodes ? i + 1 : NONE, std::memory_order_relaxed);
+        }
+        unused_nodes.store(num_nodes > 0 ? 0 : NONE, std::memory_order_relaxed);
+
+        for (auto& list : free_lists) {
+            list.store(NONE, std::memory_order_relaxed);
+        }
+    }
+
+    ConcurrentBufferArena(const ConcurrentBufferArena&) = delete;
+    ConcurrentBufferArena& operator=(const ConcurrentBufferArena&) = delete;
+
+    // Fails when the underlying allocator is out of memory, which may happen with memory to spare in the free lists of the other sizes
+    bool alloc(VkDeviceSize size, BufferAllocation& out) {
+        PK_ASSERT(size > 0);
+
+        const uint32_t size_class = class_of(size);
+        if (size_class >= NUM_SIZES) {
+            std::scoped_lock<std::mutex> lock{m};
+            return arena.alloc(size, out);
+        }
+
+        ThreadCache* cache = thread_cache(size_class);
+        ContiguousAllocation range;
+
+        if (cache && cache->count[size_class] > 0) {
+            range = cache->ranges[size_class][--cache->count[size_class]];
+        } else if (!pop(free_lists[size_class], range) && !refill(size_class, cache, range)) {
+            return false;
+        }
+
+        out = arena.allocation(range, size);
+        return true;
+    }
+
+    void free(const BufferAllocation& allocation) {
+        const ContiguousAllocation range = allocation.alloc;
+
+        const uint32_t size_class = class_of(range.size);
+        if (size_class >= NUM_SIZES) {
+            std::scoped_lock<std::mutex> lock{m};
+            arena.free(allocation);
+            return;
+        }
+        PK_ASSERT(range.size == min_size << size_class);
+
+        ThreadCache* cache = thread_cache(size_class);
+        if (!cache) {
+            push(free_lists[size_class], range);
+            return;
+        }
+
+        // Half the cache overflows at once, so that alternating allocations and frees stay within the cache
+        if (cache->count[size_class] == CACHE_SIZE) {
+            for (uint32_t i = CACHE_SIZE / 2; i < CACHE_SIZE; ++i) {
+                push(free_lists[size_class], cache->ranges[size_class][i]);
+            }
+            cache->count[size_class] = CACHE_SIZE / 2;
+        }
+
+        cache->ranges[size_class][cache->count[size_class]++] = range;
+    }
+
+    // Moves the ranges cached by the calling thread into the shared free lists
+    void flush_thread_cache() {
+        const uint32_t slot = arena_thread_slot();
+        if (slot >= MAX_THREADS)
+            return;
+
+        ThreadCache& cache = caches[slot];
+        for (uint32_t size_class = 0; size_class < CACHED_SIZES; ++size_class) {
+            for (uint32_t i = 0; i < cache.count[size_class]; ++i) {
+                push(free_lists[size_class], cache.ranges[size_class][i]);
+            }
+            cache.count[size_class] = 0;
+        }
+    }
+
+    const Buffer& buffer() const {
+        return arena.buffer;
+    }
+
+  private:
+    static constexpr uint32_t NONE = ~0u;
+
+    struct Node final {
+        ContiguousAllocation range;
+        std::atomic<uint32_t> next;
+    };
+
+    // Owned by a single thread at a time, and padded so that threads don't share cache lines
+    struct alignas(64) ThreadCache final {
+        uint32_t count[CACHED_SIZES] = {};
+        ContiguousAllocation ranges[CACHED_SIZES][CACHE_SIZE];
+    };
+
+    // The head of a lock-free stack of nodes: the index of the top node in the low bits,
+    // and a counter of the pushes and pops in the high bits so that a node popped and pushed back in between can't be mistaken for the head.
+    using Head = std::atomic<uint64_t>;
+
+    uint32_t class_of(VkDeviceSize size) const {
+        uint32_t size_class = 0;
+        while ((min_size << size_class) < size && size_class < NUM_SIZES) {
+            ++size_class;
+        }
+        return size_class;
+    }
+
+    ThreadCache* thread_cache(uint32_t size_class) const {
+        if (size_class >= CACHED_SIZES)
+            return nullptr;
+
+        const uint32_t slot = arena_thread_slot();
+        return slot < MAX_THREADS ? &caches[slot] : nullptr;
+    }
+
+    uint32_t pop_node(Head& head) {
+        uint64_t top = head.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(top) != NONE) {
+            const uint32_t node = static_cast<uint32_t>(top);
+            // stale if the node was popped meanwhile, in which case the exchange fails
+            const uint64_t next = ((top >> 32) + 1) << 32 | nodes[node].next.load(std::memory_order_relaxed);
+            if (head.compare_exchange_weak(top, next, std::memory_order_acquire, std::memory_order_acquire))
+                return node;
+        }
+        return NONE;
+    }
+
+    void push_node(Head& head, uint32_t node) {
+        uint64_t top = head.load(std::memory_order_relaxed);
+        do {
+            nodes[node].next.store(static_cast<uint32_t>(top), std::memory_order_relaxed);
+        } while (!head.compare_exchange_weak(top, ((top >> 32) + 1) << 32 | node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    bool pop(Head& list, ContiguousAllocation& out) {
+        const uint32_t node = pop_node(list);
+        if (node == NONE)
+            return false;
+
+        out = nodes[node].range;
+        push_node(unused_nodes, node);
+        return true;
+    }
+
+    void push(Head& list, ContiguousAllocation range) {
+        const uint32_t node = pop_node(unused_nodes);
+        PK_ASSERT(node != NONE);
+
+        nodes[node].range = range;
+        push_node(list, node);
+    }
+
+    // Allocates a batch of ranges, one of which is returned and the rest are cached by the calling thread.
+    // Fails only if not even the first one fits, the batch is cut short otherwise.
+    bool refill(uint32_t size_class, ThreadCache* cache, ContiguousAllocation& out) {
+        std::scoped_lock<std::mutex> lock{m};
+
+        // Another thread may have refilled the free list while this one waited on the lock
+        if (pop(free_lists[size_class], out))
+            return true;
+
+        const VkDeviceSize size = min_size << size_class;
+
+        // The allocator may round the blocks up, but ranges are only ever reused for the same size
+        BufferAllocation allocation;
+        if (!arena.alloc(size, allocation))
+            return false;
+        out = ContiguousAllocation{allocation.alloc.offset, size};
+
+        if (!cache)
+            return true;
+
+        while (cache->count[size_class] < CACHE_SIZE / 2 && arena.alloc(size, allocation)) {
+            cache->ranges[size_class][cache->count[size_class]++] = ContiguousAllocation{allocation.alloc.offset, size};
+        }
+        return true;
+    }
+
+    BufferArena<Alloc> arena;
+    VkDeviceSize min_size;
+    std::mutex m;
+
+    uint32_t num_nodes;
+    std::unique_ptr<Node[]> nodes;
+    Head unused_nodes;
+    std::array<Head, NUM_SIZES> free_lists;
+
+    std::unique_ptr<ThreadCache[]> caches;
+};
+
 class Allocator final {
   public:
     void init(Context& cx);
@@ -100,6 +317,12 @@ class Allocator final {
     Buffer create_buffer(const VkBufferCreateInfo& bci, VmaMemoryUsage usage, bool mapped);
     Image create_image(const VkImageCreateInfo& ici, VmaMemoryUsage usage);
 
+    // Creates an image with no memory bound to it, see alias().
+    Image create_image(const VkImageCreateInfo& ici);
+    // Allocates one block of memory that satisfies all the images and binds every image to the start of it.
+    // The images may only be used at non-overlapping times.
+    VmaAllocation alias(const std::vector<Image>& images, VmaMemoryUsage usage);
+
     template <typename Alloc>
     BufferArena<Alloc> create_arena(Alloc alloc, VkBufferCreateInfo bci, VmaMemoryUsage usage, bool mapped) {
         PK_ASSERT(bci.size >= alloc.size_hint());
@@ -109,13 +332,25 @@ class Allocator final {
 
     void destroy(Buffer buffer);
     void destroy(Image image);
+    void destroy(VmaAllocation allocation);
+
+    // Memory still available to the largest device local heap
+    VkDeviceSize device_budget() const;
 
     template <typename Alloc>
     void destroy(BufferArena<Alloc> arena) {
         destroy(arena.buffer);
     }
 
+    template <typename Alloc>
+    void destroy(const ConcurrentBufferArena<Alloc>& arena) {
+        destroy(arena.buffer());
+    }
+
     VmaAllocator allocator;
+
+  private:
+    VkDevice dev;
 };
 
 } // namespace gfx
@@ -11,13 +11,14 @@ namespace gfx {
 CommandPool::CommandPool() : total{0} {
 }
 
-void CommandPool::init(Context& cx) {
+void CommandPool::init(Context& cx, uint32_t queue_idx, VkCommandBufferLevel level) {
     dev = cx.dev;
+    this->level = level;
 
     VkCommandPoolCreateInfo cpci = {};
     cpci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     cpci.flags = /*VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |*/ VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    cpci.queueFamilyIndex = cx.gfx_queue_idx;
+    cpci.queueFamilyIndex = queue_idx;
 
     vk_log(vkCreateCommandPool(dev, &cpci, nullptr, &pool));
 }
@@ -38,7 +39,7 @@ VkCommandBuffer CommandPool::take() {
         cbai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
         cbai.commandBufferCount = 1;
         cbai.commandPool = pool;
-        cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cbai.level = level;
 
         VkCommandBuffer cmd;
         vk_log(vkAllocateCommandBuffers(dev, &cbai, &cmd));
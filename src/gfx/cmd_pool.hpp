@@ -12,7 +12,7 @@ class CommandPool final {
   public:
     CommandPool();
 
-    void init(Context& cx);
+    void init(Context& cx, uint32_t queue_idx, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
     void cleanup();
 
     VkCommandBuffer take();
@@ -22,6 +22,7 @@ class CommandPool final {
 
   private:
     VkDevice dev;
+    VkCommandBufferLevel level;
     std::vector<VkCommandBuffer> cmds;
     std::mutex m;
     std::size_t total;
@@ -4,6 +4,7 @@
 #include "frame_context.hpp"
 #include "context.hpp"
 #include "ui.hpp"
+#include "view.hpp"
 
 namespace gfx {
 
@@ -15,33 +16,35 @@ void CompositePass::init(FrameContext& fcx) {
 void CompositePass::cleanup(FrameContext& fcx) {
 }
 
-void CompositePass::add_resources(FrameContext& fcx, RenderGraph& rg) {
+void CompositePass::add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) {
+    if (!view.main())
+        return;
+
     TextureDesc in_desc;
     in_desc.width = fcx.cx.width;
     in_desc.height = fcx.cx.height;
-    in_desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    in_desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
     in_desc.format = VK_FORMAT_R16G16B16A16_SFLOAT;
     in_desc.samples = VK_SAMPLE_COUNT_1_BIT;
 
-    const Texture in = fcx.cx.rt_cache.get("composite.in", in_desc);
-
-    PassAttachment pa_in;
-    pa_in.tex = in;
-    pa_in.subresource = vk_subresource_range(0, 1, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
-
-    rg.push_attachment({"composite.in"}, pa_in);
+    rg.push_transient({"composite.in"}, in_desc);
 }
 
-std::vector<RenderPass> CompositePass::pass(FrameContext& fcx) {
+std::vector<RenderPass> CompositePass::pass(FrameContext& fcx, const View& view) {
+    if (!view.main())
+        return {};
+
     RenderPass pass;
 
     pass.width = fcx.cx.width;
     pass.height = fcx.cx.height;
     pass.layers = 1;
+    pass.name = "composite";
 
     pass.push_color_output({"composite.out"}, vk_clear_color(0.f, 0.f, 0.f, 1.f));
-    pass.push_texture_input({"composite.in"});
-    pass.set_pre_exec([this](FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) { ui->late_init(fcx, rp); });
+    pass.push_input_attachment({"composite.in"}, false, {});
+    if (ui)
+        pass.set_pre_exec([this](FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) { ui->late_init(fcx, rp, rg.subpass()); });
     pass.set_exec([this](FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) { render(fcx, rg, rp); });
 
     return {pass};
@@ -52,8 +55,7 @@ void CompositePass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPas
     const VkRect2D scissor = vk_rect(0, 0, fcx.cx.width, fcx.cx.height);
 
     DescriptorSetInfo set_info;
-    set_info.bind_texture(
-        rg.attachment({"composite.in"}).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    set_info.bind_texture(rg.attachment({"composite.in"}).tex, VK_NULL_HANDLE, VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT);
 
     if (!fcx.cx.pipeline_cache.contains("composite.pipeline")) {
         VkPipelineRasterizationStateCreateInfo prsci = vk_rasterization_state_create_info(VK_POLYGON_MODE_FILL);
@@ -71,7 +73,7 @@ void CompositePass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPas
         fcx.cx.pipeline_cache.add("composite.pipeline", builder.info());
     }
 
-    const Pipeline pipeline = fcx.cx.pipeline_cache.get(rp, 0, "composite.pipeline");
+    const Pipeline pipeline = fcx.cx.pipeline_cache.get(rg.target(), "composite.pipeline");
     const DescriptorSet set = fcx.cx.descriptor_cache.get_set(key, set_info);
 
     vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
@@ -82,7 +84,8 @@ void CompositePass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPas
 
     vkCmdDraw(fcx.cmd, 3, 1, 0, 0);
 
-    ui->end(fcx);
+    if (ui)
+        ui->end(fcx);
 }
 
 } // namespace gfx
@@ -12,12 +12,14 @@ class CompositePass final : public GFXPass {
     void init(FrameContext& fcx) override;
     void cleanup(FrameContext& fcx) override;
 
-    void add_resources(FrameContext& fcx, RenderGraph& rg) override;
-    std::vector<RenderPass> pass(FrameContext& fcx) override;
+    // Only the main view is presented
+    void add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) override;
+    std::vector<RenderPass> pass(FrameContext& fcx, const View& view) override;
 
     void render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp);
 
-    UIRenderer* ui;
+    // Drawn on top of the frame, if any; headless frames are rendered without it
+    UIRenderer* ui = nullptr;
 
   private:
     DescriptorKey key;
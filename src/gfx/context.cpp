@@ -4,6 +4,8 @@
 
 #include <spdlog/spdlog.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cstring>
 
 namespace gfx {
 
@@ -25,6 +27,7 @@ void glfw_resize(GLFWwindow* window, int32_t, int32_t) {
     glfwGetFramebufferSize(cx->window, &width, &height);
     cx->sc_init(width, height);
     cx->rt_cache.reset();
+    cx->rg_cache.clear_graphs();
     cx->on_resize(width, height);
 }
 
@@ -43,6 +46,21 @@ bool Context::init(GLFWwindow* window) {
     width = fb_width;
     height = fb_height;
 
+    return init_device();
+}
+
+bool Context::init_headless(uint32_t width, uint32_t height) {
+    window = nullptr;
+    surface = VK_NULL_HANDLE;
+    swapchain = VK_NULL_HANDLE;
+
+    this->width = width;
+    this->height = height;
+
+    return init_device();
+}
+
+bool Context::init_device() {
     vkb::InstanceBuilder vkb_instance_builder;
     vkb_instance_builder.set_app_name("Parkbox");
     vkb_instance_builder.require_api_version(1, 2);
@@ -61,7 +79,10 @@ bool Context::init(GLFWwindow* window) {
         true
 #endif
     );
-    vkb_instance_builder.enable_layer("VK_LAYER_LUNARG_monitor");
+    if (headless())
+        vkb_instance_builder.set_headless();
+    else
+        vkb_instance_builder.enable_layer("VK_LAYER_LUNARG_monitor");
 
     vkb::detail::Result<vkb::Instance> vkb_instance_result = vkb_instance_builder.build();
 
@@ -75,7 +96,8 @@ bool Context::init(GLFWwindow* window) {
 
     volkLoadInstance(instance);
 
-    vk_log(glfwCreateWindowSurface(instance, window, nullptr, &surface));
+    if (!headless())
+        vk_log(glfwCreateWindowSurface(instance, window, nullptr, &surface));
 
     VkPhysicalDeviceFeatures features = {};
     features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
@@ -83,19 +105,26 @@ bool Context::init(GLFWwindow* window) {
     features.samplerAnisotropy = VK_TRUE;
     features.depthClamp = VK_TRUE;
     features.fragmentStoresAndAtomics = VK_TRUE;
+    features.shaderStorageImageExtendedFormats = VK_TRUE;
 
     VkPhysicalDeviceVulkan12Features features_12 = {};
     features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
     features_12.runtimeDescriptorArray = VK_TRUE;
     features_12.descriptorBindingPartiallyBound = VK_TRUE;
+    features_12.timelineSemaphore = VK_TRUE;
 
     vkb::PhysicalDeviceSelector vkb_physdev_selector{vkb_instance_result.value()};
-    vkb_physdev_selector.set_surface(surface);
-    vkb_physdev_selector.require_present();
+    if (!headless()) {
+        vkb_physdev_selector.set_surface(surface);
+        vkb_physdev_selector.require_present();
+    } else {
+        vkb_physdev_selector.require_present(false);
+    }
     vkb_physdev_selector.set_minimum_version(1, 2);
     vkb_physdev_selector.set_required_features(features);
     vkb_physdev_selector.set_required_features_12(features_12);
     vkb_physdev_selector.prefer_gpu_device_type(vkb::PreferredDeviceType::discrete);
+    vkb_physdev_selector.add_desired_extension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
 
     vkb::detail::Result<vkb::PhysicalDevice> vkb_physdev_result = vkb_physdev_selector.select();
 
@@ -106,7 +135,22 @@ bool Context::init(GLFWwindow* window) {
 
     phys_dev = vkb_physdev_result->physical_device;
 
+    // desired extensions are enabled if present, so check whether it is
+    uint32_t ext_count = 0;
+    vkEnumerateDeviceExtensionProperties(phys_dev, nullptr, &ext_count, nullptr);
+    std::vector<VkExtensionProperties> exts(ext_count);
+    vkEnumerateDeviceExtensionProperties(phys_dev, nullptr, &ext_count, exts.data());
+
+    dynamic_rendering = std::any_of(exts.begin(), exts.end(),
+        [](const VkExtensionProperties& ext) { return std::strcmp(ext.extensionName, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) == 0; });
+
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features = {};
+    dynamic_rendering_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+    dynamic_rendering_features.dynamicRendering = VK_TRUE;
+
     vkb::DeviceBuilder vkb_device_builder{vkb_physdev_result.value()};
+    if (dynamic_rendering)
+        vkb_device_builder.add_pNext(&dynamic_rendering_features);
     vkb::detail::Result<vkb::Device> vkb_device = vkb_device_builder.build();
 
     dev = vkb_device->device;
@@ -114,23 +158,26 @@ bool Context::init(GLFWwindow* window) {
 
     gfx_queue = *vkb_device->get_queue(vkb::QueueType::graphics);
     transfer_queue = *vkb_device->get_queue(vkb::QueueType::transfer);
-    present_queue = *vkb_device->get_queue(vkb::QueueType::present);
+    present_queue = headless() ? gfx_queue : *vkb_device->get_queue(vkb::QueueType::present);
     compute_queue = *vkb_device->get_queue(vkb::QueueType::compute);
 
     gfx_queue_idx = *vkb_device->get_queue_index(vkb::QueueType::graphics);
     transfer_queue_idx = *vkb_device->get_queue_index(vkb::QueueType::transfer);
-    present_queue_idx = *vkb_device->get_queue_index(vkb::QueueType::present);
+    present_queue_idx = headless() ? gfx_queue_idx : *vkb_device->get_queue_index(vkb::QueueType::present);
     compute_queue_idx = *vkb_device->get_queue_index(vkb::QueueType::compute);
 
     sc_init(width, height);
 
+    scheduler.Init();
     alloc.init(*this);
-    frame_pool.init(*this);
+    frame_pool.init(*this, gfx_queue_idx);
+    compute_pool.init(*this, compute_queue_idx);
+    transfers.init(*this);
     shader_cache.init(*this);
     descriptor_cache.init(dev);
     pipeline_cache.init(dev, descriptor_cache);
     sampler_cache.init(dev);
-    rg_cache.init(dev);
+    rg_cache.init(*this);
     rt_cache.init(*this);
 
     return true;
@@ -140,6 +187,9 @@ void Context::sc_init(int32_t width, int32_t height) {
     this->width = width;
     this->height = height;
 
+    if (headless())
+        return;
+
     vkb::SwapchainBuilder vkb_swapchain_builder{vkb_dev};
     vkb_swapchain_builder.set_desired_extent(width, height);
     vkb_swapchain_builder.set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR);
@@ -160,7 +210,8 @@ void Context::pre_cleanup(FrameContext& fcx) {
 }
 
 void Context::sc_cleanup() {
-    vkDestroySwapchainKHR(dev, swapchain, nullptr);
+    if (!headless())
+        vkDestroySwapchainKHR(dev, swapchain, nullptr);
 }
 
 void Context::cleanup() {
@@ -170,13 +221,20 @@ void Context::cleanup() {
     pipeline_cache.cleanup();
     descriptor_cache.cleanup();
     shader_cache.cleanup();
+    transfers.cleanup();
+    compute_pool.cleanup();
     frame_pool.cleanup();
     alloc.cleanup();
 
     vkDestroyDevice(dev, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (!headless())
+        vkDestroySurfaceKHR(instance, surface, nullptr);
     vkDestroyDebugUtilsMessengerEXT(instance, debug_messenger, nullptr);
     vkDestroyInstance(instance, nullptr);
 }
 
+bool Context::headless() const {
+    return window == nullptr;
+}
+
 } // namespace gfx
\ No newline at end of file
@@ -10,11 +10,14 @@
 #include "signal.hpp"
 #include "render_graph.hpp"
 #include "rt_cache.hpp"
+#include "upload_ring.hpp"
+#include "transfer.hpp"
 
 #include <volk.h>
 #include <vk_mem_alloc.h>
 #include <entt/entt.hpp>
 #include <VkBootstrap.h>
+#include <ftl/task_scheduler.h>
 
 struct GLFWwindow;
 
@@ -24,12 +27,17 @@ class Renderer;
 
 struct Context {
     bool init(GLFWwindow* window);
+    // Without a window, surface or swapchain, so that it runs on machines without a display or GPU (e.g. with lavapipe as the only ICD).
+    // The renderer draws into an offscreen target instead of the swapchain.
+    bool init_headless(uint32_t width, uint32_t height);
     void sc_init(int32_t width, int32_t height);
     void post_init(FrameContext& fcx);
     void pre_cleanup(FrameContext& fcx);
     void sc_cleanup();
     void cleanup();
 
+    bool headless() const;
+
     GLFWwindow* window;
     uint32_t width;
     uint32_t height;
@@ -56,14 +64,22 @@ struct Context {
     uint32_t present_queue_idx;
     uint32_t compute_queue_idx;
 
+    // VK_KHR_dynamic_rendering is supported, so render graphs begin rendering without render pass and framebuffer objects where possible
+    bool dynamic_rendering;
+
+    ftl::TaskScheduler scheduler;
     Allocator alloc;
     CommandPool frame_pool;
+    CommandPool compute_pool;
     ShaderCache shader_cache;
     DescriptorCache descriptor_cache;
     PipelineCache pipeline_cache;
     SamplerCache sampler_cache;
     RenderGraphCache rg_cache;
     RenderTargetCache rt_cache;
+    // initialized by the renderer, which has a region for each of its frames in flight
+    UploadRing uploads;
+    TransferUploader transfers;
 
     Scene scene;
 
@@ -72,6 +88,9 @@ struct Context {
     Signal<int32_t, int32_t> on_resize;
 
     Renderer* renderer; // TODO(jazzfool): this pointer is ugly to have here, remove it at some point
+
+  private:
+    bool init_device();
 };
 
 } // namespace gfx
\ No newline at end of file
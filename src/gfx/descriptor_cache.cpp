@@ -5,6 +5,7 @@
 #include "pipeline_cache.hpp"
 
 #include <array>
+#include <atomic>
 #include <spdlog/spdlog.h>
 
 namespace gfx {
@@ -200,13 +201,15 @@ std::vector<StoredDescriptorWrite> DescriptorSetInfo::write_diff(VkDevice dev, t
 }
 
 DescriptorKey::DescriptorKey() {
-    static uint64_t next = 0;
+    static std::atomic<uint64_t> next{0};
     key = next++;
 }
 
 void DescriptorCache::init(VkDevice dev) {
     this->dev = dev;
     active_pool = nullptr;
+    set_cache.resize(1);
+    frame_slot = 0;
 }
 
 void DescriptorCache::cleanup() {
@@ -224,39 +227,41 @@ void DescriptorCache::cleanup() {
 }
 
 VkDescriptorSetLayout DescriptorCache::get_layout(const DescriptorSetInfo& info) {
-    StoredDescriptorSetLayoutCreateInfo layout_info = info.vk_layout();
-    layout_info.rebind();
-
-    const std::size_t hash = std::hash<VkDescriptorSetLayoutCreateInfo>{}(layout_info.info);
-    if (layout_cache.count(hash)) {
-        return layout_cache.at(hash);
-    }
-
-    VkDescriptorSetLayout layout;
-    vk_log(vkCreateDescriptorSetLayout(dev, &layout_info.info, nullptr, &layout));
-
-    layout_cache.emplace(hash, layout);
-
-    return layout;
+    std::scoped_lock<std::mutex> lock{m};
+    return create_layout(info);
 }
 
 DescriptorSet DescriptorCache::get_set(DescriptorKey& key, const DescriptorSetInfo& info) {
-    const VkDescriptorSetLayout layout = get_layout(info);
+    std::scoped_lock<std::mutex> lock{m};
 
-    if (!set_cache.count(key.key)) {
+    const VkDescriptorSetLayout layout = create_layout(info);
+
+    auto& sets = set_cache[frame_slot];
+    if (!sets.count(key.key)) {
         DescriptorSet set;
         set.layout = layout;
         set.set = allocate_set(layout);
-        set_cache.emplace(key.key, std::make_pair(set, info.write(dev, set.set)));
+        sets.emplace(key.key, std::make_pair(set, info.write(dev, set.set)));
         return set;
     } else {
-        auto& [set, prev_writes] = set_cache.at(key.key);
+        auto& [set, prev_writes] = sets.at(key.key);
         prev_writes = info.write_diff(dev, prev_writes, set.set);
         return set;
     }
 }
 
+void DescriptorCache::set_frame_slot(std::size_t slot) {
+    std::scoped_lock<std::mutex> lock{m};
+
+    if (slot >= set_cache.size()) {
+        set_cache.resize(slot + 1);
+    }
+    frame_slot = slot;
+}
+
 void DescriptorCache::reset_pools() {
+    std::scoped_lock<std::mutex> lock{m};
+
     for (VkDescriptorPool pool : used_pools) {
         vk_log(vkResetDescriptorPool(dev, pool, 0));
     }
@@ -266,6 +271,23 @@ void DescriptorCache::reset_pools() {
     active_pool = nullptr;
 }
 
+VkDescriptorSetLayout DescriptorCache::create_layout(const DescriptorSetInfo& info) {
+    StoredDescriptorSetLayoutCreateInfo layout_info = info.vk_layout();
+    layout_info.rebind();
+
+    const std::size_t hash = std::hash<VkDescriptorSetLayoutCreateInfo>{}(layout_info.info);
+    if (layout_cache.count(hash)) {
+        return layout_cache.at(hash);
+    }
+
+    VkDescriptorSetLayout layout;
+    vk_log(vkCreateDescriptorSetLayout(dev, &layout_info.info, nullptr, &layout));
+
+    layout_cache.emplace(hash, layout);
+
+    return layout;
+}
+
 VkDescriptorPool DescriptorCache::get_pool() {
     static constexpr std::pair<VkDescriptorType, float> pool_sizes[] = {
         {VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f},
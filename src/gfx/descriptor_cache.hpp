@@ -8,6 +8,7 @@
 #include <volk.h>
 #include <unordered_map>
 #include <span.hpp>
+#include <mutex>
 
 namespace gfx {
 
@@ -100,15 +101,21 @@ class DescriptorCache final {
     VkDescriptorSetLayout get_layout(const DescriptorSetInfo& info);
     DescriptorSet get_set(DescriptorKey& key, const DescriptorSetInfo& info);
 
+    // Sets are kept apart per frame slot, so that rewriting one never touches a set a frame still in flight is using
+    void set_frame_slot(std::size_t slot);
     void reset_pools();
 
   private:
+    VkDescriptorSetLayout create_layout(const DescriptorSetInfo& info);
     VkDescriptorPool get_pool();
     VkDescriptorSet allocate_set(VkDescriptorSetLayout layout);
 
     VkDevice dev;
+    // sets are retrieved from passes recording in parallel
+    std::mutex m;
     std::unordered_map<std::size_t, VkDescriptorSetLayout> layout_cache;
-    std::unordered_map<uint64_t, std::pair<DescriptorSet, std::vector<StoredDescriptorWrite>>> set_cache;
+    std::vector<std::unordered_map<uint64_t, std::pair<DescriptorSet, std::vector<StoredDescriptorWrite>>>> set_cache;
+    std::size_t frame_slot;
 
     VkDescriptorPool active_pool;
     std::vector<VkDescriptorPool> used_pools;
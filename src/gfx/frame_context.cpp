@@ -4,18 +4,22 @@
 #include "vk_helpers.hpp"
 #include "def.hpp"
 
+#include <iterator>
+
 namespace gfx {
 
 void wait_fence(VkDevice dev, VkCommandBuffer cmd, FrameContext fcx) {
     vk_log(vkWaitForFences(fcx.cx.dev, 1, &fcx.fence, VK_TRUE, UINT64_MAX));
-    fcx.cx.frame_pool.replace(cmd);
-    fcx.cleanup();
+    std::move(fcx).release();
 }
 
 FrameContext::FrameContext(Context& cx) : cx{cx}, owned_fence{false} {
     cmd = cx.frame_pool.take();
 }
 
+FrameContext::FrameContext(Context& cx, VkCommandBuffer cmd) : cx{cx}, cmd{cmd}, owned_fence{false} {
+}
+
 void FrameContext::copy(Buffer src, Buffer dst) {
     PK_ASSERT(src.size <= dst.size);
 
@@ -80,8 +84,10 @@ void FrameContext::copy_to_image(Buffer src, Image dst, VkImageLayout layout, ui
 }
 
 void FrameContext::stage(Buffer dst, const void* data) {
-    const VkDeviceSize size = dst.size;
+    copy(staging_buffer(data, dst.size), dst);
+}
 
+Buffer FrameContext::staging_buffer(const void* data, VkDeviceSize size) {
     VkBufferCreateInfo bci = {};
     bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
@@ -95,7 +101,7 @@ void FrameContext::stage(Buffer dst, const void* data) {
 
     vk_log(vmaFlushAllocation(cx.alloc.allocator, staging.allocation, staging.offset, size));
 
-    copy(staging, dst);
+    return staging;
 }
 
 void FrameContext::bind(Buffer buffer) {
@@ -110,6 +116,16 @@ void FrameContext::bind(std::function<void()> fn) {
     fn_binds.push_back(fn);
 }
 
+void FrameContext::join(FrameContext&& other) {
+    buffer_binds.insert(buffer_binds.end(), other.buffer_binds.begin(), other.buffer_binds.end());
+    image_binds.insert(image_binds.end(), other.image_binds.begin(), other.image_binds.end());
+    fn_binds.insert(fn_binds.end(), std::make_move_iterator(other.fn_binds.begin()), std::make_move_iterator(other.fn_binds.end()));
+
+    other.buffer_binds.clear();
+    other.image_binds.clear();
+    other.fn_binds.clear();
+}
+
 void FrameContext::begin() {
     VkCommandBufferBeginInfo cbbi = {};
     cbbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -122,21 +138,66 @@ void FrameContext::end() {
     vk_log(vkEndCommandBuffer(cmd));
 }
 
-std::future<void> FrameContext::submit(VkQueue queue) && {
-    VkFence fence;
+void FrameContext::wait_semaphore(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stage) {
+    wait_semaphores.push_back(semaphore);
+    wait_values.push_back(value);
+    wait_stages.push_back(stage);
+}
 
-    VkFenceCreateInfo fci = {};
-    fci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+void FrameContext::signal_semaphore(VkSemaphore semaphore, uint64_t value) {
+    signal_semaphores.push_back(semaphore);
+    signal_values.push_back(value);
+}
 
-    vk_log(vkCreateFence(cx.dev, &fci, nullptr, &fence));
+void FrameContext::submit_cmd(VkQueue queue, VkFence fence) {
+    VkTimelineSemaphoreSubmitInfo tssi = {};
+    tssi.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    tssi.waitSemaphoreValueCount = wait_values.size();
+    tssi.pWaitSemaphoreValues = wait_values.data();
+    tssi.signalSemaphoreValueCount = signal_values.size();
+    tssi.pSignalSemaphoreValues = signal_values.data();
 
     VkSubmitInfo si = {};
     si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    si.pNext = &tssi;
+    si.waitSemaphoreCount = wait_semaphores.size();
+    si.pWaitSemaphores = wait_semaphores.data();
+    si.pWaitDstStageMask = wait_stages.data();
+    si.signalSemaphoreCount = signal_semaphores.size();
+    si.pSignalSemaphores = signal_semaphores.data();
     si.commandBufferCount = 1;
     si.pCommandBuffers = &cmd;
 
     vk_log(vkQueueSubmit(queue, 1, &si, fence));
 
+    wait_semaphores.clear();
+    wait_values.clear();
+    wait_stages.clear();
+    signal_semaphores.clear();
+    signal_values.clear();
+}
+
+void FrameContext::split(VkQueue queue) {
+    end();
+    submit_cmd(queue, VK_NULL_HANDLE);
+
+    // Only the last command buffer is replaced after waiting on the fence
+    bind([&pool = cx.frame_pool, cmd = cmd] { pool.replace(cmd); });
+
+    cmd = cx.frame_pool.take();
+    begin();
+}
+
+std::future<void> FrameContext::submit(VkQueue queue) && {
+    VkFence fence;
+
+    VkFenceCreateInfo fci = {};
+    fci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    vk_log(vkCreateFence(cx.dev, &fci, nullptr, &fence));
+
+    submit_cmd(queue, fence);
+
     owned_fence = true;
 
     return std::move(*this).wait(fence);
@@ -148,6 +209,11 @@ std::future<void> FrameContext::wait(VkFence fence) && {
     return std::async(std::launch::async, wait_fence, cx.dev, cmd, std::move(*this));
 }
 
+void FrameContext::release() && {
+    cx.frame_pool.replace(cmd);
+    cleanup();
+}
+
 void FrameContext::cleanup() {
     for (Buffer buffer : buffer_binds) {
         cx.alloc.destroy(buffer);
@@ -21,6 +21,8 @@ struct Context;
 class FrameContext final {
   public:
     FrameContext(Context& cx);
+    // Records into an existing command buffer, e.g. a secondary command buffer on a worker thread; its binds are handed over with join().
+    FrameContext(Context& cx, VkCommandBuffer cmd);
 
     FrameContext(FrameContext&&) = default;
     FrameContext(const FrameContext&) = delete;
@@ -32,16 +34,29 @@ class FrameContext final {
     void multicopy(Buffer src, Buffer dst, tcb::span<BufferCopy> copies);
     void copy_to_image(Buffer src, Image dst, VkImageLayout layout, uint32_t bytes_per_pixel, VkImageSubresourceLayers subresource);
     void stage(Buffer dst, const void* data);
+    // A host-visible copy of data to transfer from, which lives as long as the resources bound to this
+    Buffer staging_buffer(const void* data, VkDeviceSize size);
 
     void bind(Buffer buffer);
     void bind(Image image);
     void bind(std::function<void()> fn);
+    // Takes over the resources bound to another frame context
+    void join(FrameContext&& other);
 
     void begin();
     void end();
 
+    // Semaphores waited on and signalled by the next submission of cmd (values are ignored for binary semaphores)
+    void wait_semaphore(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stage);
+    void signal_semaphore(VkSemaphore semaphore, uint64_t value);
+    void submit_cmd(VkQueue queue, VkFence fence);
+    // Submits everything recorded so far and continues recording into a new command buffer
+    void split(VkQueue queue);
+
     std::future<void> submit(VkQueue queue) &&;
     std::future<void> wait(VkFence fence) &&;
+    // Returns the command buffer and destroys the bound resources, once the caller has waited on the fence of the last submission
+    void release() &&;
 
     Context& cx;
     VkCommandBuffer cmd;
@@ -56,6 +71,12 @@ class FrameContext final {
     std::vector<Buffer> buffer_binds;
     std::vector<Image> image_binds;
     std::vector<std::function<void()>> fn_binds;
+
+    std::vector<VkSemaphore> wait_semaphores;
+    std::vector<uint64_t> wait_values;
+    std::vector<VkPipelineStageFlags> wait_stages;
+    std::vector<VkSemaphore> signal_semaphores;
+    std::vector<uint64_t> signal_values;
 };
 
 } // namespace gfx
@@ -9,14 +9,17 @@ namespace gfx {
 class FrameContext;
 class RenderGraph;
 class RenderPass;
+class View;
 
 class GFXPass {
   public:
     virtual void init(FrameContext& fcx) = 0;
     virtual void cleanup(FrameContext& fcx) = 0;
 
-    virtual void add_resources(FrameContext& fcx, RenderGraph& rg) = 0;
-    virtual std::vector<RenderPass> pass(FrameContext& fcx) = 0;
+    // Called for every view of the frame, the main view first. Work that doesn't depend on the camera is only added for the main view,
+    // and the other views use its resources.
+    virtual void add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) = 0;
+    virtual std::vector<RenderPass> pass(FrameContext& fcx, const View& view) = 0;
 };
 
 } // namespace gfx
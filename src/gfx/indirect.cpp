@@ -6,8 +6,13 @@
 #include "def.hpp"
 #include "helpers.hpp"
 #include "material.hpp"
+#include "render_graph.hpp"
+#include "scene.hpp"
 
 #include <array>
+#include <algorithm>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/fmt.h>
 #include <glm/gtx/matrix_decompose.hpp>
 #include <glm/gtx/component_wise.hpp>
 #include <glm/gtx/norm.hpp>
@@ -25,11 +30,11 @@ std::size_t std::hash<gfx::IndirectMeshKey>::operator()(const gfx::IndirectMeshK
 namespace gfx {
 
 uint32_t indirect_vertex_offset(const BufferAllocation& buf) {
-    return buf->offset / sizeof(Vertex);
+    return buf.alloc.offset / sizeof(Vertex);
 }
 
 uint32_t indirect_index_offset(const BufferAllocation& buf) {
-    return buf->offset / sizeof(uint32_t);
+    return buf.alloc.offset / sizeof(uint32_t);
 }
 
 uint32_t indirect_num_indices(const BufferAllocation& buf) {
@@ -45,62 +50,191 @@ IndirectMeshKey indirect_mesh_key(const BufferAllocation& vertices, const Buffer
 }
 
 void IndirectStorage::init(FrameContext& fcx) {
-    dev = fcx.cx.dev;
+    cx = &fcx.cx;
     dirty = true;
+    compaction = Compaction::IDLE;
+
+    // Transfers copy within the arenas when compacting them
+    vx_arena.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    vx_arena.granularity = sizeof(Vertex);
+    ix_arena.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    ix_arena.granularity = sizeof(uint32_t);
+
+    const VkDeviceSize initial = std::clamp(fcx.cx.alloc.device_budget() / 64, MIN_ARENA_BLOCK, MAX_INITIAL_ARENA_BLOCK);
+    push_block(vx_arena, initial);
+    push_block(ix_arena, initial / 2);
 
     VkBufferCreateInfo bci = {};
     bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    bci.size = MAX_MESHES * MAX_VERTICES_PER_MESH * sizeof(Vertex);
-    bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    vx_arena = fcx.cx.alloc.create_arena(FreeListAllocator{MAX_MESHES * MAX_VERTICES_PER_MESH * sizeof(Vertex)}, bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
-
-    bci.size = MAX_MESHES * MAX_INDICES_PER_MESH * sizeof(uint32_t);
-    bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-    ix_arena = fcx.cx.alloc.create_arena(FreeListAllocator{MAX_MESHES * MAX_INDICES_PER_MESH * sizeof(uint32_t)}, bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
-
     bci.size = MAX_MATERIALS * sizeof(MaterialInstance);
     bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
     material_buf = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
 
-    bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    material_staging = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_CPU_ONLY, true);
-
     textures.reserve(MAX_TEXTURES);
+
+    const uint8_t gray[4] = {128, 128, 128, 255};
+    placeholder = create_pixel_texture(fcx, VK_FORMAT_R8G8B8A8_UNORM, gray, sizeof(gray));
 }
 
 void IndirectStorage::cleanup(FrameContext& fcx) {
-    fcx.cx.alloc.destroy(*vx_arena);
-    fcx.cx.alloc.destroy(*ix_arena);
+    relocations.clear();
+
+    for (Arena* arena : {&vx_arena, &ix_arena}) {
+        for (const ArenaBlock& block : arena->blocks) {
+            fcx.cx.alloc.destroy(block.arena);
+        }
+        arena->blocks.clear();
+    }
+
     fcx.cx.alloc.destroy(material_buf);
-    fcx.cx.alloc.destroy(material_staging);
 
     for (const Texture& tex : textures) {
+        if (tex.view != placeholder.view)
+            destroy_texture(fcx.cx, tex);
+    }
+
+    for (const auto& [id, tex] : pending_textures) {
         destroy_texture(fcx.cx, tex);
     }
+
+    destroy_texture(fcx.cx, placeholder);
+}
+
+void IndirectStorage::add_resources(RenderGraph& rg) const {
+    rg.push_buffer({"scene.materials"}, {material_buf});
+}
+
+void IndirectStorage::upload(UploadRing& uploads) {
+    if (!dirty || mats.empty())
+        return;
+    dirty = false;
+
+    uploads.stage(material_buf.slice(0, sizeof(MaterialInstance) * mats.size()), mats.data());
+}
+
+void IndirectStorage::compact(FrameContext& fcx) {
+    switch (compaction) {
+    case Compaction::COPYING:
+    case Compaction::RELEASING:
+        return;
+    case Compaction::COPIED:
+        // Frames recorded from now on read the new ranges, the old ones are freed once the last frame that reads them has finished
+        for (const Relocation& relocation : relocations) {
+            if (!relocation.cancelled)
+                on_relocate(relocation.from, relocation.to);
+        }
+        compaction = Compaction::RELEASING;
+        fcx.bind([this] { release_relocations(); });
+        return;
+    case Compaction::IDLE:
+        break;
+    }
+
+    // Meshes still being uploaded on the transfer queue aren't moved from under it
+    if (fcx.cx.transfers.pending() > 0)
+        return;
+
+    VkDeviceSize budget = COMPACT_BYTES_PER_FRAME;
+    for (Arena* arena : {&vx_arena, &ix_arena}) {
+        for (uint32_t block = 0; block < arena->blocks.size(); ++block) {
+            relocate(*arena, block, budget);
+        }
+    }
+
+    if (relocations.empty())
+        return;
+
+    // The old ranges may have been written earlier in the frame
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // Ranges are moved within their block, the ranges of a move never overlap as the new one was free while the old one is in use
+    std::unordered_map<VkBuffer, std::vector<VkBufferCopy>> copies;
+    for (const Relocation& relocation : relocations) {
+        copies[relocation.from->buffer].push_back({relocation.from->offset, relocation.to->offset, relocation.from->size});
+    }
+
+    for (const auto& [buffer, regions] : copies) {
+        vkCmdCopyBuffer(fcx.cmd, buffer, buffer, regions.size(), regions.data());
+    }
+
+    // Nothing reads the new ranges until they're announced, after the frame has finished
+    compaction = Compaction::COPYING;
+    fcx.bind([this] { compaction = Compaction::COPIED; });
 }
 
-void IndirectStorage::update(FrameContext& fcx) {
-    if (dirty) {
-        dirty = false;
+void IndirectStorage::relocate(Arena& arena, uint32_t block, VkDeviceSize& budget) {
+    BufferArena<TLSFAllocator>& blk = arena.blocks[block].arena;
+    const VkDeviceSize base = arena.blocks[block].base;
+
+    const TLSFAllocator& allocator = blk.get_allocator();
+    if (allocator.fragmentation() <= COMPACT_THRESHOLD)
+        return;
 
-        ::memcpy(material_staging.pmap, mats.data(), sizeof(MaterialInstance) * mats.size());
-        vk_log(vmaFlushAllocation(fcx.cx.alloc.allocator, material_staging.allocation, material_staging.offset, sizeof(MaterialInstance) * mats.size()));
+    // Moving the highest ranges down into the holes merges the free memory at the top
+    const std::vector<ContiguousAllocation> allocs = allocator.allocations();
+    for (auto it = allocs.rbegin(); it != allocs.rend() && it->size <= budget; ++it) {
+        BufferAllocation from = blk.allocation(*it, it->size);
+        BufferAllocation to;
+        if (!blk.alloc(it->size, to))
+            break;
 
-        fcx.copy(material_staging, material_buf);
+        if (to.alloc.offset > from.alloc.offset) {
+            blk.free(to);
+            continue;
+        }
 
-        const VkBufferMemoryBarrier barrier = vk_buffer_barrier(material_buf);
-        vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+        from.alloc.offset += base;
+        to.alloc.offset += base;
+        relocations.push_back(Relocation{&arena, from, to, false});
+        budget -= it->size;
     }
 }
 
+bool IndirectStorage::cancel_relocation(const BufferAllocation& alloc) {
+    for (Relocation& relocation : relocations) {
+        if (!relocation.cancelled && relocation.from->buffer == alloc->buffer && relocation.from.alloc.offset == alloc.alloc.offset) {
+            relocation.cancelled = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void IndirectStorage::release_relocations() {
+    for (const Relocation& relocation : relocations) {
+        free(*relocation.arena, relocation.from);
+        if (relocation.cancelled)
+            free(*relocation.arena, relocation.to);
+    }
+
+    relocations.clear();
+    compaction = Compaction::IDLE;
+}
+
 uint32_t IndirectStorage::push_texture(Texture tex) {
     assert(textures.size() < MAX_TEXTURES);
     textures.push_back(tex);
     return textures.size() - 1;
 }
 
+uint32_t IndirectStorage::push_pending_texture(Texture tex) {
+    const uint32_t id = push_texture(placeholder);
+    pending_textures.emplace(id, tex);
+    return id;
+}
+
+void IndirectStorage::make_resident(uint32_t texture) {
+    textures[texture] = pending_textures.at(texture);
+    pending_textures.erase(texture);
+}
+
 uint32_t IndirectStorage::push_material(MaterialInstance mat) {
     dirty = true;
     mats.push_back(mat);
@@ -108,38 +242,128 @@ uint32_t IndirectStorage::push_material(MaterialInstance mat) {
 }
 
 BufferAllocation IndirectStorage::allocate_vertices(uint64_t num_verts) {
-    return vx_arena->alloc(num_verts * sizeof(Vertex));
+    return allocate(vx_arena, num_verts * sizeof(Vertex));
 }
 
 void IndirectStorage::free_vertices(const BufferAllocation& alloc) {
-    vx_arena->free(alloc);
+    // a range being moved is freed once the move has finished
+    if (!cancel_relocation(alloc))
+        free(vx_arena, alloc);
 }
 
 BufferAllocation IndirectStorage::allocate_indices(uint64_t num_inds) {
-    return ix_arena->alloc(num_inds * sizeof(uint32_t));
+    return allocate(ix_arena, num_inds * sizeof(uint32_t));
 }
 
 void IndirectStorage::free_indices(const BufferAllocation& alloc) {
-    ix_arena->free(alloc);
+    if (!cancel_relocation(alloc))
+        free(ix_arena, alloc);
 }
 
-Buffer IndirectStorage::vertex_buffer() const {
-    return vx_arena->buffer;
+IndirectStorage::MeshLocation IndirectStorage::locate(IndirectMeshKey mesh) const {
+    const VkDeviceSize vx_offset = VkDeviceSize{mesh.vertex_offset} * sizeof(Vertex);
+    const VkDeviceSize ix_offset = VkDeviceSize{mesh.index_offset} * sizeof(uint32_t);
+
+    MeshLocation location;
+    location.vertex_block = find_block(vx_arena, vx_offset);
+    location.index_block = find_block(ix_arena, ix_offset);
+    location.vertex_offset = (vx_offset - vx_arena.blocks[location.vertex_block].base) / sizeof(Vertex);
+    location.first_index = (ix_offset - ix_arena.blocks[location.index_block].base) / sizeof(uint32_t);
+    return location;
+}
+
+Buffer IndirectStorage::vertex_buffer(uint32_t block) const {
+    return vx_arena.blocks[block].arena.buffer;
 }
 
-Buffer IndirectStorage::index_buffer() const {
-    return ix_arena->buffer;
+Buffer IndirectStorage::index_buffer(uint32_t block) const {
+    return ix_arena.blocks[block].arena.buffer;
 }
 
 Buffer IndirectStorage::material_buffer() const {
     return material_buf;
 }
 
+IndirectStorage::ArenaStats IndirectStorage::vertex_stats() const {
+    return stats(vx_arena);
+}
+
+IndirectStorage::ArenaStats IndirectStorage::index_stats() const {
+    return stats(ix_arena);
+}
+
 const std::vector<Texture>& IndirectStorage::get_textures() const {
     return textures;
 }
 
-void IndirectMeshPass::init(FrameContext& fcx, Buffer ubo) {
+void IndirectStorage::push_block(Arena& arena, VkDeviceSize size) {
+    size -= size % arena.granularity;
+
+    VkBufferCreateInfo bci = {};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.size = size;
+    bci.usage = arena.usage;
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    const VkDeviceSize base = arena.blocks.empty() ? 0 : arena.blocks.back().base + arena.blocks.back().arena.get_allocator().size_hint();
+    arena.blocks.push_back(ArenaBlock{cx->alloc.create_arena(TLSFAllocator{size, arena.granularity}, bci, VMA_MEMORY_USAGE_GPU_ONLY, false), base});
+}
+
+BufferAllocation IndirectStorage::allocate(Arena& arena, VkDeviceSize size) {
+    BufferAllocation alloc;
+
+    // Earlier blocks are filled first
+    uint32_t block = 0;
+    while (block < arena.blocks.size() && !arena.blocks[block].arena.alloc(size, alloc)) {
+        ++block;
+    }
+
+    if (block == arena.blocks.size()) {
+        const VkDeviceSize last = arena.blocks.back().arena.get_allocator().size_hint();
+        push_block(arena, std::max(last * 2, size + arena.granularity - 1));
+        spdlog::info("grew the {} arena by a {} MiB block", arena.usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT ? "vertex" : "index",
+            arena.blocks.back().arena.get_allocator().size_hint() / (1024 * 1024));
+
+        const bool allocated = arena.blocks.back().arena.alloc(size, alloc);
+        PK_ASSERT(allocated);
+    }
+
+    alloc.alloc.offset += arena.blocks[block].base;
+    return alloc;
+}
+
+void IndirectStorage::free(Arena& arena, const BufferAllocation& alloc) {
+    ArenaBlock& block = arena.blocks[find_block(arena, alloc.alloc.offset)];
+
+    BufferAllocation local = alloc;
+    local.alloc.offset -= block.base;
+    block.arena.free(local);
+}
+
+uint32_t IndirectStorage::find_block(const Arena& arena, VkDeviceSize offset) {
+    const auto it = std::upper_bound(
+        arena.blocks.begin(), arena.blocks.end(), offset, [](VkDeviceSize offset, const ArenaBlock& block) { return offset < block.base; });
+    PK_ASSERT(it != arena.blocks.begin());
+    return static_cast<uint32_t>(it - arena.blocks.begin() - 1);
+}
+
+IndirectStorage::ArenaStats IndirectStorage::stats(const Arena& arena) {
+    ArenaStats stats = {};
+    stats.blocks = arena.blocks.size();
+
+    for (const ArenaBlock& block : arena.blocks) {
+        const TLSFAllocator& allocator = block.arena.get_allocator();
+        stats.size += allocator.size_hint();
+        stats.free += allocator.free_size();
+        stats.fragmentation = std::max(stats.fragmentation, allocator.fragmentation());
+    }
+
+    return stats;
+}
+
+void IndirectMeshPass::init(FrameContext& fcx, std::string name) {
+    this->name = std::move(name);
+
     load_shader(fcx.cx.shader_cache, "cull.comp", VK_SHADER_STAGE_COMPUTE_BIT);
 
     VkBufferCreateInfo bci = {};
@@ -150,36 +374,22 @@ void IndirectMeshPass::init(FrameContext& fcx, Buffer ubo) {
     bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
     instance_buf = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
 
-    bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    instance_staging = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_CPU_ONLY, true);
-
-    bci.size = MAX_OBJECTS * sizeof(uint32_t);
-    bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    instance_indices_buf = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
-
     bci.size = IndirectStorage::MAX_MESHES * sizeof(VkDrawIndexedIndirectCommand);
-    bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    draw_cmds = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
-
-    bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    draw_staging = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_CPU_ONLY, true);
-
-    DescriptorKey desc_key;
+    bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    draw_template = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
 
     DescriptorSetInfo set_info;
-    set_info.bind_buffer(draw_cmds, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    set_info.bind_buffer(instance_buf, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    set_info.bind_buffer(instance_indices_buf, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    set_info.bind_buffer(ubo, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    set_info.bind_buffer({}, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    set_info.bind_buffer({}, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    set_info.bind_buffer({}, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    set_info.bind_buffer({}, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
-    DescriptorSet set = fcx.cx.descriptor_cache.get_set(desc_key, set_info);
+    set_layout = fcx.cx.descriptor_cache.get_layout(set_info);
 
     VkPipelineLayoutCreateInfo plci = {};
     plci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     plci.setLayoutCount = 1;
-    plci.pSetLayouts = &set.layout;
-
-    this->set = set.set;
+    plci.pSetLayouts = &set_layout;
 
     vk_log(vkCreatePipelineLayout(fcx.cx.dev, &plci, nullptr, &layout));
 
@@ -195,32 +405,75 @@ void IndirectMeshPass::init(FrameContext& fcx, Buffer ubo) {
 
     vk_log(vkCreateComputePipelines(fcx.cx.dev, nullptr, 1, &cpci, nullptr, &pipeline));
 
-    VkEventCreateInfo eci = {};
-    eci.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO;
-
-    vk_log(vkCreateEvent(fcx.cx.dev, &eci, nullptr, &event));
+    for (const View& view : fcx.cx.scene.views) {
+        add_view(fcx, view);
+    }
 }
 
 void IndirectMeshPass::cleanup(FrameContext& fcx) {
+    for (auto& [view, buffers] : views) {
+        fcx.cx.alloc.destroy(buffers.draw_cmds);
+        fcx.cx.alloc.destroy(buffers.instance_indices);
+    }
+
     fcx.cx.alloc.destroy(instance_buf);
-    fcx.cx.alloc.destroy(instance_staging);
-    fcx.cx.alloc.destroy(instance_indices_buf);
-    fcx.cx.alloc.destroy(draw_cmds);
-    fcx.cx.alloc.destroy(draw_staging);
+    fcx.cx.alloc.destroy(draw_template);
 
     vkDestroyPipeline(fcx.cx.dev, pipeline, nullptr);
     vkDestroyPipelineLayout(fcx.cx.dev, layout, nullptr);
-    vkDestroyEvent(fcx.cx.dev, event, nullptr);
 }
 
-void IndirectMeshPass::push_mesh(IndirectMeshKey mesh, glm::vec3 center, float radius) {
+void IndirectMeshPass::add_view(FrameContext& fcx, const View& view) {
+    VkBufferCreateInfo bci = {};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    ViewBuffers buffers;
+
+    bci.size = MAX_OBJECTS * sizeof(uint32_t);
+    bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    buffers.instance_indices = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
+
+    bci.size = IndirectStorage::MAX_MESHES * sizeof(VkDrawIndexedIndirectCommand);
+    bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffers.draw_cmds = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
+
+    DescriptorSetInfo set_info;
+    set_info.bind_buffer(buffers.draw_cmds, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    set_info.bind_buffer(instance_buf, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    set_info.bind_buffer(buffers.instance_indices, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    set_info.bind_buffer(view.cull_ubo, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+
+    buffers.set = fcx.cx.descriptor_cache.get_set(buffers.desc_key, set_info).set;
+
+    views.emplace(view.name, std::move(buffers));
+}
+
+void IndirectMeshPass::remove_view(FrameContext& fcx, const View& view) {
+    const ViewBuffers& buffers = views.at(view.name);
+    fcx.bind(buffers.draw_cmds);
+    fcx.bind(buffers.instance_indices);
+    views.erase(view.name);
+}
+
+void IndirectMeshPass::push_mesh(IndirectMeshKey mesh, glm::vec3 center, float radius, bool resident) {
     batches.emplace(mesh, Cache<std::pair<IndirectObject, std::size_t>>{});
     batch_list.push_back(mesh);
     mesh_bounds.emplace(mesh, std::make_pair(center, radius));
+
+    if (!resident)
+        pending_meshes.insert(mesh);
+}
+
+void IndirectMeshPass::make_resident(IndirectMeshKey mesh) {
+    pending_meshes.erase(mesh);
 }
 
 void IndirectMeshPass::update_mesh(IndirectMeshKey old_mesh, IndirectMeshKey new_mesh, glm::vec3 center, float radius) {
     Cache<std::pair<IndirectObject, std::size_t>> val = batches.at(old_mesh);
+    for (const auto& [id, object] : val.all()) {
+        val.get({id}).first.mesh = new_mesh;
+    }
     batches.erase(old_mesh);
     batches.emplace(new_mesh, val);
 
@@ -228,6 +481,9 @@ void IndirectMeshPass::update_mesh(IndirectMeshKey old_mesh, IndirectMeshKey new
 
     mesh_bounds.erase(old_mesh);
     mesh_bounds.emplace(new_mesh, std::make_pair(center, radius));
+
+    if (pending_meshes.erase(old_mesh))
+        pending_meshes.insert(new_mesh);
 }
 
 IndirectObjectHandle IndirectMeshPass::push_object(Context& cx, IndirectObject obj) {
@@ -248,7 +504,9 @@ IndirectObjectHandle IndirectMeshPass::push_object(Context& cx, IndirectObject o
 bool IndirectMeshPass::remove_object(IndirectObjectHandle h) {
     if (batches.count(h.mesh)) {
         // TODO(jazzfool): free list to reuse removed instances for new ones
-        instances.at(batches.at(h.mesh).get(h.handle).second).batch_idx = -1;
+        const std::size_t idx = batches.at(h.mesh).get(h.handle).second;
+        instances.at(idx).batch_idx = -1;
+        instance_updates.insert(idx);
         return batches.at(h.mesh).remove(h.handle);
     } else {
         return false;
@@ -272,18 +530,7 @@ void IndirectMeshPass::update_object(Context& cx, IndirectObjectHandle h) {
 
     instances[idx].bounds = glm::vec4{center, radius};
 
-    vk_mapped_write(cx.alloc, instance_staging.slice(sizeof(GPUInstance) * idx, sizeof(GPUInstance)), &instances[idx], sizeof(GPUInstance));
-
-    if (instance_updates.count(idx) == 0) {
-        instance_updates.insert(idx);
-
-        BufferCopy copy;
-        copy.src_offset = sizeof(GPUInstance) * idx;
-        copy.dst_offset = copy.src_offset;
-        copy.size = sizeof(GPUInstance);
-
-        instance_writes.push_back(copy);
-    }
+    instance_updates.insert(idx);
 }
 
 IndirectObject& IndirectMeshPass::object(IndirectObjectHandle h) {
@@ -294,64 +541,108 @@ const IndirectObject& IndirectMeshPass::object(IndirectObjectHandle h) const {
     return batches.at(h.mesh).get(h.handle).first;
 }
 
-void IndirectMeshPass::prepare(FrameContext& fcx) {
+void IndirectMeshPass::add_resources(RenderGraph& rg, const View& view) const {
+    const ViewBuffers& buffers = views.at(view.name);
+
+    if (view.main())
+        rg.push_buffer({fmt::format("{}.instances", name)}, {instance_buf});
+    rg.push_buffer(view.resource(fmt::format("{}.draws", name)), {buffers.draw_cmds});
+    rg.push_buffer(view.resource(fmt::format("{}.instance_indices", name)), {buffers.instance_indices});
+}
+
+void IndirectMeshPass::push_passes(std::vector<RenderPass>& out, const View& view) {
+    RenderPass pass;
+    pass.name = view.resource(fmt::format("{}.cull", name)).name;
+    pass.push_buffer_input({fmt::format("{}.instances", name)}, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    pass.push_buffer_output(view.resource(fmt::format("{}.draws", name)), VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    pass.push_buffer_output(view.resource(fmt::format("{}.instance_indices", name)), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+    pass.set_compute(false);
+    pass.set_exec([this, &view](FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) { cull(fcx, view); });
+    out.push_back(std::move(pass));
+}
+
+void IndirectMeshPass::push_inputs(RenderPass& pass, const View& view) const {
+    pass.push_buffer_input(view.resource(fmt::format("{}.draws", name)), VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+    pass.push_buffer_input({fmt::format("{}.instances", name)}, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    pass.push_buffer_input(view.resource(fmt::format("{}.instance_indices", name)), VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
+
+void IndirectMeshPass::upload(UploadRing& uploads, const IndirectStorage& storage) {
     std::vector<VkDrawIndexedIndirectCommand> draws;
     draws.reserve(batches.size());
+    draw_ranges.clear();
 
     uint32_t instance_start = 0;
     for (const auto& batch : batch_list) {
+        const IndirectStorage::MeshLocation location = storage.locate(batch);
+
         VkDrawIndexedIndirectCommand draw = {};
-        draw.firstIndex = batch.index_offset;
+        draw.firstIndex = location.first_index;
         draw.firstInstance = instance_start;
         draw.instanceCount = 0;
-        draw.vertexOffset = batch.vertex_offset;
-        draw.indexCount = batch.num_indices;
+        draw.vertexOffset = location.vertex_offset;
+        draw.indexCount = pending_meshes.count(batch) ? 0 : batch.num_indices;
+
+        if (!draw_ranges.empty() && draw_ranges.back().vertex_block == location.vertex_block && draw_ranges.back().index_block == location.index_block) {
+            draw_ranges.back().count++;
+        } else {
+            draw_ranges.push_back(DrawRange{location.vertex_block, location.index_block, static_cast<uint32_t>(draws.size()), 1});
+        }
 
         draws.push_back(draw);
 
         instance_start += batches[batch].all().size();
     }
 
-    vk_mapped_write(fcx.cx.alloc, draw_staging, draws.data(), sizeof(VkDrawIndexedIndirectCommand) * draws.size());
-    fcx.copy(draw_staging, draw_cmds);
+    if (!draws.empty())
+        uploads.stage(draw_template.slice(0, sizeof(VkDrawIndexedIndirectCommand) * draws.size()), draws.data());
 
-    if (!instance_writes.empty()) {
-        fcx.multicopy(instance_staging, instance_buf, instance_writes);
-        instance_writes.clear();
-        instance_updates.clear();
+    // The ring merges the copies of neighbouring instances
+    for (std::size_t idx : instance_updates) {
+        uploads.stage(instance_buf.slice(sizeof(GPUInstance) * idx, sizeof(GPUInstance)), &instances[idx]);
     }
+    instance_updates.clear();
+}
+
+void IndirectMeshPass::cull(FrameContext& fcx, const View& view) {
+    const ViewBuffers& buffers = views.at(view.name);
 
-    const std::array<VkBufferMemoryBarrier, 2> barriers = {vk_buffer_barrier(draw_cmds), vk_buffer_barrier(instance_buf)};
-    vkCmdPipelineBarrier(
-        fcx.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, barriers.size(), barriers.data(), 0, nullptr);
+    fcx.copy(draw_template, buffers.draw_cmds);
+
+    // The graph only synchronizes between passes, the reset of the draw commands still has to be visible to the culling within this one
+    VkBufferMemoryBarrier barrier = vk_buffer_barrier(buffers.draw_cmds);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
 
     vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-    vkCmdBindDescriptorSets(fcx.cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &set, 0, nullptr);
+    vkCmdBindDescriptorSets(fcx.cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &buffers.set, 0, nullptr);
     vkCmdDispatch(fcx.cmd, instances.size(), 1, 1);
-
-    vkCmdSetEvent(fcx.cmd, event, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 }
 
-void IndirectMeshPass::execute(VkCommandBuffer cmd, const IndirectStorage& storage) {
-    const std::array<VkBufferMemoryBarrier, 2> barriers = {vk_buffer_barrier(draw_cmds), vk_buffer_barrier(instance_indices_buf)};
-    vkCmdWaitEvents(
-        cmd, 1, &event, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, nullptr, barriers.size(), barriers.data(), 0, nullptr);
+void IndirectMeshPass::execute(VkCommandBuffer cmd, const IndirectStorage& storage, const View& view) const {
+    const Buffer draw_cmds = views.at(view.name).draw_cmds;
 
-    const VkDeviceSize vx_offset = storage.vertex_buffer().offset;
-    const Buffer vx_buffer = storage.vertex_buffer();
+    for (const DrawRange& range : draw_ranges) {
+        const Buffer vx_buffer = storage.vertex_buffer(range.vertex_block);
+        const Buffer ix_buffer = storage.index_buffer(range.index_block);
 
-    vkCmdBindVertexBuffers(cmd, 0, 1, &vx_buffer.buffer, &vx_offset);
-    vkCmdBindIndexBuffer(cmd, storage.index_buffer().buffer, storage.index_buffer().offset, VK_INDEX_TYPE_UINT32);
+        vkCmdBindVertexBuffers(cmd, 0, 1, &vx_buffer.buffer, &vx_buffer.offset);
+        vkCmdBindIndexBuffer(cmd, ix_buffer.buffer, ix_buffer.offset, VK_INDEX_TYPE_UINT32);
 
-    vkCmdDrawIndexedIndirect(cmd, draw_cmds.buffer, draw_cmds.offset, batches.size(), sizeof(VkDrawIndexedIndirectCommand));
+        vkCmdDrawIndexedIndirect(cmd, draw_cmds.buffer, draw_cmds.offset + range.first * sizeof(VkDrawIndexedIndirectCommand), range.count,
+            sizeof(VkDrawIndexedIndirectCommand));
+    }
 }
 
 Buffer IndirectMeshPass::instance_buffer() const {
     return instance_buf;
 }
 
-Buffer IndirectMeshPass::instance_indices_buffer() const {
-    return instance_indices_buf;
+Buffer IndirectMeshPass::instance_indices_buffer(const View& view) const {
+    return views.at(view.name).instance_indices;
 }
 
 } // namespace gfx
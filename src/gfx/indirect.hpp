@@ -5,14 +5,16 @@
 #include "allocator.hpp"
 #include "descriptor_cache.hpp"
 #include "pipeline_cache.hpp"
+#include "signal.hpp"
 
 #include <unordered_map>
-#include <optional>
 #include <glm/mat4x4.hpp>
 #include <unordered_set>
+#include <string>
 
 namespace gfx {
 
+// The offsets are in a space spanning all the blocks of the arenas, see IndirectStorage::locate()
 struct IndirectMeshKey final {
     uint32_t vertex_offset;
     uint32_t index_offset;
@@ -35,6 +37,10 @@ struct hash<gfx::IndirectMeshKey> {
 namespace gfx {
 
 class FrameContext;
+class UploadRing;
+class RenderGraph;
+class RenderPass;
+class View;
 
 struct MaterialInstance;
 
@@ -54,43 +60,123 @@ IndirectMeshKey indirect_mesh_key(const BufferAllocation& vertices, const Buffer
 class IndirectStorage final {
   public:
     static constexpr inline uint32_t MAX_MESHES = 1024;
-    static constexpr inline uint32_t MAX_VERTICES_PER_MESH = 32000;
-    static constexpr inline uint32_t MAX_INDICES_PER_MESH = 64000;
     static constexpr inline uint32_t MAX_MATERIALS = 512;
     static constexpr inline uint32_t MAX_TEXTURES = 64;
+    // The vertex arena starts at a fraction of the device memory budget, the index arena at half of it.
+    // Once a block is full, another one at least twice as large is chained after it.
+    static constexpr inline VkDeviceSize MIN_ARENA_BLOCK = 4 * 1024 * 1024;
+    static constexpr inline VkDeviceSize MAX_INITIAL_ARENA_BLOCK = 64 * 1024 * 1024;
+    // The arenas are compacted while more than this fraction of their free memory is split off the largest free block
+    static constexpr inline float COMPACT_THRESHOLD = 0.25f;
+    static constexpr inline VkDeviceSize COMPACT_BYTES_PER_FRAME = 4 * 1024 * 1024;
+
+    // The blocks of the arenas that a mesh is in, and its offsets within them
+    struct MeshLocation final {
+        uint32_t vertex_block;
+        uint32_t index_block;
+        int32_t vertex_offset;
+        uint32_t first_index;
+    };
+
+    struct ArenaStats final {
+        uint32_t blocks;
+        VkDeviceSize size;
+        VkDeviceSize free;
+        // of the most fragmented block
+        float fragmentation;
+    };
 
     void init(FrameContext& fcx);
     void cleanup(FrameContext& fcx);
 
-    void update(FrameContext& fcx);
+    void add_resources(RenderGraph& rg) const;
+    // Stages the materials, only when they changed
+    void upload(UploadRing& uploads);
+    // Moves vertices and indices down into the holes of fragmented arenas, a few at a time.
+    // A move is copied on the GPU, announced by on_relocate once the copy has finished, and the old range is freed once no frame reads it anymore.
+    void compact(FrameContext& fcx);
 
     uint32_t push_texture(Texture tex);
+    // A texture that is still being uploaded, which a placeholder stands in for until it's made resident
+    uint32_t push_pending_texture(Texture tex);
+    void make_resident(uint32_t texture);
     uint32_t push_material(MaterialInstance mat);
 
+    // An allocation never spans two blocks, its buffer is a slice of the block it's in
     BufferAllocation allocate_vertices(uint64_t num_verts);
     void free_vertices(const BufferAllocation& alloc);
 
     BufferAllocation allocate_indices(uint64_t num_inds);
     void free_indices(const BufferAllocation& alloc);
 
-    Buffer vertex_buffer() const;
-    Buffer index_buffer() const;
+    MeshLocation locate(IndirectMeshKey mesh) const;
+    Buffer vertex_buffer(uint32_t block) const;
+    Buffer index_buffer(uint32_t block) const;
     Buffer material_buffer() const;
 
+    ArenaStats vertex_stats() const;
+    ArenaStats index_stats() const;
+
     const std::vector<Texture>& get_textures() const;
 
+    // (from, to): whoever allocated from must replace it with to, and reallocate the meshes it keys
+    Signal<const BufferAllocation&, const BufferAllocation&> on_relocate;
+
   private:
-    VkDevice dev;
+    struct ArenaBlock final {
+        BufferArena<TLSFAllocator> arena;
+        // of its offsets in the mesh keys
+        VkDeviceSize base;
+    };
+
+    struct Arena final {
+        std::vector<ArenaBlock> blocks;
+        VkBufferUsageFlags usage;
+        VkDeviceSize granularity;
+    };
+
+    enum class Compaction {
+        IDLE,
+        // the copies are recorded in a frame that hasn't finished
+        COPYING,
+        COPIED,
+        // the moves were announced, the old ranges are freed once the frame that announced them has finished
+        RELEASING,
+    };
+
+    struct Relocation final {
+        Arena* arena;
+        BufferAllocation from;
+        BufferAllocation to;
+        // from was freed during the copy, and to is freed along with it
+        bool cancelled;
+    };
 
-    std::optional<BufferArena<FreeListAllocator>> vx_arena;
-    std::optional<BufferArena<FreeListAllocator>> ix_arena;
+    void push_block(Arena& arena, VkDeviceSize size);
+    BufferAllocation allocate(Arena& arena, VkDeviceSize size);
+    void free(Arena& arena, const BufferAllocation& alloc);
+    static uint32_t find_block(const Arena& arena, VkDeviceSize offset);
+    static ArenaStats stats(const Arena& arena);
+
+    void relocate(Arena& arena, uint32_t block, VkDeviceSize& budget);
+    bool cancel_relocation(const BufferAllocation& alloc);
+    void release_relocations();
+
+    Context* cx;
+
+    Arena vx_arena;
+    Arena ix_arena;
 
     Buffer material_buf;
-    Buffer material_staging;
 
     std::vector<Texture> textures;
+    std::unordered_map<uint32_t, Texture> pending_textures;
+    Texture placeholder;
     std::vector<MaterialInstance> mats;
 
+    Compaction compaction;
+    std::vector<Relocation> relocations;
+
     bool dirty;
 };
 
@@ -103,10 +189,16 @@ class IndirectMeshPass final {
   public:
     static constexpr inline uint32_t MAX_OBJECTS = 4096;
 
-    void init(FrameContext& fcx, Buffer ubo);
+    void init(FrameContext& fcx, std::string name);
     void cleanup(FrameContext& fcx);
 
-    void push_mesh(IndirectMeshKey mesh, glm::vec3 center, float radius);
+    // Every view culls the instances into its own draw commands
+    void add_view(FrameContext& fcx, const View& view);
+    void remove_view(FrameContext& fcx, const View& view);
+
+    // Objects of a mesh that isn't resident yet are culled as usual, but draw nothing until it's made resident
+    void push_mesh(IndirectMeshKey mesh, glm::vec3 center, float radius, bool resident = true);
+    void make_resident(IndirectMeshKey mesh);
     void update_mesh(IndirectMeshKey old_mesh, IndirectMeshKey new_mesh, glm::vec3 center, float radius);
 
     IndirectObjectHandle push_object(Context& cx, IndirectObject obj);
@@ -115,11 +207,17 @@ class IndirectMeshPass final {
     IndirectObject& object(IndirectObjectHandle h);
     const IndirectObject& object(IndirectObjectHandle h) const;
 
-    void prepare(FrameContext& fcx);
-    void execute(VkCommandBuffer cmd, const IndirectStorage& storage);
+    void add_resources(RenderGraph& rg, const View& view) const;
+    // Stages the updated instances and the template of the draw commands, which every view copies before culling into it
+    void upload(UploadRing& uploads, const IndirectStorage& storage);
+    // Every view culls the instances into its draw commands
+    void push_passes(std::vector<RenderPass>& out, const View& view);
+    // Declares the reads of the draw commands and instances by a pass that executes this
+    void push_inputs(RenderPass& pass, const View& view) const;
+    void execute(VkCommandBuffer cmd, const IndirectStorage& storage, const View& view) const;
 
     Buffer instance_buffer() const;
-    Buffer instance_indices_buffer() const;
+    Buffer instance_indices_buffer(const View& view) const;
 
   private:
     struct GPUInstance final {
@@ -130,22 +228,40 @@ class IndirectMeshPass final {
         glm::vec4 bounds;
     };
 
-    VkDescriptorSet set;
+    // Consecutive draw commands of meshes in the same blocks of the arenas, which are drawn at once
+    struct DrawRange final {
+        uint32_t vertex_block;
+        uint32_t index_block;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    struct ViewBuffers final {
+        Buffer draw_cmds;
+        Buffer instance_indices;
+        DescriptorKey desc_key;
+        VkDescriptorSet set;
+    };
+
+    void cull(FrameContext& fcx, const View& view);
+
+    std::string name;
+
+    VkDescriptorSetLayout set_layout;
     VkPipeline pipeline;
     VkPipelineLayout layout;
-    VkEvent event;
 
     Buffer instance_buf;
-    Buffer instance_staging;
-    Buffer instance_indices_buf;
-    Buffer draw_cmds;
-    Buffer draw_staging;
+    Buffer draw_template;
+
+    std::unordered_map<std::string, ViewBuffers> views;
 
     std::unordered_map<IndirectMeshKey, Cache<std::pair<IndirectObject, std::size_t>>> batches;
     std::unordered_map<IndirectMeshKey, std::pair<glm::vec3, float>> mesh_bounds;
+    std::unordered_set<IndirectMeshKey> pending_meshes;
     std::vector<IndirectMeshKey> batch_list;
+    std::vector<DrawRange> draw_ranges;
     std::vector<GPUInstance> instances;
-    std::vector<BufferCopy> instance_writes;
     std::unordered_set<std::size_t> instance_updates;
 };
 
@@ -2,14 +2,14 @@
 
 #include "frame_context.hpp"
 #include "context.hpp"
+#include "render_graph.hpp"
 
 #include <fstream>
 #include <spdlog/fmt/fmt.h>
 
 namespace gfx {
 
-void MaterialShadingPass::init(Buffer ubo, std::string shader_template, PipelineInfo base) {
-    this->ubo = ubo;
+void MaterialShadingPass::init(std::string shader_template, PipelineInfo base) {
     this->shader_template = std::move(shader_template);
     this->base = std::move(base);
 }
@@ -39,7 +39,7 @@ void MaterialShadingPass::insert(FrameContext& fcx, std::string name) {
     pi.shader_stages.push_back(pssci);
 
     PassInfo info{fcx.cx.pipeline_cache.add(name, pi)};
-    info.pass.init(fcx, ubo);
+    info.pass.init(fcx, name);
 
     passes.emplace(std::hash<std::string>{}(name), std::move(info));
 }
@@ -60,36 +60,69 @@ std::vector<MaterialShadingPass::PassInfo*> MaterialShadingPass::all() {
     return out;
 }
 
-void MaterialShadingPass::prepare(FrameContext& fcx) {
+void MaterialShadingPass::add_view(FrameContext& fcx, const View& view) {
     for (auto& [key, pass] : passes) {
-        pass.pass.prepare(fcx);
+        pass.pass.add_view(fcx, view);
     }
 }
 
-void MaterialPass::init(FrameContext& fcx) {
-    VkBufferCreateInfo bci = {};
-    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    bci.size = sizeof(Uniforms);
-    bci.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-    ubo = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_CPU_TO_GPU, true);
+void MaterialShadingPass::remove_view(FrameContext& fcx, const View& view) {
+    for (auto& [key, pass] : passes) {
+        pass.pass.remove_view(fcx, view);
+    }
 }
 
-void MaterialPass::cleanup(FrameContext& fcx) {
-    fcx.cx.alloc.destroy(ubo);
+void MaterialShadingPass::add_resources(RenderGraph& rg, const View& view) const {
+    for (const auto& [key, pass] : passes) {
+        pass.pass.add_resources(rg, view);
+    }
+}
+
+void MaterialShadingPass::upload(UploadRing& uploads, const IndirectStorage& storage) {
+    for (auto& [key, pass] : passes) {
+        pass.pass.upload(uploads, storage);
+    }
 }
 
-void MaterialPass::prepare(FrameContext& fcx) {
-    vk_mapped_write(fcx.cx.alloc, ubo, &uniforms, sizeof(Uniforms));
+void MaterialShadingPass::push_passes(std::vector<RenderPass>& out, const View& view) {
+    for (auto& [key, pass] : passes) {
+        pass.pass.push_passes(out, view);
+    }
+}
+
+void MaterialPass::add_view(FrameContext& fcx, const View& view) {
+    for (auto& [key, pass] : passes) {
+        pass.add_view(fcx, view);
+    }
+}
+
+void MaterialPass::remove_view(FrameContext& fcx, const View& view) {
+    for (auto& [key, pass] : passes) {
+        pass.remove_view(fcx, view);
+    }
+}
+
+void MaterialPass::add_resources(RenderGraph& rg, const View& view) const {
+    for (const auto& [key, pass] : passes) {
+        pass.add_resources(rg, view);
+    }
+}
+
+void MaterialPass::upload(UploadRing& uploads, const IndirectStorage& storage) {
+    for (auto& [key, pass] : passes) {
+        pass.upload(uploads, storage);
+    }
+}
 
+void MaterialPass::push_passes(std::vector<RenderPass>& out, const View& view) {
     for (auto& [key, pass] : passes) {
-        pass.prepare(fcx);
+        pass.push_passes(out, view);
     }
 }
 
 void MaterialPass::insert(FrameContext& fcx, std::string_view name, std::string shader_template, PipelineInfo base) {
     MaterialShadingPass pass;
-    pass.init(ubo, shader_template, base);
+    pass.init(shader_template, base);
     passes.emplace(std::hash<std::string_view>{}(name), std::move(pass));
 }
 
@@ -23,7 +23,7 @@ class MaterialShadingPass final {
         IndirectMeshPass pass;
     };
 
-    void init(Buffer ubo, std::string shader_template, PipelineInfo base);
+    void init(std::string shader_template, PipelineInfo base);
 
     void insert(FrameContext& fcx, std::string name);
     IndirectMeshPass& pass(std::string_view name);
@@ -31,11 +31,14 @@ class MaterialShadingPass final {
 
     std::vector<PassInfo*> all();
 
-    void prepare(FrameContext& fcx);
+    void add_view(FrameContext& fcx, const View& view);
+    void remove_view(FrameContext& fcx, const View& view);
 
-  private:
-    Buffer ubo;
+    void add_resources(RenderGraph& rg, const View& view) const;
+    void upload(UploadRing& uploads, const IndirectStorage& storage);
+    void push_passes(std::vector<RenderPass>& out, const View& view);
 
+  private:
     std::string shader_template;
     PipelineInfo base;
     std::unordered_map<std::size_t, PassInfo> passes;
@@ -43,26 +46,21 @@ class MaterialShadingPass final {
 
 class MaterialPass final {
   public:
-    struct Uniforms final {
-        glm::vec4 frustum;
-        glm::vec2 near_far;
-        glm::mat4 view;
-    };
+    void add_view(FrameContext& fcx, const View& view);
+    void remove_view(FrameContext& fcx, const View& view);
 
-    void init(FrameContext& fcx);
-    void cleanup(FrameContext& fcx);
-
-    void prepare(FrameContext& fcx);
+    void add_resources(RenderGraph& rg, const View& view) const;
+    // Stages the instances and draw commands of every indirect pass
+    void upload(UploadRing& uploads, const IndirectStorage& storage);
+    // The culling passes of every indirect pass
+    void push_passes(std::vector<RenderPass>& out, const View& view);
 
     void insert(FrameContext& fcx, std::string_view name, std::string shader_template, PipelineInfo base);
     MaterialShadingPass& pass(std::string_view name);
     const MaterialShadingPass& pass(std::string_view name) const;
 
-    Uniforms uniforms;
-
   private:
     std::unordered_map<std::size_t, MaterialShadingPass> passes;
-    Buffer ubo;
 };
 
 } // namespace gfx
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "mesh.hpp"
 #include "helpers.hpp"
 #include "renderer.hpp"
+#include "view.hpp"
 
 #include <ftl/task_scheduler.h>
 #include <ftl/task_counter.h>
@@ -182,10 +183,7 @@ void PBRGraphicsPass::init(FrameContext& fcx) {
     std::vector<glm::vec2> ibl_dfg_lut_data;
 
     {
-        ftl::TaskScheduler sched;
-        sched.Init();
-
-        const auto out = integrate_dfg(sched, dfg_lut_desc.width, 1);
+        const auto out = integrate_dfg(fcx.cx.scheduler, dfg_lut_desc.width, 1);
         ec_dfg_lut_data = out[0];
         ibl_dfg_lut_data = out[1];
     }
@@ -263,19 +261,6 @@ void PBRGraphicsPass::init(FrameContext& fcx) {
 
     irrad = create_texture(fcx.cx, irrad_desc);
 
-    VkImageMemoryBarrier hdr_barrier = {};
-    hdr_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    hdr_barrier.image = hdr.image.image;
-    hdr_barrier.srcAccessMask = 0;
-    hdr_barrier.dstAccessMask = 0;
-    hdr_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    hdr_barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    hdr_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    hdr_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    hdr_barrier.subresourceRange = vk_subresource_range(0, 6, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
-
-    vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &hdr_barrier);
-
     const LoadedMesh cube = load_mesh(fmt::format("{}/meshes/{}", PK_RESOURCE_DIR, "cube.obj"));
 
     VkBufferCreateInfo cube_bci = {};
@@ -381,11 +366,10 @@ void PBRGraphicsPass::init(FrameContext& fcx) {
         pass.width = 512;
         pass.height = 512;
         pass.layers = 1;
+        pass.name = name;
         pass.push_color_output({name}, vk_clear_color({0.f, 0.f, 0.f, 1.f}));
-        pass.push_dependent(
-            {"hdr"}, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
         pass.set_exec([=](FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass) {
-            const Pipeline pipeline = fcx.cx.pipeline_cache.get(pass, 0, "ibl.equirectangular_to_cubemap");
+            const Pipeline pipeline = fcx.cx.pipeline_cache.get(rg.target(), "ibl.equirectangular_to_cubemap");
 
             vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
 
@@ -464,11 +448,10 @@ void PBRGraphicsPass::init(FrameContext& fcx) {
         pass.width = 128;
         pass.height = 128;
         pass.layers = 1;
+        pass.name = name;
         pass.push_color_output({name}, vk_clear_color({0.f, 0.f, 0.f, 1.f}));
-        pass.push_dependent(
-            {"irrad"}, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
         pass.set_exec([=](FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass) {
-            const Pipeline pipeline = fcx.cx.pipeline_cache.get(pass, 0, "ibl.equirectangular_to_cubemap");
+            const Pipeline pipeline = fcx.cx.pipeline_cache.get(rg.target(), "ibl.equirectangular_to_cubemap");
 
             vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
 
@@ -489,6 +472,7 @@ void PBRGraphicsPass::init(FrameContext& fcx) {
     }
 
     rg.set_output({"hdr"}, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    rg.push_side_effect({"irrad"});
     rg.exec(fcx, fcx.cx.rg_cache);
 
     VkImageMemoryBarrier irrad_barrier = {};
@@ -630,8 +614,8 @@ void PBRGraphicsPass::init(FrameContext& fcx) {
 
     vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &prefilter_barrier);
 
-    fcx.cx.scene.uniforms.sun_dir = glm::normalize(glm::vec4{1.f, 2.f, -1.f, 0.f});
-    fcx.cx.scene.uniforms.sun_radiant_flux = (glm::vec4{255.f, 255.f, 250.f, 255.f} / 255.f) * 50.f;
+    fcx.cx.scene.sun_dir = glm::normalize(glm::vec4{1.f, 2.f, -1.f, 0.f});
+    fcx.cx.scene.sun_radiant_flux = (glm::vec4{255.f, 255.f, 250.f, 255.f} / 255.f) * 50.f;
 
     {
         VkSamplerCreateInfo sci = {};
@@ -668,7 +652,7 @@ void PBRGraphicsPass::init(FrameContext& fcx) {
         set_info.bind_texture(ibl_dfg_lut, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
         set_info.bind_texture(prefilter, fcx.cx.sampler_cache.get(prefilter_sci), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
         set_info.bind_texture(irrad, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-        set_info.bind_buffer(fcx.cx.scene.ubo, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        set_info.bind_buffer({}, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
         set_info.bind_texture({}, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
         set_info.bind_buffer({}, VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
         set_info.bind_texture({}, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
@@ -694,42 +678,42 @@ void PBRGraphicsPass::cleanup(FrameContext& fcx) {
     destroy_texture(fcx.cx, irrad);
 }
 
-void PBRGraphicsPass::add_resources(FrameContext& fcx, RenderGraph& rg) {
+void PBRGraphicsPass::add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) {
     TextureDesc desc;
-    desc.width = fcx.cx.width;
-    desc.height = fcx.cx.height;
-    desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    desc.width = view.width;
+    desc.height = view.height;
+    desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
     desc.format = VK_FORMAT_R16G16B16A16_SFLOAT;
     desc.samples = VK_SAMPLE_COUNT_4_BIT;
 
-    const Texture out = fcx.cx.rt_cache.get("pbr.out", desc);
-
-    PassAttachment out_attachment;
-    out_attachment.tex = out;
-    out_attachment.subresource = vk_subresource_range(0, 1, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
-
-    rg.push_attachment({"pbr.out"}, out_attachment);
+    rg.push_transient(view.resource("pbr.out"), desc);
 }
 
-std::vector<RenderPass> PBRGraphicsPass::pass(FrameContext& fcx) {
+std::vector<RenderPass> PBRGraphicsPass::pass(FrameContext& fcx, const View& view) {
     RenderPass pass;
 
-    pass.width = fcx.cx.width;
-    pass.height = fcx.cx.height;
+    pass.width = view.width;
+    pass.height = view.height;
     pass.layers = 1;
-
-    pass.push_color_output({"pbr.out"}, vk_clear_color(glm::vec4{2.f, 2.f, 2.f, 255.f} / 255.f));
-    pass.set_depth_stencil({"prepass.depth.msaa"}, {});
-    pass.push_texture_input({"shadow.buffer"});
-    pass.push_texture_input({"ssao.out"});
-    pass.set_exec(mfbind(this, &PBRGraphicsPass::render));
+    pass.name = view.resource("pbr").name;
+
+    pass.push_color_output(view.resource("pbr.out"), vk_clear_color(glm::vec4{2.f, 2.f, 2.f, 255.f} / 255.f));
+    pass.set_depth_stencil(view.resource("prepass.depth.msaa"), {});
+    pass.push_texture_input(view.resource("shadow.buffer"));
+    pass.push_texture_input(view.resource("ssao.out"));
+    pass.push_buffer_input({"scene.materials"}, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    for (MaterialShadingPass::PassInfo* info : fcx.cx.scene.passes.pass("pbr").all()) {
+        info->pass.push_inputs(pass, view);
+        desc_keys.get(&info->pass, view.name);
+    }
+    pass.set_exec([this, &view](FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) { render(fcx, rg, rp, view); });
 
     return {pass};
 }
 
-void PBRGraphicsPass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) {
-    const VkViewport viewport = vk_viewport(0.f, 0.f, static_cast<float>(fcx.cx.width), static_cast<float>(fcx.cx.height), 0.f, 1.f);
-    const VkRect2D scissor = vk_rect(0, 0, fcx.cx.width, fcx.cx.height);
+void PBRGraphicsPass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp, const View& view) {
+    const VkViewport viewport = vk_viewport(0.f, 0.f, static_cast<float>(view.width), static_cast<float>(view.height), 0.f, 1.f);
+    const VkRect2D scissor = vk_rect(0, 0, view.width, view.height);
 
     vkCmdSetViewport(fcx.cmd, 0, 1, &viewport);
     vkCmdSetScissor(fcx.cmd, 0, 1, &scissor);
@@ -761,7 +745,7 @@ void PBRGraphicsPass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderP
 
         DescriptorSetInfo set_info;
         set_info.bind_buffer(pass->pass.instance_buffer(), VK_SHADER_STAGE_VERTEX_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-        set_info.bind_buffer(pass->pass.instance_indices_buffer(), VK_SHADER_STAGE_VERTEX_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        set_info.bind_buffer(pass->pass.instance_indices_buffer(view), VK_SHADER_STAGE_VERTEX_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
         set_info.bind_buffer(fcx.cx.scene.storage.material_buffer(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
         set_info.bind_textures(fcx.cx.scene.storage.get_textures(), fcx.cx.sampler_cache.get(sci), VK_SHADER_STAGE_FRAGMENT_BIT,
             VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT);
@@ -769,21 +753,21 @@ void PBRGraphicsPass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderP
         set_info.bind_texture(ibl_dfg_lut, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
         set_info.bind_texture(prefilter, fcx.cx.sampler_cache.get(prefilter_sci), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
         set_info.bind_texture(irrad, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-        set_info.bind_buffer(fcx.cx.scene.ubo, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        set_info.bind_buffer(view.ubo, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
         set_info.bind_texture(
-            rg.attachment({"shadow.buffer"}).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+            rg.attachment(view.resource("shadow.buffer")).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
         set_info.bind_buffer(rg.buffer({"shadow.ubo"}).buffer, VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
         set_info.bind_texture(
-            rg.attachment({"ssao.out"}).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+            rg.attachment(view.resource("ssao.out")).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
-        const DescriptorSet set = fcx.cx.descriptor_cache.get_set(desc_keys.get(&pass->pass), set_info);
+        const DescriptorSet set = fcx.cx.descriptor_cache.get_set(desc_keys.get(&pass->pass, view.name), set_info);
 
-        Pipeline pipeline = fcx.cx.pipeline_cache.get(rp, 0, pass->pipeline);
+        Pipeline pipeline = fcx.cx.pipeline_cache.get(rg.target(), pass->pipeline);
 
         vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
         vkCmdBindDescriptorSets(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout, 0, 1, &set.set, 0, nullptr);
 
-        pass->pass.execute(fcx.cmd, fcx.cx.scene.storage);
+        pass->pass.execute(fcx.cmd, fcx.cx.scene.storage, view);
     }
 }
 
@@ -16,10 +16,10 @@ class PBRGraphicsPass final : public GFXPass {
     void init(FrameContext& fcx) override;
     void cleanup(FrameContext& fcx) override;
 
-    void add_resources(FrameContext& fcx, RenderGraph& rg) override;
-    std::vector<RenderPass> pass(FrameContext& fcx) override;
+    void add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) override;
+    std::vector<RenderPass> pass(FrameContext& fcx, const View& view) override;
 
-    void render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp);
+    void render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp, const View& view);
 
   private:
     Texture ec_dfg_lut;
@@ -27,7 +27,7 @@ class PBRGraphicsPass final : public GFXPass {
     Texture prefilter;
     Texture irrad;
 
-    DescriptorKeyList<IndirectMeshPass*> desc_keys;
+    DescriptorKeyList<IndirectMeshPass*, std::string> desc_keys;
 };
 
 } // namespace gfx
@@ -9,7 +9,7 @@ void Pipeline::destroy(VkDevice device) {
     vkDestroyPipeline(device, pipeline, nullptr);
 }
 
-VkPipeline PipelineBuilder::build(VkDevice device, VkRenderPass pass) {
+VkPipeline PipelineBuilder::build(VkDevice device, const PipelineTarget& target) {
     VkPipelineViewportStateCreateInfo viewport_state = {};
     viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewport_state.viewportCount = 1;
@@ -23,8 +23,16 @@ VkPipeline PipelineBuilder::build(VkDevice device, VkRenderPass pass) {
     color_blending.attachmentCount = color_blend_attachments.size();
     color_blending.pAttachments = color_blend_attachments.data();
 
+    VkPipelineRenderingCreateInfoKHR prci = {};
+    prci.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+    prci.colorAttachmentCount = target.color_formats.size();
+    prci.pColorAttachmentFormats = target.color_formats.data();
+    prci.depthAttachmentFormat = target.depth_format;
+    prci.stencilAttachmentFormat = vk_has_stencil(target.depth_format) ? target.depth_format : VK_FORMAT_UNDEFINED;
+
     VkGraphicsPipelineCreateInfo pipeline_info = {};
     pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.pNext = target.pass == VK_NULL_HANDLE ? &prci : nullptr;
     pipeline_info.stageCount = shader_stages.size();
     pipeline_info.pStages = shader_stages.data();
     pipeline_info.pVertexInputState = &vertex_input_info;
@@ -34,8 +42,8 @@ VkPipeline PipelineBuilder::build(VkDevice device, VkRenderPass pass) {
     pipeline_info.pMultisampleState = &multisampling;
     pipeline_info.pColorBlendState = &color_blending;
     pipeline_info.layout = pipeline_layout;
-    pipeline_info.renderPass = pass;
-    pipeline_info.subpass = subpass;
+    pipeline_info.renderPass = target.pass;
+    pipeline_info.subpass = target.subpass;
     pipeline_info.basePipelineHandle = nullptr;
     pipeline_info.pDepthStencilState = &depth_stencil;
     pipeline_info.pDynamicState = &dynamic_state;
@@ -153,9 +161,12 @@ Pipeline SimplePipelineBuilder::build() {
     pb.dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
     pb.dynamic_state.dynamicStateCount = 2;
     pb.dynamic_state.pDynamicStates = dynamic_states;
-    pb.subpass = subpass;
 
-    auto pl = pb.build(dev, pass);
+    PipelineTarget target;
+    target.pass = pass;
+    target.subpass = subpass;
+
+    auto pl = pb.build(dev, target);
 
     Pipeline pipeline;
     pipeline.pipeline = pl;
@@ -212,17 +223,22 @@ PipelineHandle PipelineCache::add(std::string_view name, const PipelineInfo& pi)
 }
 
 PipelineHandle PipelineCache::add(PipelineHandle handle, const PipelineInfo& pi) {
+    std::scoped_lock<std::mutex> lock{m};
     pipeline_infos[handle.hash] = pi;
     return handle;
 }
 
-Pipeline PipelineCache::get(VkRenderPass pass, uint32_t subpass, std::string_view name) {
-    return get(pass, subpass, PipelineHandle{std::hash<std::string_view>{}(name)});
+Pipeline PipelineCache::get(const PipelineTarget& target, std::string_view name) {
+    return get(target, PipelineHandle{std::hash<std::string_view>{}(name)});
 }
 
-Pipeline PipelineCache::get(VkRenderPass pass, uint32_t subpass, PipelineHandle handle) {
+Pipeline PipelineCache::get(const PipelineTarget& target, PipelineHandle handle) {
+    std::scoped_lock<std::mutex> lock{m};
+
     std::size_t hash = 0;
-    hash_combine(hash, reinterpret_cast<void*>(pass), handle.hash);
+    hash_combine(hash, reinterpret_cast<void*>(target.pass), target.subpass, target.depth_format, handle.hash);
+    for (const VkFormat format : target.color_formats)
+        hash_combine(hash, format);
 
     const PipelineInfo& info = pipeline_infos.at(handle.hash);
 
@@ -263,13 +279,15 @@ Pipeline PipelineCache::get(VkRenderPass pass, uint32_t subpass, PipelineHandle
         pb.depth_stencil = info.depth_stencil;
         pb.dynamic_state = info.dynamic_state;
         pb.cache = cache;
-        pb.subpass = subpass;
 
         Pipeline pipe;
-        pipe.pipeline = pb.build(dev, pass);
+        pipe.pipeline = pb.build(dev, target);
         pipe.layout = pipeline_layout;
 
         pipelines[hash] = pipe;
+
+        if (target.pass != VK_NULL_HANDLE)
+            pass_pipelines[target.pass].push_back(hash);
     }
 
     return pipelines.at(hash);
@@ -280,6 +298,7 @@ PipelineInfo PipelineCache::info(std::string_view name) {
 }
 
 PipelineInfo PipelineCache::info(PipelineHandle handle) {
+    std::scoped_lock<std::mutex> lock{m};
     return pipeline_infos.at(handle.hash);
 }
 
@@ -288,7 +307,26 @@ bool PipelineCache::contains(std::string_view name) const {
 }
 
 bool PipelineCache::contains(PipelineHandle handle) const {
+    std::scoped_lock<std::mutex> lock{m};
     return pipeline_infos.count(handle.hash) == 1;
 }
 
+std::vector<Pipeline> PipelineCache::evict(VkRenderPass pass) {
+    std::scoped_lock<std::mutex> lock{m};
+
+    std::vector<Pipeline> evicted;
+
+    auto it = pass_pipelines.find(pass);
+    if (it == pass_pipelines.end())
+        return evicted;
+
+    for (const std::size_t hash : it->second) {
+        evicted.push_back(pipelines.at(hash));
+        pipelines.erase(hash);
+    }
+
+    pass_pipelines.erase(it);
+    return evicted;
+}
+
 } // namespace gfx
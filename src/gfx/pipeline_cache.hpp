@@ -8,6 +8,7 @@
 #include <vector>
 #include <string_view>
 #include <unordered_map>
+#include <mutex>
 
 namespace gfx {
 
@@ -20,6 +21,14 @@ struct Pipeline final {
     VkPipelineLayout layout;
 };
 
+// What a graphics pipeline renders into: a subpass of a render pass, or attachments of the given formats when rendering without a render pass
+struct PipelineTarget final {
+    VkRenderPass pass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    std::vector<VkFormat> color_formats;
+    VkFormat depth_format = VK_FORMAT_UNDEFINED;
+};
+
 class PipelineBuilder final {
   public:
     std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
@@ -32,9 +41,8 @@ class PipelineBuilder final {
     VkPipelineDepthStencilStateCreateInfo depth_stencil;
     VkPipelineCache cache;
     VkPipelineDynamicStateCreateInfo dynamic_state;
-    uint32_t subpass;
 
-    VkPipeline build(VkDevice device, VkRenderPass pass);
+    VkPipeline build(VkDevice device, const PipelineTarget& target);
 };
 
 struct PipelineInfo final {
@@ -110,8 +118,8 @@ class PipelineCache final {
     PipelineHandle add(std::string_view name, const PipelineInfo& pi);
     PipelineHandle add(PipelineHandle handle, const PipelineInfo& pi);
 
-    Pipeline get(VkRenderPass pass, uint32_t subpass, std::string_view name);
-    Pipeline get(VkRenderPass pass, uint32_t subpass, PipelineHandle handle);
+    Pipeline get(const PipelineTarget& target, std::string_view name);
+    Pipeline get(const PipelineTarget& target, PipelineHandle handle);
 
     PipelineInfo info(std::string_view name);
     PipelineInfo info(PipelineHandle handle);
@@ -119,13 +127,18 @@ class PipelineCache final {
     bool contains(std::string_view name) const;
     bool contains(PipelineHandle handle) const;
 
+    // Forgets the pipelines created for a render pass that is being destroyed; the caller destroys them once the GPU is done with them
+    std::vector<Pipeline> evict(VkRenderPass pass);
+
     VkPipelineCache cache;
 
   private:
     DescriptorCache* dc;
     VkDevice dev;
+    mutable std::mutex m;
     std::unordered_map<std::size_t, PipelineInfo> pipeline_infos;
     std::unordered_map<std::size_t, Pipeline> pipelines;
+    std::unordered_map<VkRenderPass, std::vector<std::size_t>> pass_pipelines;
 };
 
 } // namespace gfx
@@ -11,13 +11,13 @@ class PrepassPass final : public GFXPass {
     void init(FrameContext& fcx) override;
     void cleanup(FrameContext& fcx) override;
 
-    void add_resources(FrameContext& fcx, RenderGraph& rg) override;
-    std::vector<RenderPass> pass(FrameContext& fcx) override;
+    void add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) override;
+    std::vector<RenderPass> pass(FrameContext& fcx, const View& view) override;
 
   private:
-    void render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass);
+    void render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass, const View& view);
 
-    DescriptorKey desc_key;
+    DescriptorKeyList<std::string> desc_keys;
 };
 
 } // namespace gfx
@@ -6,6 +6,14 @@
 #include "context.hpp"
 
 #include <unordered_set>
+#include <numeric>
+#include <limits>
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+#include <spdlog/fmt/fmt.h>
+#include <ftl/task_scheduler.h>
+#include <ftl/task_counter.h>
 
 std::size_t std::hash<gfx::Name>::operator()(const gfx::Name& name) const {
     std::size_t h = 0;
@@ -15,6 +23,44 @@ std::size_t std::hash<gfx::Name>::operator()(const gfx::Name& name) const {
 
 namespace gfx {
 
+// Passes are recorded on the worker threads, so the subpass being recorded is tracked per thread
+static thread_local uint32_t current_subpass = 0;
+static thread_local const PipelineTarget* current_target = nullptr;
+// Versions of transients as seen by the pass
+static thread_local const std::unordered_map<Name, Name>* current_versions = nullptr;
+
+// Topology keys are the bytes of everything a compiled graph depends on, so that graphs are compared in full rather than by a hash
+template <typename T>
+static void append_key(std::string& key, const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Length prefixed, so that consecutive names can't run into each other
+static void append_key(std::string& key, const Name& name) {
+    append_key(key, name.name.size());
+    key += name.name;
+}
+
+template <typename T>
+static void append_key(std::string& key, const std::optional<T>& value) {
+    append_key(key, value.has_value());
+    if (value.has_value())
+        append_key(key, *value);
+}
+
+template <typename... Ts>
+static void append_keys(std::string& key, const Ts&... values) {
+    (append_key(key, values), ...);
+}
+
+static std::size_t hash_desc(const TextureDesc& desc) {
+    std::size_t h = 0;
+    hash_combine(h, desc.flags, desc.type, desc.view_type, desc.aspect, desc.width, desc.height, desc.depth, desc.layers, desc.mips, desc.samples,
+        desc.usage, desc.format);
+    return h;
+}
+
 void RenderPass::set_depth_stencil(Name name, std::optional<VkClearDepthStencilValue> clear) {
     depth_stencil = std::make_pair(name, clear);
 }
@@ -35,12 +81,24 @@ void RenderPass::push_texture_input(Name name) {
     texture_inputs.push_back(name);
 }
 
-void RenderPass::push_dependency(Name name, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access, bool virt) {
-    dependencies.push_back(std::make_pair(name, Dependency{layout, stage, access, virt}));
+void RenderPass::push_storage_output(Name name) {
+    storage_outputs.push_back(name);
+}
+
+void RenderPass::push_dependency(Name name, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access) {
+    dependencies.push_back(std::make_pair(name, Dependency{layout, stage, access}));
+}
+
+void RenderPass::push_dependent(Name name, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access) {
+    dependents.push_back(std::make_pair(name, Dependency{layout, stage, access}));
 }
 
-void RenderPass::push_dependent(Name name, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access, bool virt) {
-    dependents.push_back(std::make_pair(name, Dependency{layout, stage, access, virt}));
+void RenderPass::push_buffer_input(Name name, VkPipelineStageFlags stage, VkAccessFlags access) {
+    buffer_inputs.push_back(std::make_pair(name, BufferAccess{stage, access}));
+}
+
+void RenderPass::push_buffer_output(Name name, VkPipelineStageFlags stage, VkAccessFlags access) {
+    buffer_outputs.push_back(std::make_pair(name, BufferAccess{stage, access}));
 }
 
 void RenderPass::set_pre_exec(std::function<void(FrameContext&, const RenderGraph&, VkRenderPass)> pre_exec) {
@@ -51,51 +109,267 @@ void RenderPass::set_exec(std::function<void(FrameContext&, const RenderGraph&,
     this->exec = std::move(exec);
 }
 
-void RenderGraphCache::init(VkDevice dev) {
-    this->dev = dev;
+void RenderPass::set_compute(bool async) {
+    compute = true;
+    this->async = async;
+}
+
+void RenderPass::set_predicate(std::function<bool()> predicate) {
+    this->predicate = std::move(predicate);
+}
+
+void RenderGraphCache::init(Context& cx) {
+    this->cx = &cx;
+
+    VkSemaphoreTypeCreateInfo stci = {};
+    stci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    stci.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    stci.initialValue = 0;
+
+    VkSemaphoreCreateInfo sci = {};
+    sci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    sci.pNext = &stci;
+
+    vk_log(vkCreateSemaphore(cx.dev, &sci, nullptr, &gfx_timeline));
+    vk_log(vkCreateSemaphore(cx.dev, &sci, nullptr, &compute_timeline));
+
+    secondary_pools = std::vector<CommandPool>(cx.scheduler.GetThreadCount());
+    for (CommandPool& pool : secondary_pools) {
+        pool.init(cx, cx.gfx_queue_idx, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+    }
 }
 
 void RenderGraphCache::cleanup() {
     clear();
+
+    for (VkEvent event : events) {
+        vkDestroyEvent(cx->dev, event, nullptr);
+    }
+
+    events.clear();
+
+    vkDestroySemaphore(cx->dev, gfx_timeline, nullptr);
+    vkDestroySemaphore(cx->dev, compute_timeline, nullptr);
+
+    for (CommandPool& pool : secondary_pools) {
+        pool.cleanup();
+    }
 }
 
 void RenderGraphCache::clear() {
-    for (const auto& [hash, pass] : passes) {
-        vkDestroyRenderPass(dev, pass, nullptr);
-    }
+    clear_graphs();
 
-    for (const auto& [hash, fb] : framebuffers) {
-        vkDestroyFramebuffer(dev, fb, nullptr);
+    for (const auto& [hash, entries] : passes) {
+        for (const auto& entry : entries) {
+            vkDestroyRenderPass(cx->dev, entry.handle, nullptr);
+        }
     }
 
     passes.clear();
+}
+
+void RenderGraphCache::clear_graphs() {
+    for (auto& [hash, graph] : graphs) {
+        destroy(graph);
+    }
+
+    for (const auto& [name, history] : histories) {
+        for (const Texture& image : history.images) {
+            destroy_texture(*cx, image);
+        }
+    }
+
+    // Framebuffers of resized attachments would never be looked up again
+    for (const auto& [hash, entries] : framebuffers) {
+        for (const auto& entry : entries) {
+            vkDestroyFramebuffer(cx->dev, entry.handle, nullptr);
+        }
+    }
+
+    graphs.clear();
     framebuffers.clear();
+    histories.clear();
 }
 
-VkRenderPass RenderGraphCache::create_pass(const VkRenderPassCreateInfo& rpci) {
-    const std::size_t h = std::hash<VkRenderPassCreateInfo>{}(rpci);
+RenderGraphCache::StoredRenderPass::StoredRenderPass(const VkRenderPassCreateInfo& rpci)
+    : info(rpci), attachments(rpci.pAttachments, rpci.pAttachments + rpci.attachmentCount), subpasses(rpci.pSubpasses, rpci.pSubpasses + rpci.subpassCount),
+      dependencies(rpci.pDependencies, rpci.pDependencies + rpci.dependencyCount) {
+    std::size_t reference_count = 0;
+    std::size_t preserve_count = 0;
+    for (const VkSubpassDescription& subpass : subpasses) {
+        reference_count += subpass.inputAttachmentCount + subpass.colorAttachmentCount;
+        reference_count += subpass.pResolveAttachments != nullptr ? subpass.colorAttachmentCount : 0;
+        reference_count += subpass.pDepthStencilAttachment != nullptr ? 1 : 0;
+        preserve_count += subpass.preserveAttachmentCount;
+    }
+
+    // Reserved up front, so the arrays don't move while the subpasses are pointed into them
+    references.reserve(reference_count);
+    preserved.reserve(preserve_count);
 
-    if (passes.count(h)) {
-        return passes.at(h);
+    const auto copy = [](auto& storage, const auto* data, uint32_t count) -> decltype(data) {
+        if (data == nullptr)
+            return nullptr;
+
+        const std::size_t offset = storage.size();
+        storage.insert(storage.end(), data, data + count);
+        return storage.data() + offset;
+    };
+
+    for (VkSubpassDescription& subpass : subpasses) {
+        subpass.pInputAttachments = copy(references, subpass.pInputAttachments, subpass.inputAttachmentCount);
+        subpass.pColorAttachments = copy(references, subpass.pColorAttachments, subpass.colorAttachmentCount);
+        subpass.pResolveAttachments = copy(references, subpass.pResolveAttachments, subpass.colorAttachmentCount);
+        subpass.pDepthStencilAttachment = copy(references, subpass.pDepthStencilAttachment, 1);
+        subpass.pPreserveAttachments = copy(preserved, subpass.pPreserveAttachments, subpass.preserveAttachmentCount);
+    }
+
+    info.pNext = nullptr;
+    info.pAttachments = attachments.data();
+    info.pSubpasses = subpasses.data();
+    info.pDependencies = dependencies.data();
+}
+
+RenderGraphCache::StoredFramebuffer::StoredFramebuffer(const VkFramebufferCreateInfo& fbci)
+    : info(fbci), views(fbci.pAttachments, fbci.pAttachments + fbci.attachmentCount) {
+    info.pNext = nullptr;
+    info.pAttachments = views.data();
+}
+
+template <typename Stored, typename Handle, typename Info, typename F>
+Handle RenderGraphCache::find_or_create(std::unordered_map<std::size_t, std::vector<Entry<Stored, Handle>>>& entries, const Info& info, F&& create) {
+    std::vector<Entry<Stored, Handle>>& bucket = entries[std::hash<Info>{}(info)];
+
+    for (Entry<Stored, Handle>& entry : bucket) {
+        if (entry.stored.info == info) {
+            entry.last_use = frame;
+            return entry.handle;
+        }
     }
 
-    VkRenderPass rp;
-    vk_log(vkCreateRenderPass(dev, &rpci, nullptr, &rp));
-    passes.emplace(h, rp);
-    return rp;
+    const Handle handle = create();
+    bucket.push_back(Entry<Stored, Handle>{Stored{info}, handle, frame});
+    return handle;
+}
+
+VkRenderPass RenderGraphCache::create_pass(const VkRenderPassCreateInfo& rpci) {
+    return find_or_create(passes, rpci, [&] {
+        VkRenderPass rp;
+        vk_log(vkCreateRenderPass(cx->dev, &rpci, nullptr, &rp));
+        return rp;
+    });
 }
 
 VkFramebuffer RenderGraphCache::create_framebuffer(const VkFramebufferCreateInfo& fbci) {
-    const std::size_t h = std::hash<VkFramebufferCreateInfo>{}(fbci);
+    return find_or_create(framebuffers, fbci, [&] {
+        VkFramebuffer fb;
+        vk_log(vkCreateFramebuffer(cx->dev, &fbci, nullptr, &fb));
+        return fb;
+    });
+}
+
+void RenderGraphCache::evict(FrameContext& fcx) {
+    const auto unused = [this](uint64_t last_use) { return frame - last_use > max_unused_frames; };
+
+    // Render passes are referenced by the graphs compiled with them, so they're only evicted along with the last of those
+    std::unordered_set<VkRenderPass> used_passes;
+
+    for (auto it = graphs.begin(); it != graphs.end();) {
+        if (unused(it->second.last_use)) {
+            fcx.bind([this, graph = std::move(it->second)]() mutable { destroy(graph); });
+            it = graphs.erase(it);
+            continue;
+        }
+
+        for (const CompiledRenderGraph::Pass& pass : it->second.passes) {
+            used_passes.insert(pass.rp);
+        }
+
+        ++it;
+    }
+
+    for (auto it = framebuffers.begin(); it != framebuffers.end();) {
+        auto& bucket = it->second;
+        for (auto entry = bucket.begin(); entry != bucket.end();) {
+            if (unused(entry->last_use)) {
+                fcx.bind([dev = cx->dev, fb = entry->handle] { vkDestroyFramebuffer(dev, fb, nullptr); });
+                entry = bucket.erase(entry);
+            } else {
+                ++entry;
+            }
+        }
+
+        it = bucket.empty() ? framebuffers.erase(it) : std::next(it);
+    }
+
+    for (auto it = passes.begin(); it != passes.end();) {
+        auto& bucket = it->second;
+        for (auto entry = bucket.begin(); entry != bucket.end();) {
+            if (unused(entry->last_use) && !used_passes.count(entry->handle)) {
+                // Pipelines are cached per render pass, and a new render pass could be created with the same handle
+                fcx.bind([dev = cx->dev, rp = entry->handle, pipelines = cx->pipeline_cache.evict(entry->handle)] {
+                    for (Pipeline pipeline : pipelines) {
+                        pipeline.destroy(dev);
+                    }
+                    vkDestroyRenderPass(dev, rp, nullptr);
+                });
+                entry = bucket.erase(entry);
+            } else {
+                ++entry;
+            }
+        }
+
+        it = bucket.empty() ? passes.erase(it) : std::next(it);
+    }
+}
+
+VkEvent RenderGraphCache::take_event() {
+    std::scoped_lock<std::mutex> lock{events_m};
+
+    if (events.empty()) {
+        VkEventCreateInfo eci = {};
+        eci.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO;
+
+        VkEvent event;
+        vk_log(vkCreateEvent(cx->dev, &eci, nullptr, &event));
+
+        return event;
+    }
+
+    VkEvent event = events.back();
+    events.pop_back();
+
+    return event;
+}
+
+void RenderGraphCache::replace_event(VkEvent event) {
+    std::scoped_lock<std::mutex> lock{events_m};
+
+    vk_log(vkResetEvent(cx->dev, event));
+    events.push_back(event);
+}
+
+void RenderGraphCache::wait_compute(FrameContext& fcx, VkPipelineStageFlags stages) const {
+    if (compute_value > 0)
+        fcx.wait_semaphore(compute_timeline, compute_value, stages);
+}
+
+const RenderGraphStats& RenderGraphCache::stats() const {
+    return last_stats;
+}
+
+const std::string& RenderGraphCache::schedule() const {
+    return last_schedule;
+}
 
-    if (framebuffers.count(h)) {
-        return framebuffers.at(h);
+void RenderGraphCache::destroy(CompiledRenderGraph& graph) {
+    for (const auto& [name, attachment] : graph.transients) {
+        destroy_texture(*cx, attachment.tex);
     }
 
-    VkFramebuffer fb;
-    vk_log(vkCreateFramebuffer(dev, &fbci, nullptr, &fb));
-    framebuffers.emplace(h, fb);
-    return fb;
+    for (VmaAllocation heap : graph.heaps) {
+        cx->alloc.destroy(heap);
+    }
 }
 
 void RenderGraph::push_pass(RenderPass pass) {
@@ -106,6 +380,10 @@ void RenderGraph::push_attachment(Name name, PassAttachment attachment) {
     attachments.emplace(name, attachment);
 }
 
+void RenderGraph::push_transient(Name name, const TextureDesc& desc) {
+    transients.emplace(name, desc);
+}
+
 void RenderGraph::push_buffer(Name name, PassBuffer buffer) {
     buffers.emplace(name, buffer);
 }
@@ -114,10 +392,34 @@ void RenderGraph::push_initial_layout(Name name, VkImageLayout layout) {
     initial_layouts.emplace(name, layout);
 }
 
+void RenderGraph::push_history(Name name, const TextureDesc& desc, uint32_t frames) {
+    PK_ASSERT(frames > 0);
+    histories.emplace(name, std::make_pair(desc, frames));
+}
+
+Name RenderGraph::history(const Name& name, uint32_t age) {
+    return {name.name + ".history." + std::to_string(age)};
+}
+
 PassAttachment RenderGraph::attachment(Name name) const {
+    if (current_versions != nullptr) {
+        const auto version = current_versions->find(name);
+        if (version != current_versions->end())
+            return attachments.at(version->second);
+    }
+
     return attachments.at(name);
 }
 
+uint32_t RenderGraph::subpass() const {
+    return current_subpass;
+}
+
+const PipelineTarget& RenderGraph::target() const {
+    PK_ASSERT(current_target != nullptr);
+    return *current_target;
+}
+
 PassBuffer RenderGraph::buffer(Name name) const {
     return buffers.at(name);
 }
@@ -127,491 +429,2073 @@ void RenderGraph::set_output(Name name, VkImageLayout layout) {
     output_layout = layout;
 }
 
-void RenderGraph::exec(FrameContext& fcx, RenderGraphCache& cache) {
-    // Validation
-    for (const RenderPass& pass : passes) {
-        if (pass.depth_stencil.has_value())
-            PK_ASSERT(attachments.count(pass.depth_stencil.value().first));
+void RenderGraph::push_side_effect(Name name) {
+    side_effects.push_back(std::move(name));
+}
 
-        for (const auto& [res, _] : pass.color_outputs)
-            PK_ASSERT(attachments.count(res));
+template <typename F>
+void RenderGraph::for_each_attachment(const RenderPass& pass, F&& f) {
+    for (const auto& [name, self, clear] : pass.input_attachments)
+        f(name);
 
-        for (const auto& [res, _] : pass.resolve_outputs)
-            PK_ASSERT(attachments.count(res));
+    for (const Name& name : pass.texture_inputs)
+        f(name);
 
-        for (const auto& [res, _a, _b] : pass.input_attachments)
-            PK_ASSERT(attachments.count(res));
+    for (const auto& [name, dep] : pass.dependencies)
+        f(name);
 
-        for (const Name& res : pass.texture_inputs)
-            PK_ASSERT(attachments.count(res));
+    for (const Name& name : pass.storage_outputs)
+        f(name);
 
-        for (const auto& [res, _] : pass.dependencies)
-            PK_ASSERT(attachments.count(res));
+    if (pass.depth_stencil.has_value())
+        f(pass.depth_stencil->first);
 
-        for (const auto& [res, _] : pass.dependents)
-            PK_ASSERT(attachments.count(res));
-    }
+    for (const auto& [name, clear] : pass.color_outputs)
+        f(name);
 
-    // Bottom-up dependency traversal
-    std::vector<std::size_t> pass_list;
-    push_writers(pass_list, output);
+    for (const auto& [name, clear] : pass.resolve_outputs)
+        f(name);
 
-    // Reverse ordering
-    std::reverse(pass_list.begin(), pass_list.end());
+    for (const auto& [name, dep] : pass.dependents)
+        f(name);
+}
 
-    // Prune duplicates
-    std::unordered_set<std::size_t> seen_passes;
-    pass_list.erase(std::remove_if(pass_list.begin(), pass_list.end(),
-                        [&seen_passes](std::size_t i) {
-                            if (seen_passes.count(i))
-                                return true;
-                            seen_passes.insert(i);
-                            return false;
-                        }),
-        pass_list.end());
+template <typename F>
+void RenderGraph::for_each_buffer(const RenderPass& pass, F&& f) {
+    for (const auto& [name, use] : pass.buffer_inputs)
+        f(name, use, false);
 
-    // Find the passes that aren't in the list and push them onto the end
-    // This is mostly fine since passes can only be left out if they don't write to anything (but presumably read with side effects).
-    for (std::size_t i = 0; i < passes.size(); ++i) {
-        if (!seen_passes.count(i))
-            pass_list.push_back(i);
-    }
+    for (const auto& [name, use] : pass.buffer_outputs)
+        f(name, use, true);
+}
 
-    struct Attachment final {
-        PassAttachment attachment;
-        VkImageLayout layout;
-        VkPipelineStageFlags stage;
-        VkAccessFlags access;
-    };
+void RenderGraph::rotate_histories(FrameContext& fcx, RenderGraphCache& cache) {
+    for (const auto& [name, desc_frames] : histories) {
+        const auto& [desc, frames] = desc_frames;
+        const std::size_t desc_hash = hash_desc(desc);
+
+        RenderGraphCache::History& history = cache.histories[name];
+        if (history.images.size() != frames + 1 || history.desc_hash != desc_hash) {
+            // Previous frames may still be using the old images
+            fcx.bind([&cx = fcx.cx, images = std::move(history.images)] {
+                for (const Texture& image : images) {
+                    destroy_texture(cx, image);
+                }
+            });
 
-    // Track resources
-    std::unordered_map<Name, Attachment> tracked_attachments;
-    tracked_attachments.reserve(attachments.size());
+            history.desc_hash = desc_hash;
+            history.images.clear();
+            for (uint32_t i = 0; i <= frames; ++i) {
+                history.images.push_back(create_texture(*cache.cx, desc));
+            }
+            history.layouts.assign(frames + 1, VK_IMAGE_LAYOUT_UNDEFINED);
+            history.current = 0;
+        } else {
+            history.current = (history.current + 1) % history.images.size();
+        }
 
-    for (const auto& [name, attachment] : attachments) {
-        Attachment tracked;
-        tracked.attachment = attachment;
-        tracked.layout = VK_IMAGE_LAYOUT_UNDEFINED;
-        tracked.stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        tracked.access = 0;
+        for (uint32_t age = 0; age <= frames; ++age) {
+            const uint32_t i = (history.current + history.images.size() - age) % history.images.size();
+            const Name image_name = age == 0 ? name : RenderGraph::history(name, age);
 
-        if (initial_layouts.count(name)) {
-            tracked.layout = initial_layouts.at(name);
-        }
+            PassAttachment attachment;
+            attachment.tex = history.images[i];
+            attachment.subresource = vk_subresource_range(0, desc.layers, 0, desc.mips, desc.aspect);
+            push_attachment(image_name, attachment);
 
-        tracked_attachments.emplace(name, tracked);
+            if (history.layouts[i] != VK_IMAGE_LAYOUT_UNDEFINED)
+                push_initial_layout(image_name, history.layouts[i]);
+        }
     }
+}
 
-    // Execute
-    for (const size_t i : pass_list) {
-        const RenderPass& pass = passes[i];
+void RenderGraph::exec(FrameContext& fcx, RenderGraphCache& cache) {
+    rotate_histories(fcx, cache);
 
-        std::vector<VkImageMemoryBarrier> barriers;
+    enabled.resize(passes.size());
+    for (std::size_t i = 0; i < passes.size(); ++i) {
+        enabled[i] = !passes[i].predicate || passes[i].predicate();
+    }
 
-        VkPipelineStageFlags src_stages = 0;
-        VkPipelineStageFlags dst_stages = 0;
+    std::string key = topology();
+    const std::size_t hash = std::hash<std::string>{}(key);
 
-        std::vector<VkAttachmentDescription> attachments;
-        std::vector<VkImageView> framebuffer_attachments;
-        std::vector<VkClearValue> clear_values;
-        std::vector<VkAttachmentReference> input_attachments;
-        std::vector<VkAttachmentReference> color_attachments;
-        std::vector<VkAttachmentReference> resolve_attachments;
-        std::optional<VkAttachmentReference> depth_stencil_attachment;
-
-        static constexpr auto make_barrier = [](Attachment& attachment, VkAccessFlags access, VkImageLayout layout) -> VkImageMemoryBarrier {
-            VkImageMemoryBarrier barrier = {};
-            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            barrier.image = attachment.attachment.tex.image.image;
-            barrier.srcAccessMask = attachment.access;
-            barrier.dstAccessMask = access;
-            barrier.oldLayout = attachment.layout;
-            barrier.newLayout = layout;
-            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            barrier.subresourceRange = attachment.attachment.subresource;
-            return barrier;
-        };
+    // Graphs whose topologies hash the same are told apart by comparing the topologies in full
+    const auto [begin, end] = cache.graphs.equal_range(hash);
+    auto it = std::find_if(begin, end, [&](const auto& entry) { return entry.second.topology == key; });
+    if (it == end) {
+        it = cache.graphs.emplace(hash, compile(cache));
+        it->second.topology = std::move(key);
+    }
 
-        // Wait for any past usage
-        for (const auto& [name, self, clear] : pass.input_attachments) {
-            Attachment& attachment = tracked_attachments[name];
+    CompiledRenderGraph& graph = it->second;
 
-            VkAccessFlags access = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
-            VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    cache.frame++;
+    graph.last_use = cache.frame;
+    cache.evict(fcx);
 
-            if (self) {
-                access |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-                layout = VK_IMAGE_LAYOUT_GENERAL;
-                dst_stage |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    attachments.insert(graph.transients.begin(), graph.transients.end());
 
-                VkClearValue val;
-                if (clear.has_value()) {
-                    val.color = clear.value();
-                } else {
-                    val.color.float32[0] = 0.f;
-                    val.color.float32[1] = 0.f;
-                    val.color.float32[2] = 0.f;
-                    val.color.float32[3] = 0.f;
-                }
+    // Events are only reset (and reused) once the frame has finished on the GPU
+    std::vector<VkEvent> events(graph.event_count);
+    for (VkEvent& event : events) {
+        event = cache.take_event();
+    }
 
-                clear_values.push_back(val);
+    if (!events.empty()) {
+        fcx.bind([&cache, events] {
+            for (VkEvent event : events) {
+                cache.replace_event(event);
             }
+        });
+    }
 
-            src_stages |= attachment.stage;
-            dst_stages |= dst_stage;
+    RenderGraphStats stats;
+    stats.passes = passes.size() - graph.culled_passes;
+    stats.elided_barriers = graph.elided_barriers;
+    stats.culled_passes = graph.culled_passes;
+
+    std::vector<VkImageMemoryBarrier> barriers;
+    std::vector<VkBufferMemoryBarrier> buffer_barriers;
+    std::vector<VkEvent> wait_events;
+    std::vector<VkImageView> views;
+
+    // Each subpass is recorded into its own secondary command buffer by a task on the worker threads.
+    // Anything that isn't thread-safe (framebuffers, pre_exec callbacks) is taken care of up front.
+    struct Recording final {
+        RenderGraph* rg;
+        RenderGraphCache* cache;
+        const RenderPass* pass;
+        const CompiledRenderGraph::Pass* compiled;
+        const std::unordered_map<Name, Name>* versions;
+        PipelineTarget target;
+        FrameContext fcx;
+    };
 
-            barriers.push_back(make_barrier(attachment, access, layout));
+    static constexpr auto record = [](ftl::TaskScheduler* scheduler, void* arg) {
+        Recording& recording = *static_cast<Recording*>(arg);
+
+        CommandPool& pool = recording.cache->secondary_pools[scheduler->GetCurrentThreadIndex()];
+        const VkCommandBuffer cmd = pool.take();
+        recording.fcx.cmd = cmd;
+        recording.fcx.bind([&pool, cmd] { pool.replace(cmd); });
+
+        const CompiledRenderGraph::Pass& compiled = *recording.compiled;
+
+        VkCommandBufferInheritanceRenderingInfoKHR cbiri = {};
+        cbiri.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+        cbiri.colorAttachmentCount = compiled.target.color_formats.size();
+        cbiri.pColorAttachmentFormats = compiled.target.color_formats.data();
+        cbiri.depthAttachmentFormat = compiled.target.depth_format;
+        cbiri.stencilAttachmentFormat = vk_has_stencil(compiled.target.depth_format) ? compiled.target.depth_format : VK_FORMAT_UNDEFINED;
+        cbiri.rasterizationSamples = compiled.samples;
+
+        VkCommandBufferInheritanceInfo cbii = {};
+        cbii.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        cbii.pNext = compiled.rp == VK_NULL_HANDLE ? &cbiri : nullptr;
+        cbii.renderPass = recording.target.pass;
+        cbii.subpass = recording.target.subpass;
+        cbii.framebuffer = compiled.fb;
+
+        VkCommandBufferBeginInfo cbbi = {};
+        cbbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        cbbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        cbbi.pInheritanceInfo = &cbii;
+
+        vk_log(vkBeginCommandBuffer(cmd, &cbbi));
+
+        current_subpass = recording.target.subpass;
+        current_target = &recording.target;
+        current_versions = recording.versions;
+        recording.pass->exec(recording.fcx, *recording.rg, compiled.rp);
+        current_subpass = 0;
+        current_target = nullptr;
+        current_versions = nullptr;
+
+        vk_log(vkEndCommandBuffer(cmd));
+    };
 
-            VkAttachmentReference attachment_ref = {};
-            attachment_ref.layout = layout;
-            attachment_ref.attachment = attachments.size();
+    std::vector<Recording> recordings;
+    recordings.reserve(passes.size());
+    std::vector<std::size_t> first_recordings(graph.passes.size());
 
-            input_attachments.push_back(attachment_ref);
+    for (std::size_t position = 0; position < graph.passes.size(); ++position) {
+        CompiledRenderGraph::Pass& compiled = graph.passes[position];
+        const RenderPass& pass = passes[compiled.subpasses.front()];
 
-            if (self) {
-                color_attachments.push_back(attachment_ref);
-            }
+        if (pass.compute)
+            continue;
+
+        // Only the attachment images can change between frames with the same topology (swapchain image, ping-pong targets).
+        // The framebuffer is looked up every frame regardless, which keeps it from being evicted.
+        views.clear();
+        for (const Name& name : compiled.framebuffer_attachments) {
+            views.push_back(attachments.at(name).tex.view);
+        }
+
+        if (compiled.rp != VK_NULL_HANDLE) {
+            VkFramebufferCreateInfo fbci = {};
+            fbci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            fbci.attachmentCount = views.size();
+            fbci.pAttachments = views.data();
+            fbci.renderPass = compiled.rp;
+            fbci.width = pass.width;
+            fbci.height = pass.height;
+            fbci.layers = pass.layers;
+
+            compiled.fb = cache.create_framebuffer(fbci);
+        }
+
+        first_recordings[position] = recordings.size();
 
-            VkAttachmentDescription attachment_desc = {};
-            attachment_desc.initialLayout = layout;
-            attachment_desc.finalLayout = layout;
-            attachment_desc.format = attachment.attachment.tex.image.format;
-            attachment_desc.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-            attachment_desc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-            attachment_desc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            attachment_desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-            attachment_desc.samples = attachment.attachment.tex.image.samples;
+        for (uint32_t i = 0; i < compiled.subpasses.size(); ++i) {
+            const RenderPass& subpass = passes[compiled.subpasses[i]];
 
-            if (self && clear.has_value()) {
-                attachment_desc.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            PipelineTarget target = compiled.target;
+            if (compiled.rp != VK_NULL_HANDLE) {
+                target = {};
+                target.pass = compiled.rp;
+                target.subpass = i;
             }
 
-            attachments.push_back(attachment_desc);
-            framebuffer_attachments.push_back(attachment.attachment.tex.view);
+            const std::unordered_map<Name, Name>* versions = &graph.versions[compiled.subpasses[i]];
+            recordings.push_back(Recording{this, &cache, &subpass, &compiled, versions, std::move(target), FrameContext{fcx.cx, VK_NULL_HANDLE}});
 
-            // Update attachment info for following passes wanting to synchronize
-            attachment.access = access;
-            attachment.layout = layout;
-            attachment.stage = dst_stage;
+            current_subpass = i;
+            current_target = &recordings.back().target;
+            current_versions = versions;
+            if (subpass.pre_exec)
+                subpass.pre_exec(fcx, *this, compiled.rp);
         }
 
-        for (const Name& name : pass.texture_inputs) {
-            Attachment& attachment = tracked_attachments[name];
+        current_subpass = 0;
+        current_target = nullptr;
+        current_versions = nullptr;
+    }
 
-            VkAccessFlags access = VK_ACCESS_SHADER_READ_BIT;
-            VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    std::vector<ftl::Task> tasks;
+    tasks.reserve(recordings.size());
+    for (Recording& recording : recordings) {
+        tasks.push_back({record, &recording});
+    }
 
-            src_stages |= attachment.stage;
-            dst_stages |= dst_stage;
+    ftl::TaskCounter counter{&fcx.cx.scheduler};
+    fcx.cx.scheduler.AddTasks(tasks.size(), tasks.data(), ftl::TaskPriority::High, &counter);
+    fcx.cx.scheduler.WaitForCounter(&counter, true);
 
-            barriers.push_back(make_barrier(attachment, access, layout));
+    for (Recording& recording : recordings) {
+        fcx.join(std::move(recording.fcx));
+    }
 
-            // Update attachment info for following passes wanting to synchronize
-            attachment.access = access;
-            attachment.layout = layout;
-            attachment.stage = dst_stage;
+    stats.secondary_buffers = recordings.size();
+
+    // Imported attachments first used by the compute queue are released before anything else
+    if (!graph.prologue.empty()) {
+        barriers.clear();
+        for (const CompiledRenderGraph::Barrier& barrier : graph.prologue) {
+            barriers.push_back(image_barrier(barrier));
         }
 
-        for (const auto& [name, dep] : pass.dependencies) {
-            Attachment& attachment = tracked_attachments[name];
+        vkCmdPipelineBarrier(
+            fcx.cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, barriers.size(), barriers.data());
 
-            const VkAccessFlags access = dep.access;
-            const VkImageLayout layout = dep.layout;
-            const VkPipelineStageFlags dst_stage = dep.stage;
+        stats.pipeline_barriers++;
+        stats.image_barriers += barriers.size();
+        stats.queue_transfers += barriers.size();
+    }
 
-            src_stages |= attachment.stage;
-            dst_stages |= dst_stage;
+    // Consecutive async compute passes are recorded into their own command buffer, which waits on all graphics work submitted before it.
+    // Graphics passes only wait on the compute passes they depend on, so the two overlap in between.
+    const uint64_t first_compute_value = cache.compute_value;
+    std::vector<uint64_t> compute_values(graph.passes.size(), 0);
+    uint64_t waited_compute_value = first_compute_value;
+    VkPipelineStageFlags waited_compute_stages = 0;
+    VkPipelineStageFlags waited_frame_stages = 0;
+    VkCommandBuffer gfx_cmd = VK_NULL_HANDLE;
+
+    const auto submit_compute = [&] {
+        fcx.end();
+        fcx.wait_semaphore(cache.gfx_timeline, cache.gfx_value, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+        fcx.signal_semaphore(cache.compute_timeline, ++cache.compute_value);
+        fcx.submit_cmd(fcx.cx.compute_queue, VK_NULL_HANDLE);
+        fcx.bind([&pool = fcx.cx.compute_pool, cmd = fcx.cmd] { pool.replace(cmd); });
+
+        fcx.cmd = gfx_cmd;
+        gfx_cmd = VK_NULL_HANDLE;
+
+        stats.compute_submits++;
+    };
 
-            if (!dep.virt)
-                barriers.push_back(make_barrier(attachment, access, layout));
+    for (std::size_t position = 0; position < graph.passes.size(); ++position) {
+        CompiledRenderGraph::Pass& compiled = graph.passes[position];
+        const RenderPass& pass = passes[compiled.subpasses.front()];
 
-            attachment.access = access;
-            attachment.layout = layout;
-            attachment.stage = dst_stage;
+        if (compiled.async && gfx_cmd == VK_NULL_HANDLE) {
+            fcx.signal_semaphore(cache.gfx_timeline, ++cache.gfx_value);
+            fcx.split(fcx.cx.gfx_queue);
+
+            gfx_cmd = fcx.cmd;
+            fcx.cmd = fcx.cx.compute_pool.take();
+            fcx.begin();
+        } else if (!compiled.async && gfx_cmd != VK_NULL_HANDLE) {
+            submit_compute();
         }
 
-        if (pass.depth_stencil.has_value()) {
-            Attachment& attachment = tracked_attachments[pass.depth_stencil.value().first];
+        // The compute work of the previous frame may still be using what the pass uses first in this one
+        if (!compiled.async && cache.previous_compute_value > 0 && (compiled.frame_wait_stages & ~waited_frame_stages)) {
+            fcx.split(fcx.cx.gfx_queue);
+            fcx.wait_semaphore(cache.compute_timeline, cache.previous_compute_value, compiled.frame_wait_stages);
+
+            waited_frame_stages |= compiled.frame_wait_stages;
+        }
 
-            VkAccessFlags access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
-            VkImageLayout layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-            const VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        if (compiled.queue_wait.has_value()) {
+            const uint64_t value = compute_values[compiled.queue_wait.value()];
+            if (value > waited_compute_value || (compiled.queue_wait_stages & ~waited_compute_stages)) {
+                fcx.split(fcx.cx.gfx_queue);
+                fcx.wait_semaphore(cache.compute_timeline, value, compiled.queue_wait_stages);
 
-            if (pass.depth_stencil.value().second.has_value()) {
-                access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-                layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+                waited_compute_value = value;
+                waited_compute_stages = compiled.queue_wait_stages;
             }
+        }
 
-            src_stages |= attachment.stage;
-            dst_stages |= dst_stage;
+        if (!compiled.wait_events.empty()) {
+            wait_events.clear();
+            for (const std::size_t event : compiled.wait_events) {
+                wait_events.push_back(events[event]);
+            }
 
-            barriers.push_back(make_barrier(attachment, access, layout));
+            barriers.clear();
+            for (const CompiledRenderGraph::Barrier& barrier : compiled.wait_barriers) {
+                barriers.push_back(image_barrier(barrier));
+            }
 
-            VkAttachmentReference attachment_ref = {};
-            attachment_ref.layout = layout;
-            attachment_ref.attachment = attachments.size();
-
-            depth_stencil_attachment = attachment_ref;
-
-            VkAttachmentDescription attachment_desc = {};
-            attachment_desc.initialLayout = layout;
-            attachment_desc.finalLayout = layout;
-            attachment_desc.format = attachment.attachment.tex.image.format;
-            attachment_desc.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-            attachment_desc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-            attachment_desc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            attachment_desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-            attachment_desc.samples = attachment.attachment.tex.image.samples;
-
-            if (pass.depth_stencil.value().second.has_value()) {
-                attachment_desc.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-                VkClearValue val;
-                val.depthStencil = pass.depth_stencil.value().second.value();
-                clear_values.push_back(val);
-            } else {
-                VkClearValue val;
-                val.depthStencil.depth = 0.f;
-                val.depthStencil.stencil = 0;
-                clear_values.push_back(val);
+            buffer_barriers.clear();
+            for (const CompiledRenderGraph::BufferBarrier& barrier : compiled.wait_buffer_barriers) {
+                buffer_barriers.push_back(buffer_barrier(barrier));
             }
 
-            attachments.push_back(attachment_desc);
-            framebuffer_attachments.push_back(attachment.attachment.tex.view);
+            vkCmdWaitEvents(fcx.cmd, wait_events.size(), wait_events.data(), compiled.wait_src_stages, compiled.wait_dst_stages, 0, nullptr,
+                buffer_barriers.size(), buffer_barriers.data(), barriers.size(), barriers.data());
 
-            attachment.access = access;
-            attachment.layout = layout;
-            attachment.stage = dst_stage;
+            stats.split_barriers++;
+            stats.image_barriers += barriers.size();
+            stats.buffer_barriers += buffer_barriers.size();
         }
 
-        // Synchronize writes
-        for (const auto& [name, clear] : pass.color_outputs) {
-            Attachment& attachment = tracked_attachments[name];
-
-            const VkAccessFlags access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
-            const VkImageLayout layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-            const VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-
-            src_stages |= attachment.stage;
-            dst_stages |= dst_stage;
-
-            barriers.push_back(make_barrier(attachment, access, layout));
+        if (compiled.src_stages != 0) {
+            barriers.clear();
+            for (const CompiledRenderGraph::Barrier& barrier : compiled.barriers) {
+                barriers.push_back(image_barrier(barrier));
+            }
 
-            VkAttachmentReference attachment_ref = {};
-            attachment_ref.layout = layout;
-            attachment_ref.attachment = attachments.size();
-
-            color_attachments.push_back(attachment_ref);
-
-            VkAttachmentDescription attachment_desc = {};
-            attachment_desc.initialLayout = layout;
-            attachment_desc.finalLayout = layout;
-            attachment_desc.format = attachment.attachment.tex.image.format;
-            attachment_desc.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-            attachment_desc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-            attachment_desc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            attachment_desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-            attachment_desc.samples = attachment.attachment.tex.image.samples;
-
-            if (clear.has_value()) {
-                attachment_desc.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-                VkClearValue val;
-                val.color = clear.value();
-                clear_values.push_back(val);
-            } else {
-                VkClearValue val;
-                val.color.float32[0] = 0.f;
-                val.color.float32[1] = 0.f;
-                val.color.float32[2] = 0.f;
-                val.color.float32[3] = 0.f;
-                clear_values.push_back(val);
+            buffer_barriers.clear();
+            for (const CompiledRenderGraph::BufferBarrier& barrier : compiled.buffer_barriers) {
+                buffer_barriers.push_back(buffer_barrier(barrier));
             }
 
-            attachments.push_back(attachment_desc);
-            framebuffer_attachments.push_back(attachment.attachment.tex.view);
+            vkCmdPipelineBarrier(fcx.cmd, compiled.src_stages, compiled.dst_stages, 0, 0, nullptr, buffer_barriers.size(), buffer_barriers.data(),
+                barriers.size(), barriers.data());
 
-            attachment.access = access;
-            attachment.layout = layout;
-            attachment.stage = dst_stage;
+            stats.pipeline_barriers++;
+            stats.image_barriers += barriers.size();
+            stats.buffer_barriers += buffer_barriers.size();
         }
 
-        for (const auto& [name, clear] : pass.resolve_outputs) {
-            Attachment& attachment = tracked_attachments[name];
+        if (pass.compute) {
+            current_versions = &graph.versions[compiled.subpasses.front()];
+            if (pass.pre_exec)
+                pass.pre_exec(fcx, *this, VK_NULL_HANDLE);
+            pass.exec(fcx, *this, VK_NULL_HANDLE);
+            current_versions = nullptr;
+        } else if (compiled.rp == VK_NULL_HANDLE) {
+            std::vector<VkRenderingAttachmentInfoKHR> color_attachments;
+            color_attachments.reserve(compiled.color_attachments.size());
+
+            const auto rendering_attachment = [this](const CompiledRenderGraph::RenderingAttachment& attachment) {
+                VkRenderingAttachmentInfoKHR rai = {};
+                rai.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+                rai.imageView = attachments.at(attachment.name).tex.view;
+                rai.imageLayout = attachment.layout;
+                rai.loadOp = attachment.load_op;
+                rai.storeOp = attachment.store_op;
+                rai.clearValue = attachment.clear;
+                if (attachment.resolve.has_value()) {
+                    rai.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+                    rai.resolveImageView = attachments.at(attachment.resolve.value()).tex.view;
+                    rai.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+                }
+                return rai;
+            };
 
-            const VkAccessFlags access = 0;
-            const VkImageLayout layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-            const VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            for (const CompiledRenderGraph::RenderingAttachment& attachment : compiled.color_attachments) {
+                color_attachments.push_back(rendering_attachment(attachment));
+            }
 
-            src_stages |= attachment.stage;
-            dst_stages |= dst_stage;
+            VkRenderingAttachmentInfoKHR depth_attachment = {};
+            if (compiled.depth_attachment.has_value())
+                depth_attachment = rendering_attachment(compiled.depth_attachment.value());
+
+            VkRenderingInfoKHR ri = {};
+            ri.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+            ri.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR;
+            ri.renderArea = vk_rect(0, 0, pass.width, pass.height);
+            ri.layerCount = pass.layers;
+            ri.colorAttachmentCount = color_attachments.size();
+            ri.pColorAttachments = color_attachments.data();
+            if (compiled.depth_attachment.has_value()) {
+                ri.pDepthAttachment = &depth_attachment;
+                if (vk_has_stencil(compiled.target.depth_format))
+                    ri.pStencilAttachment = &depth_attachment;
+            }
 
-            barriers.push_back(make_barrier(attachment, access, layout));
+            vkCmdBeginRenderingKHR(fcx.cmd, &ri);
 
-            VkAttachmentReference attachment_ref = {};
-            attachment_ref.layout = layout;
-            attachment_ref.attachment = attachments.size();
-
-            resolve_attachments.push_back(attachment_ref);
-
-            VkAttachmentDescription attachment_desc = {};
-            attachment_desc.initialLayout = layout;
-            attachment_desc.finalLayout = layout;
-            attachment_desc.format = attachment.attachment.tex.image.format;
-            attachment_desc.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-            attachment_desc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-            attachment_desc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            attachment_desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-            attachment_desc.samples = attachment.attachment.tex.image.samples;
-
-            if (clear.has_value()) {
-                attachment_desc.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-                VkClearValue val;
-                val.color = clear.value();
-                clear_values.push_back(val);
-            } else {
-                VkClearValue val;
-                val.color.uint32[0] = 0;
-                val.color.uint32[1] = 0;
-                val.color.uint32[2] = 0;
-                val.color.uint32[3] = 0;
-                clear_values.push_back(val);
-            }
+            const VkCommandBuffer cmd = recordings[first_recordings[position]].fcx.cmd;
+            vkCmdExecuteCommands(fcx.cmd, 1, &cmd);
 
-            attachments.push_back(attachment_desc);
-            framebuffer_attachments.push_back(attachment.attachment.tex.view);
+            vkCmdEndRenderingKHR(fcx.cmd);
 
-            attachment.access = access;
-            attachment.layout = layout;
-            attachment.stage = dst_stage;
-        }
+            stats.render_passes++;
+        } else {
+            VkRenderPassBeginInfo rpbi = {};
+            rpbi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            rpbi.renderPass = compiled.rp;
+            rpbi.framebuffer = compiled.fb;
+            rpbi.clearValueCount = compiled.clear_values.size();
+            rpbi.pClearValues = compiled.clear_values.data();
+            rpbi.renderArea = vk_rect(0, 0, pass.width, pass.height);
 
-        for (const auto& [name, dep] : pass.dependents) {
-            Attachment& attachment = tracked_attachments[name];
+            vkCmdBeginRenderPass(fcx.cmd, &rpbi, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-            const VkAccessFlags access = dep.access;
-            const VkImageLayout layout = dep.layout;
-            const VkPipelineStageFlags dst_stage = dep.stage;
+            for (std::size_t i = 0; i < compiled.subpasses.size(); ++i) {
+                if (i > 0)
+                    vkCmdNextSubpass(fcx.cmd, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-            src_stages |= attachment.stage;
-            dst_stages |= dst_stage;
+                const VkCommandBuffer cmd = recordings[first_recordings[position] + i].fcx.cmd;
+                vkCmdExecuteCommands(fcx.cmd, 1, &cmd);
+            }
 
-            if (!dep.virt)
-                barriers.push_back(make_barrier(attachment, access, layout));
+            vkCmdEndRenderPass(fcx.cmd);
 
-            attachment.access = access;
-            attachment.layout = layout;
-            attachment.stage = dst_stage;
+            stats.render_passes++;
         }
 
-        vkCmdPipelineBarrier(fcx.cmd, src_stages != 0 ? src_stages : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, dst_stages, 0, 0, nullptr, 0, nullptr, barriers.size(),
-            barriers.data());
+        if (!compiled.releases.empty()) {
+            barriers.clear();
+            for (const CompiledRenderGraph::Barrier& barrier : compiled.releases) {
+                barriers.push_back(image_barrier(barrier));
+            }
+
+            vkCmdPipelineBarrier(
+                fcx.cmd, compiled.release_stages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, barriers.size(), barriers.data());
 
-        VkSubpassDescription subpass = {};
-        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount = color_attachments.size();
-        subpass.pColorAttachments = color_attachments.data();
-        subpass.inputAttachmentCount = input_attachments.size();
-        subpass.pInputAttachments = input_attachments.data();
-        subpass.pResolveAttachments = resolve_attachments.data();
-        if (depth_stencil_attachment.has_value()) {
-            subpass.pDepthStencilAttachment = &depth_stencil_attachment.value();
+            stats.pipeline_barriers++;
+            stats.image_barriers += barriers.size();
+            stats.queue_transfers += barriers.size();
         }
 
-        VkRenderPassCreateInfo rpci = {};
-        rpci.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        rpci.subpassCount = 1;
-        rpci.pSubpasses = &subpass;
-        rpci.dependencyCount = 0;
-        rpci.pDependencies = nullptr;
-        rpci.attachmentCount = attachments.size();
-        rpci.pAttachments = attachments.data();
+        if (compiled.event.has_value())
+            vkCmdSetEvent(fcx.cmd, events[compiled.event.value()], compiled.event_stages);
 
-        VkRenderPass rp = cache.create_pass(rpci);
+        // the value signalled once the compute command buffer is submitted
+        if (compiled.async)
+            compute_values[position] = cache.compute_value + 1;
+    }
 
-        VkFramebufferCreateInfo fbci = {};
-        fbci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        fbci.attachmentCount = framebuffer_attachments.size();
-        fbci.pAttachments = framebuffer_attachments.data();
-        fbci.renderPass = rp;
-        fbci.width = pass.width;
-        fbci.height = pass.height;
-        fbci.layers = pass.layers;
+    if (gfx_cmd != VK_NULL_HANDLE)
+        submit_compute();
 
-        VkFramebuffer fb = cache.create_framebuffer(fbci);
+    cache.previous_compute_value = cache.compute_value > first_compute_value ? cache.compute_value : 0;
 
-        VkRenderPassBeginInfo rpbi = {};
-        rpbi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        rpbi.renderPass = rp;
-        rpbi.framebuffer = fb;
-        rpbi.clearValueCount = clear_values.size();
-        rpbi.pClearValues = clear_values.data();
-        rpbi.renderArea = vk_rect(0, 0, pass.width, pass.height);
+    // The frame can't finish before its compute work, which also has to hand back the imported attachments it used last
+    if (cache.compute_value > first_compute_value) {
+        if (!graph.epilogue.empty()) {
+            fcx.split(fcx.cx.gfx_queue);
+            fcx.wait_semaphore(cache.compute_timeline, cache.compute_value, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
 
-        if (pass.pre_exec)
-            pass.pre_exec(fcx, *this, rp);
+            barriers.clear();
+            for (const CompiledRenderGraph::Barrier& barrier : graph.epilogue) {
+                barriers.push_back(image_barrier(barrier));
+            }
 
-        vkCmdBeginRenderPass(fcx.cmd, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+            vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, barriers.size(),
+                barriers.data());
 
-        pass.exec(fcx, *this, rp);
+            stats.pipeline_barriers++;
+            stats.image_barriers += barriers.size();
+        } else if (cache.compute_value > waited_compute_value) {
+            fcx.wait_semaphore(cache.compute_timeline, cache.compute_value, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+        }
+    }
 
-        vkCmdEndRenderPass(fcx.cmd);
+    barriers.clear();
+    for (const CompiledRenderGraph::Barrier& barrier : graph.output) {
+        barriers.push_back(image_barrier(barrier));
     }
 
-    VkImageMemoryBarrier barrier = {};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.image = attachments[output].tex.image.image;
-    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
-    barrier.dstAccessMask = 0;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.oldLayout = tracked_attachments[output].layout;
-    barrier.newLayout = output_layout;
-    barrier.subresourceRange = attachments[output].subresource;
+    vkCmdPipelineBarrier(
+        fcx.cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, barriers.size(), barriers.data());
 
-    vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-}
+    stats.pipeline_barriers++;
+    stats.image_barriers += barriers.size();
 
-std::vector<std::size_t> RenderGraph::find_all(std::function<bool(const RenderPass&)> pred) const {
-    std::vector<std::size_t> indices;
-    for (std::size_t i = 0; i < passes.size(); ++i) {
-        if (pred(passes[i]))
-            indices.push_back(i);
+    for (const auto& [name, desc_frames] : histories) {
+        RenderGraphCache::History& history = cache.histories.at(name);
+        for (uint32_t age = 0; age < history.images.size(); ++age) {
+            const uint32_t i = (history.current + history.images.size() - age) % history.images.size();
+            const auto layout = graph.final_layouts.find(age == 0 ? name : RenderGraph::history(name, age));
+            if (layout != graph.final_layouts.end())
+                history.layouts[i] = layout->second;
+        }
     }
-    return indices;
+
+    cache.last_stats = stats;
+    cache.last_schedule = graph.schedule;
 }
 
-void RenderGraph::push_writers(std::vector<std::size_t>& all_writers, Name res) const {
-    const std::vector<std::size_t> writers = find_all([res](const RenderPass& pass) -> bool {
-        return std::find(pass.color_outputs.begin(), pass.color_outputs.end(), res) != pass.color_outputs.end() ||
-               std::find(pass.resolve_outputs.begin(), pass.resolve_outputs.end(), res) != pass.resolve_outputs.end() ||
-               std::find(pass.dependents.begin(), pass.dependents.end(), res) != pass.dependents.end() ||
-               (pass.depth_stencil.has_value() ? pass.depth_stencil.value().second.has_value() && pass.depth_stencil.value().first == res : false);
-    });
+CompiledRenderGraph RenderGraph::compile(RenderGraphCache& cache) const {
+    // Validation, disabled passes may reference resources that weren't pushed
+    for (std::size_t i = 0; i < passes.size(); ++i) {
+        if (!enabled[i])
+            continue;
 
-    list_append(all_writers, writers);
+        for_each_attachment(passes[i], [this](const Name& res) { PK_ASSERT(attachments.count(res) || transients.count(res)); });
+        for_each_buffer(passes[i], [this](const Name& res, const RenderPass::BufferAccess&, bool) { PK_ASSERT(buffers.count(res)); });
 
-    for (const std::size_t i : writers) {
-        const RenderPass& pass = passes[i];
+        // Buffers are exclusive to the graphics queue
+        PK_ASSERT(!passes[i].async || (passes[i].buffer_inputs.empty() && passes[i].buffer_outputs.empty()));
+    }
 
-        if (pass.depth_stencil.has_value())
-            if (!pass.depth_stencil->second.has_value())
-                push_writers(all_writers, pass.depth_stencil.value().first);
+    for (const auto& [res, _] : transients) {
+        PK_ASSERT(!attachments.count(res));
+        PK_ASSERT(!(res == output));
+    }
 
-        for (const auto& [res, clear] : pass.color_outputs)
-            if (!clear.has_value())
-                push_writers(all_writers, res);
+    // Bottom-up dependency traversal
+    std::vector<std::size_t> pass_list;
+    push_writers(pass_list, output);
+    for (const Name& res : side_effects)
+        push_writers(pass_list, res);
 
-        for (const auto& [res, self, clear] : pass.input_attachments)
-            if (!self)
-                push_writers(all_writers, res);
+    // Reverse ordering
+    std::reverse(pass_list.begin(), pass_list.end());
 
-        for (const Name& res : pass.texture_inputs)
-            push_writers(all_writers, res);
+    // Prune duplicates
+    std::unordered_set<std::size_t> seen_passes;
+    pass_list.erase(std::remove_if(pass_list.begin(), pass_list.end(),
+                        [&seen_passes](std::size_t i) {
+                            if (seen_passes.count(i))
+                                return true;
+                            seen_passes.insert(i);
+                            return false;
+                        }),
+        pass_list.end());
+
+    // Every overwrite of a transient gets an image of its own, so that it doesn't have to wait on the uses of the previous contents.
+    // The graph is compiled against a copy with the versions renamed, as the passes themselves only know the original names.
+    RenderGraph renamed = *this;
+
+    CompiledRenderGraph graph;
+    graph.versions = renamed.version_transients(pass_list);
+
+    return renamed.build(cache, std::move(graph), std::move(pass_list));
+}
+
+CompiledRenderGraph RenderGraph::build(RenderGraphCache& cache, CompiledRenderGraph graph, std::vector<std::size_t> pass_list) const {
+    const std::vector<std::size_t> declared_list = pass_list;
+    pass_list = schedule(pass_list);
+
+    // Merged passes need subpasses, which dynamic rendering does without
+    const std::vector<std::vector<std::size_t>> groups = merge_passes(pass_list, !cache.cx->dynamic_rendering);
+
+    // Passes that aren't in the list contribute to neither the output nor a side effect (or are disabled), so they're culled
+    graph.culled_passes = passes.size() - pass_list.size();
+
+    for (std::size_t position = 0; position < pass_list.size(); ++position) {
+        const std::size_t i = pass_list[position];
+        const std::size_t declared = std::find(declared_list.begin(), declared_list.end(), i) - declared_list.begin();
+        graph.schedule += fmt::format("{:>3} {:<32} (declared {:>3}, traversed {:>3}){}\n", position,
+            passes[i].name.empty() ? fmt::format("#{}", i) : passes[i].name, i, declared, passes[i].async ? " async" : "");
+    }
+
+    graph.passes.reserve(groups.size());
+
+    const std::unordered_map<Name, Name> previous_aliases = alias_transients(graph, cache, groups);
+
+    static constexpr VkAccessFlags write_accesses = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    static constexpr std::size_t no_pass = std::numeric_limits<std::size_t>::max();
+
+    // The last write (or layout transition) of an image subresource, and the reads since then which were already synchronized with it
+    struct Subresource final {
+        VkImageLayout layout;
+        std::size_t writer;
+        VkPipelineStageFlags write_stage;
+        VkAccessFlags write_access;
+        std::vector<std::pair<std::size_t, VkPipelineStageFlags>> readers;
+        VkPipelineStageFlags read_stages;
+        VkAccessFlags read_access;
+        // the queue of the last use, which owns the attachment
+        bool async;
+        std::size_t last_use;
+    };
+
+    const auto same_state = [](const Subresource& a, const Subresource& b) {
+        return a.layout == b.layout && a.writer == b.writer && a.write_stage == b.write_stage && a.write_access == b.write_access &&
+               a.readers == b.readers && a.read_stages == b.read_stages && a.read_access == b.read_access && a.async == b.async && a.last_use == b.last_use;
+    };
+
+    // Attachments may be views of the same image (e.g. the layers of an array image), so the state is tracked per subresource of each image
+    struct TrackedImage final {
+        // any attachment of the image, for barriers that aren't tied to a specific one
+        Name name;
+        bool transient;
+        uint32_t layers;
+        uint32_t mips;
+        std::vector<Subresource> subresources;
+
+        Subresource& at(uint32_t mip, uint32_t layer) {
+            return subresources[mip * layers + layer];
+        }
+    };
+
+    std::unordered_map<Name, PassAttachment> all_attachments = attachments;
+    all_attachments.insert(graph.transients.begin(), graph.transients.end());
+
+    std::unordered_map<VkImage, TrackedImage> tracked_images;
+
+    for (const auto& [name, attachment] : all_attachments) {
+        const VkImageSubresourceRange& range = attachment.subresource;
+
+        TrackedImage& image = tracked_images.try_emplace(attachment.tex.image.image, TrackedImage{name, transients.count(name) > 0, 0, 0, {}}).first->second;
+        image.layers = std::max(image.layers, range.baseArrayLayer + range.layerCount);
+        image.mips = std::max(image.mips, range.baseMipLevel + range.levelCount);
+    }
+
+    for (auto& [handle, image] : tracked_images) {
+        // Anything that happened before the graph (e.g. the previous frame writing a history image) is waited on in full and made visible,
+        // except for transients, which instead wait on their aliases
+        Subresource tracked;
+        tracked.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        tracked.writer = no_pass;
+        tracked.write_stage = image.transient ? 0 : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        tracked.write_access = image.transient ? 0 : VK_ACCESS_MEMORY_WRITE_BIT;
+        tracked.read_stages = 0;
+        tracked.read_access = 0;
+        tracked.async = false;
+        tracked.last_use = no_pass;
+
+        image.subresources.assign(image.layers * image.mips, tracked);
+    }
+
+    for (const auto& [name, layout] : initial_layouts) {
+        const PassAttachment& attachment = all_attachments.at(name);
+        const VkImageSubresourceRange& range = attachment.subresource;
+
+        TrackedImage& image = tracked_images.at(attachment.tex.image.image);
+        for (uint32_t mip = range.baseMipLevel; mip < range.baseMipLevel + range.levelCount; ++mip) {
+            for (uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + range.layerCount; ++layer) {
+                image.at(mip, layer).layout = layout;
+            }
+        }
+    }
+
+    // Splits a range of an image into boxes of subresources in the same state
+    const auto partition = [&](TrackedImage& image, const VkImageSubresourceRange& range) {
+        std::vector<VkImageSubresourceRange> boxes;
+        std::vector<VkImageSubresourceRange> row;
+
+        for (uint32_t mip = range.baseMipLevel; mip < range.baseMipLevel + range.levelCount; ++mip) {
+            row.clear();
+            for (uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + range.layerCount; ++layer) {
+                if (!row.empty() && same_state(image.at(mip, layer), image.at(mip, row.back().baseArrayLayer)))
+                    row.back().layerCount++;
+                else
+                    row.push_back(VkImageSubresourceRange{range.aspectMask, mip, 1, layer, 1});
+            }
+
+            // Runs of layers continue the boxes of the previous mip if they match them
+            for (const VkImageSubresourceRange& run : row) {
+                auto it = std::find_if(boxes.begin(), boxes.end(), [&](const VkImageSubresourceRange& box) {
+                    return box.baseMipLevel + box.levelCount == mip && box.baseArrayLayer == run.baseArrayLayer && box.layerCount == run.layerCount &&
+                           same_state(image.at(box.baseMipLevel, box.baseArrayLayer), image.at(mip, run.baseArrayLayer));
+                });
+
+                if (it != boxes.end())
+                    it->levelCount++;
+                else
+                    boxes.push_back(run);
+            }
+        }
+
+        return boxes;
+    };
+
+    // Applies f to the state of each box of subresources of an attachment, which is then shared by the whole box
+    const auto update = [&](const Name& name, auto&& f) {
+        const PassAttachment& attachment = all_attachments.at(name);
+        TrackedImage& image = tracked_images.at(attachment.tex.image.image);
+
+        for (const VkImageSubresourceRange& box : partition(image, attachment.subresource)) {
+            Subresource state = image.at(box.baseMipLevel, box.baseArrayLayer);
+            f(state, box);
+
+            for (uint32_t mip = box.baseMipLevel; mip < box.baseMipLevel + box.levelCount; ++mip) {
+                for (uint32_t layer = box.baseArrayLayer; layer < box.baseArrayLayer + box.layerCount; ++layer) {
+                    image.at(mip, layer) = state;
+                }
+            }
+        }
+    };
+
+    // Nothing depends on the contents of an attachment that is only in the undefined layout, since the transition out of it discards them
+    const auto undefined = [&](const Name& name) {
+        const PassAttachment& attachment = all_attachments.at(name);
+        const VkImageSubresourceRange& range = attachment.subresource;
+        TrackedImage& image = tracked_images.at(attachment.tex.image.image);
+
+        for (uint32_t mip = range.baseMipLevel; mip < range.baseMipLevel + range.levelCount; ++mip) {
+            for (uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + range.layerCount; ++layer) {
+                if (image.at(mip, layer).layout != VK_IMAGE_LAYOUT_UNDEFINED)
+                    return false;
+            }
+        }
+
+        return true;
+    };
+
+    // Transients don't outlive the frame, so their contents are no longer needed after the last pass that uses them
+    std::unordered_map<Name, std::size_t> last_uses;
+    for (std::size_t position = 0; position < groups.size(); ++position) {
+        for (const std::size_t i : groups[position]) {
+            for_each_attachment(passes[i], [&](const Name& name) { last_uses[name] = position; });
+        }
+    }
+
+    // Transients are only ever used in full, so all of their subresources are in the same state
+    const auto transient_state = [&](const Name& name) -> Subresource& {
+        const PassAttachment& attachment = all_attachments.at(name);
+        return tracked_images.at(attachment.tex.image.image).subresources.front();
+    };
+
+    // Buffers are used the same way every frame, so their first use waits on their last use in the graph (by the previous frame)
+    struct TrackedBuffer final {
+        bool used;
+        std::size_t writer;
+        VkPipelineStageFlags write_stage;
+        VkAccessFlags write_access;
+        std::vector<std::pair<std::size_t, VkPipelineStageFlags>> readers;
+        VkPipelineStageFlags read_stages;
+        VkAccessFlags read_access;
+    };
+
+    std::unordered_map<Name, TrackedBuffer> tracked_buffers;
+
+    for (const std::vector<std::size_t>& group : groups) {
+        for (const std::size_t i : group) {
+            for_each_buffer(passes[i], [&](const Name& name, const RenderPass::BufferAccess& use, bool write) {
+                TrackedBuffer& buffer = tracked_buffers.try_emplace(name, TrackedBuffer{false, no_pass, 0, 0, {}, 0, 0}).first->second;
+                if (write) {
+                    buffer.write_stage = use.stage;
+                    buffer.write_access = use.access & write_accesses;
+                    buffer.read_stages = 0;
+                } else {
+                    buffer.read_stages |= use.stage;
+                }
+            });
+        }
+    }
+
+    for (auto& [name, buffer] : tracked_buffers) {
+        if (buffer.read_stages != 0)
+            buffer.readers.emplace_back(no_pass, buffer.read_stages);
+        buffer.read_stages = 0;
+    }
+
+    std::unordered_set<Name> used_transients;
+    std::vector<std::pair<std::size_t, Name>> first_aliases;
+
+    graph.event_count = 0;
+    graph.elided_barriers = 0;
+
+    std::vector<std::vector<std::size_t>> wait_passes(groups.size());
+
+    const uint32_t gfx_family = cache.cx->gfx_queue_idx;
+    const uint32_t compute_family = cache.cx->compute_queue_idx;
+
+    // Exclusive images must be released by the queue that used them last before the other queue can acquire them
+    const auto release = [&](const Subresource& attachment, CompiledRenderGraph::Barrier barrier) {
+        barrier.src_access = attachment.write_access;
+        barrier.dst_access = 0;
+
+        if (attachment.last_use == no_pass) {
+            graph.prologue.push_back(barrier);
+            return;
+        }
+
+        CompiledRenderGraph::Pass& owner = graph.passes[attachment.last_use];
+        owner.release_stages |= attachment.write_stage | attachment.read_stages;
+        owner.releases.push_back(barrier);
+    };
+
+    // Schedule
+    for (std::size_t position = 0; position < groups.size(); ++position) {
+        CompiledRenderGraph::Pass& compiled = graph.passes.emplace_back();
+        compiled.subpasses = groups[position];
+        compiled.fb = VK_NULL_HANDLE;
+        compiled.src_stages = 0;
+        compiled.dst_stages = 0;
+        compiled.wait_src_stages = 0;
+        compiled.wait_dst_stages = 0;
+        compiled.event_stages = 0;
+        compiled.async = passes[compiled.subpasses.front()].async;
+        compiled.queue_wait_stages = 0;
+        compiled.frame_wait_stages = 0;
+        compiled.release_stages = 0;
+        compiled.rp = VK_NULL_HANDLE;
+        compiled.samples = VK_SAMPLE_COUNT_1_BIT;
+
+        // Dependencies on the directly preceding pass go into a regular pipeline barrier before the pass.
+        // Dependencies on any earlier pass are split: the producer sets an event once it's done and the barrier is moved into the wait.
+        // Returns whether the dependency was split.
+        const auto depend = [&](std::size_t producer, VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage,
+            const std::optional<CompiledRenderGraph::Barrier>& barrier) -> bool {
+            if (producer == no_pass || producer + 1 >= position) {
+                compiled.src_stages |= src_stage;
+                compiled.dst_stages |= dst_stage;
+                if (barrier.has_value())
+                    compiled.barriers.push_back(barrier.value());
+                return false;
+            }
+
+            CompiledRenderGraph::Pass& signal = graph.passes[producer];
+            if (!signal.event.has_value())
+                signal.event = graph.event_count++;
+            signal.event_stages |= src_stage;
+
+            std::vector<std::size_t>& waits = wait_passes[position];
+            if (std::find(waits.begin(), waits.end(), producer) == waits.end())
+                waits.push_back(producer);
+
+            compiled.wait_dst_stages |= dst_stage;
+            if (barrier.has_value())
+                compiled.wait_barriers.push_back(barrier.value());
+            return true;
+        };
+
+        const auto sync_buffer = [&](const Name& name, const RenderPass::BufferAccess& use, bool write) {
+            TrackedBuffer& buffer = tracked_buffers.at(name);
+
+            // The previous frame may still use the buffer on the compute queue
+            if (!buffer.used && !compiled.async)
+                compiled.frame_wait_stages |= use.stage;
+            buffer.used = true;
+
+            const auto memory_barrier = [&] {
+                const CompiledRenderGraph::BufferBarrier barrier = {name, buffer.write_access, use.access};
+                if (depend(buffer.writer, buffer.write_stage, use.stage, std::nullopt))
+                    compiled.wait_buffer_barriers.push_back(barrier);
+                else
+                    compiled.buffer_barriers.push_back(barrier);
+            };
+
+            if (!write) {
+                // Read-after-read: the write is already visible to these stages
+                if (buffer.write_access != 0) {
+                    if (!(use.stage & ~buffer.read_stages) && !(use.access & ~buffer.read_access))
+                        graph.elided_barriers++;
+                    else
+                        memory_barrier();
+                }
+
+                buffer.readers.emplace_back(position, use.stage);
+                buffer.read_stages |= use.stage;
+                buffer.read_access |= use.access;
+                return;
+            }
+
+            if (buffer.write_access != 0)
+                memory_barrier();
+            for (const auto& [reader, stage] : buffer.readers) {
+                depend(reader, stage, use.stage, std::nullopt);
+            }
+
+            buffer.writer = position;
+            buffer.write_stage = use.stage;
+            buffer.write_access = use.access & write_accesses;
+            buffer.readers.clear();
+            buffer.read_stages = 0;
+            buffer.read_access = 0;
+        };
+
+        // Records the synchronization for an access of this pass to the subresources of an attachment in the same state,
+        // skipping whatever an earlier barrier already covers
+        const auto sync_state = [&](const Name& name, Subresource& attachment, const VkImageSubresourceRange& range, VkAccessFlags access,
+            VkImageLayout layout, VkPipelineStageFlags dst_stage) {
+            CompiledRenderGraph::Barrier barrier;
+            barrier.name = name;
+            barrier.subresource = range;
+            barrier.src_access = attachment.write_access;
+            barrier.dst_access = access;
+            barrier.old_layout = attachment.layout;
+            barrier.new_layout = layout;
+
+            // The last use was on the other queue, which is waited on with a semaphore instead (always on all of its work for compute passes).
+            // The barrier then only acquires the attachment, and starts tracking it anew.
+            if (attachment.async != compiled.async) {
+                barrier.src_access = 0;
+
+                if (gfx_family != compute_family && attachment.layout != VK_IMAGE_LAYOUT_UNDEFINED) {
+                    barrier.src_queue = attachment.async ? compute_family : gfx_family;
+                    barrier.dst_queue = compiled.async ? compute_family : gfx_family;
+                    release(attachment, barrier);
+                }
+
+                compiled.barriers.push_back(barrier);
+
+                compiled.src_stages |= dst_stage;
+                compiled.dst_stages |= dst_stage;
+
+                if (attachment.last_use != no_pass && !compiled.async) {
+                    compiled.queue_wait = std::max(compiled.queue_wait.value_or(0), attachment.last_use);
+                    compiled.queue_wait_stages |= dst_stage;
+                }
+
+                const bool write = access & write_accesses;
+
+                attachment.layout = layout;
+                attachment.writer = position;
+                attachment.write_stage = dst_stage;
+                attachment.write_access = access & write_accesses;
+                attachment.readers.clear();
+                attachment.read_stages = write ? 0 : dst_stage;
+                attachment.read_access = write ? 0 : access;
+                attachment.async = compiled.async;
+                attachment.last_use = position;
+                return;
+            }
+
+            attachment.last_use = position;
+
+            const bool write = (access & write_accesses) || layout != attachment.layout;
+
+            if (!write) {
+                // Read-after-read: the reads are already visible to these stages
+                if (!(dst_stage & ~attachment.read_stages) && !(access & ~attachment.read_access)) {
+                    graph.elided_barriers++;
+                    return;
+                }
+
+                std::optional<CompiledRenderGraph::Barrier> memory_barrier;
+                if (attachment.write_access != 0)
+                    memory_barrier = barrier;
+                else
+                    graph.elided_barriers++;
+
+                depend(attachment.writer, attachment.write_stage, dst_stage, memory_barrier);
+
+                attachment.readers.emplace_back(position, dst_stage);
+                attachment.read_stages |= dst_stage;
+                attachment.read_access |= access;
+                return;
+            }
+
+            // Write-after-read only needs an execution dependency on the reads
+            std::optional<CompiledRenderGraph::Barrier> memory_barrier;
+            if (layout != attachment.layout || attachment.write_access != 0)
+                memory_barrier = barrier;
+            else
+                graph.elided_barriers++;
+
+            depend(attachment.writer, attachment.write_stage, dst_stage, memory_barrier);
+            for (const auto& [reader, stage] : attachment.readers) {
+                depend(reader, stage, dst_stage, std::nullopt);
+            }
+
+            attachment.layout = layout;
+            attachment.writer = position;
+            attachment.write_stage = dst_stage;
+            attachment.write_access = access & write_accesses;
+            attachment.readers.clear();
+            attachment.read_stages = 0;
+            attachment.read_access = 0;
+        };
+
+        const auto sync = [&](const Name& name, VkAccessFlags access, VkImageLayout layout, VkPipelineStageFlags dst_stage) {
+            const bool imported = !tracked_images.at(all_attachments.at(name).tex.image.image).transient;
+
+            update(name, [&](Subresource& state, const VkImageSubresourceRange& range) {
+                // The previous frame may still use imported images on the compute queue
+                if (imported && state.last_use == no_pass && !compiled.async)
+                    compiled.frame_wait_stages |= dst_stage;
+
+                sync_state(name, state, range, access, layout, dst_stage);
+            });
+        };
+
+        // A transient takes over the memory of the transient used before it, so its first use must wait on the last use of the previous one
+        for (const std::size_t i : compiled.subpasses) {
+            for_each_attachment(passes[i], [&](const Name& name) {
+                const auto alias = previous_aliases.find(name);
+                if (alias == previous_aliases.end() || used_transients.count(name))
+                    return;
+
+                if (used_transients.count(alias->second)) {
+                    const Subresource& previous = transient_state(alias->second);
+                    Subresource& attachment = transient_state(name);
+                    attachment.writer = previous.writer;
+                    attachment.write_stage = previous.write_stage;
+                    attachment.write_access = previous.write_access;
+                    attachment.readers = previous.readers;
+                    attachment.read_stages = previous.read_stages;
+                    attachment.read_access = previous.read_access;
+                    attachment.async = previous.async;
+                    attachment.last_use = previous.last_use;
+                } else {
+                    first_aliases.emplace_back(position, name);
+                }
+
+                used_transients.insert(name);
+            });
+        }
+
+        struct Subpass final {
+            std::vector<VkAttachmentReference> input_attachments;
+            std::vector<VkAttachmentReference> color_attachments;
+            std::vector<VkAttachmentReference> resolve_attachments;
+            std::optional<VkAttachmentReference> depth_stencil_attachment;
+            std::vector<uint32_t> preserve_attachments;
+        };
+
+        // The last subpass that used an attachment of this render pass
+        struct SubpassUse final {
+            uint32_t subpass;
+            VkPipelineStageFlags stage;
+            VkAccessFlags access;
+        };
+
+        std::vector<VkAttachmentDescription> attachments;
+        std::vector<std::pair<uint32_t, uint32_t>> attachment_subpasses;
+        std::vector<bool> attachment_writes;
+        std::unordered_map<Name, uint32_t> attachment_indices;
+        std::unordered_map<Name, SubpassUse> subpass_uses;
+        std::vector<Subpass> subpasses(compiled.subpasses.size());
+        std::vector<VkSubpassDependency> subpass_dependencies;
+
+        const auto subpass_dependency = [&subpass_dependencies](const SubpassUse& src, const SubpassUse& dst) {
+            if (src.subpass == dst.subpass)
+                return;
+
+            auto it = std::find_if(subpass_dependencies.begin(), subpass_dependencies.end(),
+                [&](const VkSubpassDependency& dep) { return dep.srcSubpass == src.subpass && dep.dstSubpass == dst.subpass; });
+
+            if (it == subpass_dependencies.end()) {
+                VkSubpassDependency dep = {};
+                dep.srcSubpass = src.subpass;
+                dep.dstSubpass = dst.subpass;
+                dep.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+                it = subpass_dependencies.insert(subpass_dependencies.end(), dep);
+            }
+
+            it->srcStageMask |= src.stage;
+            it->dstStageMask |= dst.stage;
+            it->srcAccessMask |= src.access & write_accesses;
+            it->dstAccessMask |= dst.access;
+        };
+
+        // Adds an attachment to the render pass; the first use is synchronized with barriers and any later use with subpass dependencies.
+        // The previous contents are only loaded if the first use may read them, i.e. it neither clears nor overwrites the attachment in full.
+        const auto use_attachment = [&](uint32_t subpass, const Name& name, VkAccessFlags access, VkImageLayout layout, VkPipelineStageFlags dst_stage,
+            std::optional<VkClearValue> clear, bool overwrite = false) -> VkAttachmentReference {
+            const PassAttachment& attachment = all_attachments.at(name);
+            const SubpassUse use = {subpass, dst_stage, access};
+
+            auto it = attachment_indices.find(name);
+            if (it == attachment_indices.end()) {
+                const bool discard = overwrite || undefined(name);
+                sync(name, access, layout, dst_stage);
+
+                VkAttachmentDescription attachment_desc = {};
+                attachment_desc.initialLayout = layout;
+                attachment_desc.format = attachment.tex.image.format;
+                attachment_desc.loadOp = clear.has_value() ? VK_ATTACHMENT_LOAD_OP_CLEAR : discard ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : VK_ATTACHMENT_LOAD_OP_LOAD;
+                attachment_desc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                attachment_desc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+                attachment_desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                attachment_desc.samples = attachment.tex.image.samples;
+
+                it = attachment_indices.emplace(name, attachments.size()).first;
+                attachments.push_back(attachment_desc);
+                attachment_subpasses.emplace_back(subpass, subpass);
+                attachment_writes.push_back(false);
+                compiled.framebuffer_attachments.push_back(name);
+                compiled.clear_values.push_back(clear.value_or(VkClearValue{}));
+            } else {
+                subpass_dependency(subpass_uses.at(name), use);
+
+                update(name, [&](Subresource& state, const VkImageSubresourceRange&) {
+                    state.last_use = position;
+
+                    if ((access & write_accesses) || layout != state.layout) {
+                        state.layout = layout;
+                        state.writer = position;
+                        state.write_stage = dst_stage;
+                        state.write_access = access & write_accesses;
+                        state.readers.clear();
+                        state.read_stages = 0;
+                        state.read_access = 0;
+                    } else {
+                        state.readers.emplace_back(position, dst_stage);
+                        state.read_stages |= dst_stage;
+                        state.read_access |= access;
+                    }
+                });
+            }
+
+            attachments[it->second].finalLayout = layout;
+            attachment_subpasses[it->second].second = subpass;
+            attachment_writes[it->second] = attachment_writes[it->second] || (access & write_accesses);
+            subpass_uses[name] = use;
+
+            VkAttachmentReference attachment_ref = {};
+            attachment_ref.attachment = it->second;
+            attachment_ref.layout = layout;
+            return attachment_ref;
+        };
+
+        for (uint32_t subpass_index = 0; subpass_index < compiled.subpasses.size(); ++subpass_index) {
+            const RenderPass& pass = passes[compiled.subpasses[subpass_index]];
+            Subpass& subpass = subpasses[subpass_index];
+
+            // Merged passes only read buffers, so these barriers can all go before the render pass
+            for_each_buffer(pass, sync_buffer);
+
+            // Wait for any past usage
+            for (const auto& [name, self, clear] : pass.input_attachments) {
+                VkAccessFlags access = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+                VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+                VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+                std::optional<VkClearValue> val;
+                if (self) {
+                    access |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+                    layout = VK_IMAGE_LAYOUT_GENERAL;
+                    dst_stage |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+                    if (clear.has_value()) {
+                        val = VkClearValue{};
+                        val->color = clear.value();
+                    }
+                }
+
+                const VkAttachmentReference attachment_ref = use_attachment(subpass_index, name, access, layout, dst_stage, val);
+
+                subpass.input_attachments.push_back(attachment_ref);
+
+                if (self) {
+                    subpass.color_attachments.push_back(attachment_ref);
+                }
+            }
+
+            for (const Name& name : pass.texture_inputs) {
+                const VkAccessFlags access = VK_ACCESS_SHADER_READ_BIT;
+                const VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+                const VkPipelineStageFlags dst_stage =
+                    pass.compute ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+                sync(name, access, layout, dst_stage);
+            }
+
+            for (const auto& [name, dep] : pass.dependencies) {
+                sync(name, dep.access, dep.layout, dep.stage);
+            }
+
+            if (pass.depth_stencil.has_value()) {
+                const auto& [name, clear] = pass.depth_stencil.value();
+
+                VkAccessFlags access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+                VkImageLayout layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+                const VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+                std::optional<VkClearValue> val;
+                if (clear.has_value()) {
+                    access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+                    layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+                    val = VkClearValue{};
+                    val->depthStencil = clear.value();
+                }
+
+                subpass.depth_stencil_attachment = use_attachment(subpass_index, name, access, layout, dst_stage, val);
+            }
+
+            // Synchronize writes
+            for (const Name& name : pass.storage_outputs) {
+                const VkAccessFlags access = VK_ACCESS_SHADER_WRITE_BIT;
+                const VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL;
+                const VkPipelineStageFlags dst_stage = pass.compute ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+                sync(name, access, layout, dst_stage);
+            }
+
+            for (const auto& [name, clear] : pass.color_outputs) {
+                const VkAccessFlags access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+                const VkImageLayout layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+                const VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+                std::optional<VkClearValue> val;
+                if (clear.has_value()) {
+                    val = VkClearValue{};
+                    val->color = clear.value();
+                }
+
+                subpass.color_attachments.push_back(use_attachment(subpass_index, name, access, layout, dst_stage, val));
+            }
+
+            for (const auto& [name, clear] : pass.resolve_outputs) {
+                const VkAccessFlags access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+                const VkImageLayout layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+                const VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+                std::optional<VkClearValue> val;
+                if (clear.has_value()) {
+                    val = VkClearValue{};
+                    val->color = clear.value();
+                }
+
+                // Resolves write every pixel of the target
+                subpass.resolve_attachments.push_back(use_attachment(subpass_index, name, access, layout, dst_stage, val, true));
+            }
+
+            for (const auto& [name, dep] : pass.dependents) {
+                sync(name, dep.access, dep.layout, dep.stage);
+            }
+        }
+
+        // Attachments are only written back if something reads them later: transients not used by a later pass are discarded,
+        // and attachments that were only read are left as they are (when the store op that leaves memory untouched is available)
+        for (const auto& [name, index] : attachment_indices) {
+            if (transients.count(name) && last_uses.at(name) == position)
+                attachments[index].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            else if (!attachment_writes[index] && cache.cx->dynamic_rendering)
+                attachments[index].storeOp = VK_ATTACHMENT_STORE_OP_NONE_KHR;
+        }
+
+        // Layout transitions of attachments that weren't used before don't have to wait on anything
+        if (compiled.src_stages == 0 && (!compiled.barriers.empty() || !compiled.buffer_barriers.empty()))
+            compiled.src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+        if (passes[compiled.subpasses.front()].compute)
+            continue;
+
+        // Passes without input attachments begin rendering directly on the attachments, without render pass and framebuffer objects.
+        // All layouts were already transitioned by the barriers above, and nothing is left for subpass dependencies to synchronize.
+        if (cache.cx->dynamic_rendering && subpasses.size() == 1 && subpasses.front().input_attachments.empty()) {
+            const Subpass& subpass = subpasses.front();
+
+            const auto rendering_attachment = [&](const VkAttachmentReference& ref) {
+                CompiledRenderGraph::RenderingAttachment attachment;
+                attachment.name = compiled.framebuffer_attachments[ref.attachment];
+                attachment.layout = ref.layout;
+                attachment.load_op = attachments[ref.attachment].loadOp;
+                attachment.store_op = attachments[ref.attachment].storeOp;
+                attachment.clear = compiled.clear_values[ref.attachment];
+                compiled.samples = attachments[ref.attachment].samples;
+                return attachment;
+            };
+
+            for (std::size_t i = 0; i < subpass.color_attachments.size(); ++i) {
+                const VkAttachmentReference& ref = subpass.color_attachments[i];
+                compiled.color_attachments.push_back(rendering_attachment(ref));
+                compiled.target.color_formats.push_back(attachments[ref.attachment].format);
+
+                if (!subpass.resolve_attachments.empty())
+                    compiled.color_attachments.back().resolve = compiled.framebuffer_attachments[subpass.resolve_attachments[i].attachment];
+            }
+
+            if (subpass.depth_stencil_attachment.has_value()) {
+                const VkAttachmentReference& ref = subpass.depth_stencil_attachment.value();
+                compiled.depth_attachment = rendering_attachment(ref);
+                compiled.target.depth_format = attachments[ref.attachment].format;
+            }
+
+            continue;
+        }
+
+        // Attachments must be explicitly preserved through the subpasses in between their uses
+        for (uint32_t i = 0; i < attachments.size(); ++i) {
+            const auto [first, last] = attachment_subpasses[i];
+            for (uint32_t j = first + 1; j < last; ++j) {
+                const Subpass& subpass = subpasses[j];
+
+                const auto uses = [i](const VkAttachmentReference& ref) { return ref.attachment == i; };
+                if (std::none_of(subpass.input_attachments.begin(), subpass.input_attachments.end(), uses) &&
+                    std::none_of(subpass.color_attachments.begin(), subpass.color_attachments.end(), uses) &&
+                    std::none_of(subpass.resolve_attachments.begin(), subpass.resolve_attachments.end(), uses) &&
+                    !(subpass.depth_stencil_attachment.has_value() && uses(subpass.depth_stencil_attachment.value())))
+                    subpasses[j].preserve_attachments.push_back(i);
+            }
+        }
+
+        std::vector<VkSubpassDescription> subpass_descs;
+        subpass_descs.reserve(subpasses.size());
+
+        for (const Subpass& subpass : subpasses) {
+            VkSubpassDescription subpass_desc = {};
+            subpass_desc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            subpass_desc.colorAttachmentCount = subpass.color_attachments.size();
+            subpass_desc.pColorAttachments = subpass.color_attachments.data();
+            subpass_desc.inputAttachmentCount = subpass.input_attachments.size();
+            subpass_desc.pInputAttachments = subpass.input_attachments.data();
+            subpass_desc.pResolveAttachments = subpass.resolve_attachments.empty() ? nullptr : subpass.resolve_attachments.data();
+            subpass_desc.preserveAttachmentCount = subpass.preserve_attachments.size();
+            subpass_desc.pPreserveAttachments = subpass.preserve_attachments.data();
+            if (subpass.depth_stencil_attachment.has_value()) {
+                subpass_desc.pDepthStencilAttachment = &subpass.depth_stencil_attachment.value();
+            }
+
+            subpass_descs.push_back(subpass_desc);
+        }
+
+        VkRenderPassCreateInfo rpci = {};
+        rpci.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        rpci.subpassCount = subpass_descs.size();
+        rpci.pSubpasses = subpass_descs.data();
+        rpci.dependencyCount = subpass_dependencies.size();
+        rpci.pDependencies = subpass_dependencies.data();
+        rpci.attachmentCount = attachments.size();
+        rpci.pAttachments = attachments.data();
+
+        compiled.rp = cache.create_pass(rpci);
+    }
+
+    // The first transient in each heap waits on the last transient of the heap, as used by the previous frame.
+    // Compute passes already wait on all earlier graphics work, which in turn waited on the compute work of the previous frame at its end.
+    for (const auto& [index, name] : first_aliases) {
+        const Subresource& previous = transient_state(previous_aliases.at(name));
+
+        CompiledRenderGraph::Pass& compiled = graph.passes[index];
+        if (compiled.async)
+            continue;
+
+        // Last used on the compute queue, which is waited on with a semaphore instead
+        if (previous.async) {
+            compiled.frame_wait_stages |= compiled.dst_stages;
+            compiled.src_stages |= compiled.dst_stages;
+            continue;
+        }
+
+        compiled.src_stages |= previous.write_stage | previous.read_stages;
+
+        for (CompiledRenderGraph::Barrier& barrier : compiled.barriers) {
+            if (barrier.name == name)
+                barrier.src_access = previous.write_access;
+        }
+    }
+
+    // The source stages of a wait must match the stages its events were set with
+    for (std::size_t i = 0; i < graph.passes.size(); ++i) {
+        CompiledRenderGraph::Pass& compiled = graph.passes[i];
+        for (const std::size_t producer : wait_passes[i]) {
+            compiled.wait_events.push_back(graph.passes[producer].event.value());
+            compiled.wait_src_stages |= graph.passes[producer].event_stages;
+        }
+    }
+
+    // Imported attachments are handed back to the graphics queue at the end of the frame
+    for (auto& [handle, image] : tracked_images) {
+        if (image.transient)
+            continue;
+
+        const PassAttachment& attachment = all_attachments.at(image.name);
+        const VkImageSubresourceRange range = vk_subresource_range(0, image.layers, 0, image.mips, attachment.subresource.aspectMask);
+
+        for (const VkImageSubresourceRange& box : partition(image, range)) {
+            Subresource& state = image.at(box.baseMipLevel, box.baseArrayLayer);
+            if (!state.async)
+                continue;
+
+            if (gfx_family != compute_family) {
+                CompiledRenderGraph::Barrier barrier;
+                barrier.name = image.name;
+                barrier.subresource = box;
+                barrier.src_access = 0;
+                barrier.dst_access = 0;
+                barrier.old_layout = state.layout;
+                barrier.new_layout = state.layout;
+                barrier.src_queue = compute_family;
+                barrier.dst_queue = gfx_family;
+
+                release(state, barrier);
+                graph.epilogue.push_back(barrier);
+            }
+
+            for (uint32_t mip = box.baseMipLevel; mip < box.baseMipLevel + box.levelCount; ++mip) {
+                for (uint32_t layer = box.baseArrayLayer; layer < box.baseArrayLayer + box.layerCount; ++layer) {
+                    image.at(mip, layer).async = false;
+                }
+            }
+        }
+    }
+
+    const PassAttachment& output_attachment = all_attachments.at(output);
+    TrackedImage& output_image = tracked_images.at(output_attachment.tex.image.image);
+
+    for (const VkImageSubresourceRange& box : partition(output_image, output_attachment.subresource)) {
+        CompiledRenderGraph::Barrier barrier;
+        barrier.name = output;
+        barrier.subresource = box;
+        barrier.src_access = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dst_access = 0;
+        barrier.old_layout = output_image.at(box.baseMipLevel, box.baseArrayLayer).layout;
+        barrier.new_layout = output_layout;
+        graph.output.push_back(barrier);
+    }
+
+    // History images are only used in full
+    for (const auto& [name, attachment] : attachments) {
+        const VkImageSubresourceRange& range = attachment.subresource;
+        const VkImageLayout layout = tracked_images.at(attachment.tex.image.image).at(range.baseMipLevel, range.baseArrayLayer).layout;
+        graph.final_layouts.emplace(name, name == output ? output_layout : layout);
+    }
+
+    return graph;
+}
+
+// Serializes everything that the compiled schedule depends on, i.e. everything but the image handles.
+std::string RenderGraph::topology() const {
+    std::string key;
+
+    for (std::size_t i = 0; i < passes.size(); ++i) {
+        const RenderPass& pass = passes[i];
+        append_keys(key, static_cast<bool>(enabled[i]), pass.width, pass.height, pass.layers, pass.compute, pass.async);
+
+        append_key(key, pass.depth_stencil.has_value());
+        if (pass.depth_stencil.has_value()) {
+            append_keys(key, pass.depth_stencil->first, pass.depth_stencil->second);
+        }
+
+        append_key(key, pass.color_outputs.size());
+        for (const auto& [name, clear] : pass.color_outputs)
+            append_keys(key, name, clear);
+
+        append_key(key, pass.resolve_outputs.size());
+        for (const auto& [name, clear] : pass.resolve_outputs)
+            append_keys(key, name, clear);
+
+        append_key(key, pass.input_attachments.size());
+        for (const auto& [name, self, clear] : pass.input_attachments)
+            append_keys(key, name, self, clear);
+
+        append_key(key, pass.texture_inputs.size());
+        for (const Name& name : pass.texture_inputs)
+            append_key(key, name);
+
+        append_key(key, pass.storage_outputs.size());
+        for (const Name& name : pass.storage_outputs)
+            append_key(key, name);
+
+        append_key(key, pass.dependencies.size());
+        for (const auto& [name, dep] : pass.dependencies)
+            append_keys(key, name, dep.layout, dep.stage, dep.access);
+
+        append_key(key, pass.dependents.size());
+        for (const auto& [name, dep] : pass.dependents)
+            append_keys(key, name, dep.layout, dep.stage, dep.access);
+
+        append_key(key, pass.buffer_inputs.size());
+        for (const auto& [name, use] : pass.buffer_inputs)
+            append_keys(key, name, use.stage, use.access);
+
+        append_key(key, pass.buffer_outputs.size());
+        for (const auto& [name, use] : pass.buffer_outputs)
+            append_keys(key, name, use.stage, use.access);
+    }
+
+    // Which attachments are views of the same image, by the least name of each image
+    std::unordered_map<VkImage, const Name*> image_names;
+    for (const auto& [name, attachment] : attachments) {
+        const Name*& image_name = image_names[attachment.tex.image.image];
+        if (image_name == nullptr || name.name < image_name->name)
+            image_name = &name;
+    }
+
+    // Attachments are unordered, so they're sorted by their keys (which start with their names)
+    std::vector<std::string> attachment_keys;
+    attachment_keys.reserve(attachments.size());
+    for (const auto& [name, attachment] : attachments) {
+        std::string& ak = attachment_keys.emplace_back();
+        append_keys(ak, name, attachment.tex.image.format, attachment.tex.image.samples, attachment.subresource.aspectMask,
+            attachment.subresource.baseMipLevel, attachment.subresource.levelCount, attachment.subresource.baseArrayLayer,
+            attachment.subresource.layerCount, *image_names.at(attachment.tex.image.image));
+
+        const auto layout = initial_layouts.find(name);
+        append_key(ak, layout != initial_layouts.end() ? std::optional<VkImageLayout>{layout->second} : std::nullopt);
+    }
+
+    std::vector<std::string> transient_keys;
+    transient_keys.reserve(transients.size());
+    for (const auto& [name, desc] : transients) {
+        std::string& tk = transient_keys.emplace_back();
+        append_keys(tk, name, desc.flags, desc.type, desc.view_type, desc.aspect, desc.width, desc.height, desc.depth, desc.layers, desc.mips,
+            desc.samples, desc.usage, desc.format);
+    }
+
+    std::sort(attachment_keys.begin(), attachment_keys.end());
+    std::sort(transient_keys.begin(), transient_keys.end());
+
+    append_key(key, attachment_keys.size());
+    for (const std::string& ak : attachment_keys)
+        key += ak;
+
+    append_key(key, transient_keys.size());
+    for (const std::string& tk : transient_keys)
+        key += tk;
+
+    append_key(key, side_effects.size());
+    for (const Name& name : side_effects)
+        append_key(key, name);
+
+    append_keys(key, output, output_layout);
+
+    return key;
+}
+
+// Replaces every use of a resource by the pass with another name
+void RenderGraph::rename(RenderPass& pass, const Name& from, const Name& to) {
+    const auto replace = [&](Name& name) {
+        if (name == from)
+            name = to;
+    };
+
+    if (pass.depth_stencil.has_value())
+        replace(pass.depth_stencil->first);
+    for (auto& [name, clear] : pass.color_outputs)
+        replace(name);
+    for (auto& [name, clear] : pass.resolve_outputs)
+        replace(name);
+    for (auto& [name, self, clear] : pass.input_attachments)
+        replace(name);
+    for (Name& name : pass.texture_inputs)
+        replace(name);
+    for (Name& name : pass.storage_outputs)
+        replace(name);
+    for (auto& [name, dep] : pass.dependencies)
+        replace(name);
+    for (auto& [name, dep] : pass.dependents)
+        replace(name);
+}
+
+// Whether the pass clears the resource without otherwise reading it, i.e. doesn't depend on its previous contents at all
+bool RenderGraph::discards(const RenderPass& pass, const Name& name) {
+    bool cleared = false;
+    bool read = false;
+
+    const auto use = [&](const Name& other, bool clear) {
+        if (other == name) {
+            cleared |= clear;
+            read |= !clear;
+        }
+    };
+
+    if (pass.depth_stencil.has_value())
+        use(pass.depth_stencil->first, pass.depth_stencil->second.has_value());
+    for (const auto& [other, clear] : pass.color_outputs)
+        use(other, clear.has_value());
+    for (const auto& [other, self, clear] : pass.input_attachments)
+        use(other, self && clear.has_value());
+    for (const auto& [other, clear] : pass.resolve_outputs)
+        use(other, false);
+    for (const Name& other : pass.texture_inputs)
+        use(other, false);
+    for (const Name& other : pass.storage_outputs)
+        use(other, false);
+    for (const auto& [other, dep] : pass.dependencies)
+        use(other, false);
+    for (const auto& [other, dep] : pass.dependents)
+        use(other, false);
+
+    return cleared && !read;
+}
+
+// Walks the passes in traversal order, renaming every use of a transient after it was discarded to a new version of it
+std::vector<std::unordered_map<Name, Name>> RenderGraph::version_transients(const std::vector<std::size_t>& pass_list) {
+    std::vector<std::unordered_map<Name, Name>> versions(passes.size());
+
+    // the current version of each transient, if there were any uses
+    std::unordered_map<Name, uint32_t> current;
+    std::unordered_map<Name, TextureDesc> renamed;
+
+    for (const std::size_t i : pass_list) {
+        RenderPass& pass = passes[i];
+
+        std::vector<Name> names;
+        for_each_attachment(pass, [&](const Name& name) {
+            if (transients.count(name) && std::find(names.begin(), names.end(), name) == names.end())
+                names.push_back(name);
+        });
+
+        for (const Name& name : names) {
+            auto it = current.find(name);
+            if (it == current.end())
+                it = current.emplace(name, 0).first;
+            else if (discards(pass, name))
+                it->second++;
+
+            if (it->second == 0)
+                continue;
+
+            const Name version = {fmt::format("{}.v{}", name.name, it->second)};
+            renamed.emplace(version, transients.at(name));
+            rename(pass, name, version);
+            versions[i].emplace(name, version);
+        }
+    }
+
+    transients.insert(renamed.begin(), renamed.end());
+    return versions;
+}
+
+// Reorders the passes within the constraints of their hazards in the traversal order, greedily picking whichever ready pass
+// (1) continues the previous pass on its attachments, so the two can be merged (or at least keep the attachments in place),
+// (2) runs on the async compute queue, so it's kicked off as early as possible,
+// (3) has waited longest on its producers, so consumers are kept away from their producers to hide the latency between them.
+std::vector<std::size_t> RenderGraph::schedule(const std::vector<std::size_t>& pass_list) const {
+    const std::size_t count = pass_list.size();
+
+    std::vector<std::vector<std::size_t>> successors(count);
+    std::vector<std::size_t> predecessor_counts(count, 0);
+
+    const auto depend = [&](std::size_t src, std::size_t dst) {
+        if (std::find(successors[src].begin(), successors[src].end(), dst) == successors[src].end()) {
+            successors[src].push_back(dst);
+            predecessor_counts[dst]++;
+        }
+    };
+
+    // The last writer of each resource and the readers since, within the traversal order.
+    // Accesses of a resource conflict with those of any resource it overlaps.
+    struct Hazard final {
+        std::optional<std::size_t> writer;
+        std::vector<std::size_t> readers;
+    };
+
+    std::unordered_map<Name, Hazard> hazards;
+
+    const auto use = [&](std::size_t i, const Name& name, bool write) {
+        for (const auto& [other, hazard] : hazards) {
+            if (!overlaps(name, other))
+                continue;
+
+            if (hazard.writer.has_value())
+                depend(hazard.writer.value(), i);
+
+            if (write) {
+                for (const std::size_t reader : hazard.readers)
+                    depend(reader, i);
+            }
+        }
+
+        Hazard& hazard = hazards[name];
+        if (write) {
+            hazard.writer = i;
+            hazard.readers.clear();
+        } else {
+            hazard.readers.push_back(i);
+        }
+    };
+
+    for (std::size_t i = 0; i < count; ++i) {
+        const RenderPass& pass = passes[pass_list[i]];
+
+        // Anything that isn't known to only be read is considered a write
+        for_each_attachment(pass, [&](const Name& name) {
+            const bool read = std::find(pass.texture_inputs.begin(), pass.texture_inputs.end(), name) != pass.texture_inputs.end() ||
+                              std::any_of(pass.input_attachments.begin(), pass.input_attachments.end(),
+                                  [&name](const auto& input) { return std::get<0>(input) == name && !std::get<1>(input); }) ||
+                              (pass.depth_stencil.has_value() && pass.depth_stencil->first == name && !pass.depth_stencil->second.has_value());
+            use(i, name, !read);
+        });
+
+        for_each_buffer(pass, [&](const Name& name, const RenderPass::BufferAccess&, bool write) { use(i, name, write); });
+    }
+
+    // Attachments that could be shared with the directly preceding pass
+    const auto attachment_names = [](const RenderPass& pass) {
+        std::vector<Name> names;
+        for (const auto& [name, self, clear] : pass.input_attachments)
+            names.push_back(name);
+        if (pass.depth_stencil.has_value())
+            names.push_back(pass.depth_stencil->first);
+        for (const auto& [name, clear] : pass.color_outputs)
+            names.push_back(name);
+        return names;
+    };
+
+    const auto continues = [&](const RenderPass& prev, const RenderPass& pass) {
+        if (prev.compute || pass.compute || prev.width != pass.width || prev.height != pass.height || prev.layers != pass.layers)
+            return false;
+
+        const std::vector<Name> prev_names = attachment_names(prev);
+        for (const Name& name : attachment_names(pass)) {
+            if (std::find(prev_names.begin(), prev_names.end(), name) != prev_names.end())
+                return true;
+        }
+
+        return false;
+    };
+
+    std::vector<std::size_t> ready;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (predecessor_counts[i] == 0)
+            ready.push_back(i);
+    }
+
+    // One past the position of the latest producer of each pass
+    std::vector<std::size_t> ready_after(count, 0);
+
+    std::vector<std::size_t> order;
+    order.reserve(count);
+
+    while (!ready.empty()) {
+        const RenderPass* prev = order.empty() ? nullptr : &passes[pass_list[order.back()]];
+
+        const auto score = [&](std::size_t i) {
+            const RenderPass& pass = passes[pass_list[i]];
+            return std::make_tuple(prev != nullptr && continues(*prev, pass), pass.async, std::numeric_limits<std::size_t>::max() - ready_after[i],
+                std::numeric_limits<std::size_t>::max() - i);
+        };
+
+        const auto it = std::max_element(ready.begin(), ready.end(), [&](std::size_t a, std::size_t b) { return score(a) < score(b); });
+        const std::size_t i = *it;
+        ready.erase(it);
+
+        order.push_back(i);
+
+        for (const std::size_t successor : successors[i]) {
+            ready_after[successor] = std::max(ready_after[successor], order.size());
+            if (--predecessor_counts[successor] == 0)
+                ready.push_back(successor);
+        }
+    }
+
+    PK_ASSERT(order.size() == count);
+
+    std::vector<std::size_t> scheduled;
+    scheduled.reserve(count);
+    for (const std::size_t i : order) {
+        scheduled.push_back(pass_list[i]);
+    }
+
+    return scheduled;
+}
+
+std::vector<std::vector<std::size_t>> RenderGraph::merge_passes(const std::vector<std::size_t>& pass_list, bool merge) const {
+    std::vector<std::vector<std::size_t>> groups;
+
+    // Resources of the current group, by whether they're only accessed as attachments (i.e. per-pixel) or not
+    std::unordered_set<Name> group_attachments;
+    std::unordered_set<Name> group_textures;
+
+    const auto attachment_names = [](const RenderPass& pass) {
+        std::vector<Name> names;
+        for (const auto& [name, self, clear] : pass.input_attachments)
+            names.push_back(name);
+        if (pass.depth_stencil.has_value())
+            names.push_back(pass.depth_stencil->first);
+        for (const auto& [name, clear] : pass.color_outputs)
+            names.push_back(name);
+        for (const auto& [name, clear] : pass.resolve_outputs)
+            names.push_back(name);
+        return names;
+    };
+
+    const auto cleared = [](const RenderPass& pass, const Name& name) {
+        for (const auto& [other, self, clear] : pass.input_attachments) {
+            if (other == name && self && clear.has_value())
+                return true;
+        }
+
+        if (pass.depth_stencil.has_value() && pass.depth_stencil->first == name && pass.depth_stencil->second.has_value())
+            return true;
+
+        const auto cleared_output = [&name](const std::pair<Name, std::optional<VkClearColorValue>>& output) {
+            return output.first == name && output.second.has_value();
+        };
+
+        return std::any_of(pass.color_outputs.begin(), pass.color_outputs.end(), cleared_output) ||
+               std::any_of(pass.resolve_outputs.begin(), pass.resolve_outputs.end(), cleared_output);
+    };
+
+    const auto can_merge = [&](const RenderPass& pass) {
+        const RenderPass& first = passes[groups.back().front()];
+
+        if (pass.compute || first.compute)
+            return false;
+
+        if (!pass.storage_outputs.empty() || !first.storage_outputs.empty())
+            return false;
+
+        if (!pass.buffer_outputs.empty() || !first.buffer_outputs.empty())
+            return false;
+
+        if (pass.width != first.width || pass.height != first.height || pass.layers != first.layers)
+            return false;
+
+        // Arbitrary dependencies can't be expressed within a render pass
+        if (!pass.dependencies.empty() || !pass.dependents.empty() || !first.dependencies.empty() || !first.dependents.empty())
+            return false;
+
+        // Views of the same image may be attachments of the same render pass as long as they don't overlap
+        for (const Name& name : pass.texture_inputs) {
+            for (const Name& other : group_attachments) {
+                if (overlaps(name, other))
+                    return false;
+            }
+        }
+
+        for (const Name& name : attachment_names(pass)) {
+            for (const Name& other : group_textures) {
+                if (overlaps(name, other))
+                    return false;
+            }
+
+            for (const Name& other : group_attachments) {
+                if (overlaps(name, other) && (!(name == other) || cleared(pass, name)))
+                    return false;
+            }
+        }
+
+        return true;
+    };
+
+    for (const std::size_t i : pass_list) {
+        const RenderPass& pass = passes[i];
+
+        if (groups.empty() || !merge || !can_merge(pass)) {
+            groups.emplace_back();
+            group_attachments.clear();
+            group_textures.clear();
+        }
+
+        groups.back().push_back(i);
+
+        for (const Name& name : attachment_names(pass))
+            group_attachments.insert(name);
+        for (const Name& name : pass.texture_inputs)
+            group_textures.insert(name);
+    }
+
+    return groups;
+}
+
+std::unordered_map<Name, Name> RenderGraph::alias_transients(
+    CompiledRenderGraph& graph, RenderGraphCache& cache, const std::vector<std::vector<std::size_t>>& groups) const {
+    struct Lifetime final {
+        Name name;
+        Image image;
+        VkMemoryRequirements reqs;
+        std::size_t first;
+        std::size_t last;
+    };
+
+    std::vector<Lifetime> lifetimes;
+    lifetimes.reserve(transients.size());
+
+    std::unordered_map<Name, std::size_t> indices;
+
+    for (const auto& [name, desc] : transients) {
+        Lifetime lifetime;
+        lifetime.name = name;
+        lifetime.image = cache.cx->alloc.create_image(vk_image_create_info(desc));
+        lifetime.first = std::numeric_limits<std::size_t>::max();
+        lifetime.last = 0;
+        vkGetImageMemoryRequirements(cache.cx->dev, lifetime.image.image, &lifetime.reqs);
+
+        indices.emplace(name, lifetimes.size());
+        lifetimes.push_back(lifetime);
+    }
+
+    // Lifetimes are counted in render passes, since attachments of the same render pass can't alias
+    for (std::size_t i = 0; i < groups.size(); ++i) {
+        for (const std::size_t pass : groups[i]) {
+            for_each_attachment(passes[pass], [&](const Name& name) {
+                const auto it = indices.find(name);
+                if (it != indices.end()) {
+                    Lifetime& lifetime = lifetimes[it->second];
+                    lifetime.first = std::min(lifetime.first, i);
+                    lifetime.last = std::max(lifetime.last, i);
+                }
+            });
+        }
+    }
+
+    // Unused transients are still accessible from attachment(), so keep them alive for the whole frame
+    for (Lifetime& lifetime : lifetimes) {
+        if (lifetime.first > lifetime.last) {
+            lifetime.first = 0;
+            lifetime.last = groups.size();
+        }
+    }
+
+    struct Heap final {
+        uint32_t memory_types;
+        std::vector<std::size_t> members;
+    };
+
+    std::vector<std::size_t> order(lifetimes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&lifetimes](std::size_t a, std::size_t b) { return lifetimes[a].reqs.size > lifetimes[b].reqs.size; });
+
+    // Greedily place the largest transients first; a heap is shared by transients that are never alive at the same time
+    std::vector<Heap> heaps;
+    for (const std::size_t i : order) {
+        const Lifetime& lifetime = lifetimes[i];
+
+        const auto heap = std::find_if(heaps.begin(), heaps.end(), [&](const Heap& heap) {
+            if (!(heap.memory_types & lifetime.reqs.memoryTypeBits))
+                return false;
+
+            return std::none_of(heap.members.begin(), heap.members.end(), [&](std::size_t j) {
+                const Lifetime& other = lifetimes[j];
+                return lifetime.first <= other.last && other.first <= lifetime.last;
+            });
+        });
+
+        if (heap != heaps.end()) {
+            heap->memory_types &= lifetime.reqs.memoryTypeBits;
+            heap->members.push_back(i);
+        } else {
+            heaps.push_back(Heap{lifetime.reqs.memoryTypeBits, {i}});
+        }
+    }
+
+    std::unordered_map<Name, Name> previous_aliases;
+
+    for (Heap& heap : heaps) {
+        std::sort(heap.members.begin(), heap.members.end(), [&lifetimes](std::size_t a, std::size_t b) { return lifetimes[a].first < lifetimes[b].first; });
+
+        std::vector<Image> images;
+        images.reserve(heap.members.size());
+
+        for (std::size_t i = 0; i < heap.members.size(); ++i) {
+            const std::size_t previous = heap.members[(i + heap.members.size() - 1) % heap.members.size()];
+            previous_aliases.emplace(lifetimes[heap.members[i]].name, lifetimes[previous].name);
+            images.push_back(lifetimes[heap.members[i]].image);
+        }
+
+        graph.heaps.push_back(cache.cx->alloc.alias(images, VMA_MEMORY_USAGE_GPU_ONLY));
+    }
+
+    for (const Lifetime& lifetime : lifetimes) {
+        const TextureDesc& desc = transients.at(lifetime.name);
+
+        PassAttachment attachment;
+        attachment.tex = create_texture(cache.cx->dev, lifetime.image, vk_image_view_create_info(desc, lifetime.image.image));
+        attachment.subresource = vk_subresource_range(0, desc.layers, 0, desc.mips, desc.aspect);
+
+        graph.transients.emplace(lifetime.name, attachment);
+    }
+
+    return previous_aliases;
+}
+
+VkImageMemoryBarrier RenderGraph::image_barrier(const CompiledRenderGraph::Barrier& barrier) const {
+    const PassAttachment& attachment = attachments.at(barrier.name);
+
+    VkImageMemoryBarrier out = {};
+    out.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    out.image = attachment.tex.image.image;
+    out.srcAccessMask = barrier.src_access;
+    out.dstAccessMask = barrier.dst_access;
+    out.oldLayout = barrier.old_layout;
+    out.newLayout = barrier.new_layout;
+    out.srcQueueFamilyIndex = barrier.src_queue;
+    out.dstQueueFamilyIndex = barrier.dst_queue;
+    out.subresourceRange = barrier.subresource;
+    return out;
+}
+
+VkBufferMemoryBarrier RenderGraph::buffer_barrier(const CompiledRenderGraph::BufferBarrier& barrier) const {
+    const Buffer& buffer = buffers.at(barrier.name).buffer;
+
+    VkBufferMemoryBarrier out = {};
+    out.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    out.buffer = buffer.buffer;
+    out.offset = buffer.offset;
+    out.size = buffer.size;
+    out.srcAccessMask = barrier.src_access;
+    out.dstAccessMask = barrier.dst_access;
+    out.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    out.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    return out;
+}
+
+bool RenderGraph::overlaps(const Name& a, const Name& b) const {
+    if (a == b)
+        return true;
+
+    const auto it_a = attachments.find(a);
+    const auto it_b = attachments.find(b);
+    if (it_a == attachments.end() || it_b == attachments.end() || it_a->second.tex.image.image != it_b->second.tex.image.image)
+        return false;
+
+    const VkImageSubresourceRange& x = it_a->second.subresource;
+    const VkImageSubresourceRange& y = it_b->second.subresource;
+    return x.baseArrayLayer < y.baseArrayLayer + y.layerCount && y.baseArrayLayer < x.baseArrayLayer + x.layerCount &&
+           x.baseMipLevel < y.baseMipLevel + y.levelCount && y.baseMipLevel < x.baseMipLevel + x.levelCount;
+}
+
+std::vector<std::size_t> RenderGraph::find_all(std::function<bool(const RenderPass&)> pred) const {
+    std::vector<std::size_t> indices;
+    for (std::size_t i = 0; i < passes.size(); ++i) {
+        if (enabled[i] && pred(passes[i]))
+            indices.push_back(i);
+    }
+    return indices;
+}
+
+void RenderGraph::push_writers(std::vector<std::size_t>& all_writers, Name res) const {
+    // Writes to any view of the image that overlaps the resource count
+    const auto writes = [this, &res](const auto& outputs) {
+        return std::any_of(outputs.begin(), outputs.end(), [this, &res](const auto& output) { return overlaps(output.first, res); });
+    };
+
+    const std::vector<std::size_t> writers = find_all([&](const RenderPass& pass) -> bool {
+        return writes(pass.color_outputs) || writes(pass.resolve_outputs) || writes(pass.dependents) ||
+               std::any_of(pass.storage_outputs.begin(), pass.storage_outputs.end(), [this, &res](const Name& name) { return overlaps(name, res); }) ||
+               std::find(pass.buffer_outputs.begin(), pass.buffer_outputs.end(), res) != pass.buffer_outputs.end() ||
+               (pass.depth_stencil.has_value() ? pass.depth_stencil.value().second.has_value() && overlaps(pass.depth_stencil.value().first, res) : false);
+    });
+
+    list_append(all_writers, writers);
+
+    for (const std::size_t i : writers) {
+        const RenderPass& pass = passes[i];
+
+        if (pass.depth_stencil.has_value())
+            if (!pass.depth_stencil->second.has_value())
+                push_writers(all_writers, pass.depth_stencil.value().first);
+
+        for (const auto& [res, clear] : pass.color_outputs)
+            if (!clear.has_value())
+                push_writers(all_writers, res);
+
+        for (const auto& [res, self, clear] : pass.input_attachments)
+            if (!self)
+                push_writers(all_writers, res);
+
+        for (const Name& res : pass.texture_inputs)
+            push_writers(all_writers, res);
 
         for (const auto& [res, _] : pass.dependencies)
             push_writers(all_writers, res);
+
+        for (const auto& [res, _] : pass.buffer_inputs)
+            if (std::find(pass.buffer_outputs.begin(), pass.buffer_outputs.end(), res) == pass.buffer_outputs.end())
+                push_writers(all_writers, res);
     }
 }
 
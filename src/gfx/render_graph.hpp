@@ -2,6 +2,8 @@
 
 #include "types.hpp"
 #include "vk_helpers.hpp"
+#include "cmd_pool.hpp"
+#include "pipeline_cache.hpp"
 
 #include <vector>
 #include <string>
@@ -11,6 +13,7 @@
 #include <optional>
 #include <functional>
 #include <unordered_map>
+#include <mutex>
 
 namespace gfx {
 
@@ -59,15 +62,26 @@ class RenderPass final {
     void push_resolve_output(Name name, std::optional<VkClearColorValue> clear);
     void push_input_attachment(Name name, bool self, std::optional<VkClearColorValue> clear);
     void push_texture_input(Name name);
-    void push_dependency(Name name, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access, bool virt = false);
-    void push_dependent(Name name, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access, bool virt = false);
+    // Images written from shaders, e.g. by compute passes
+    void push_storage_output(Name name);
+    void push_dependency(Name name, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access);
+    void push_dependent(Name name, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access);
+    // Buffers are synchronized by the graph like attachments. Outputs may also read the previous contents, but don't pull in earlier writers.
+    void push_buffer_input(Name name, VkPipelineStageFlags stage, VkAccessFlags access);
+    void push_buffer_output(Name name, VkPipelineStageFlags stage, VkAccessFlags access);
 
     void set_pre_exec(std::function<void(FrameContext&, const class RenderGraph&, VkRenderPass)> pre_exec);
     void set_exec(std::function<void(FrameContext&, const class RenderGraph&, VkRenderPass)> exec);
+    // Compute passes are recorded outside of any render pass; async ones are submitted to the compute queue, overlapping with graphics work.
+    void set_compute(bool async);
+    // Evaluated once per exec; disabled passes are left out of the compiled graph along with everything only they depend on.
+    void set_predicate(std::function<bool()> predicate);
 
     uint32_t width = 0;
     uint32_t height = 0;
     uint32_t layers = 0;
+    // only used for debugging output
+    std::string name;
 
   private:
     friend class RenderGraph;
@@ -76,7 +90,11 @@ class RenderPass final {
         VkImageLayout layout;
         VkPipelineStageFlags stage;
         VkAccessFlags access;
-        bool virt;
+    };
+
+    struct BufferAccess final {
+        VkPipelineStageFlags stage;
+        VkAccessFlags access;
     };
 
     std::optional<std::pair<Name, std::optional<VkClearDepthStencilValue>>> depth_stencil;
@@ -84,30 +102,243 @@ class RenderPass final {
     std::vector<std::pair<Name, std::optional<VkClearColorValue>>> resolve_outputs;
     std::vector<std::tuple<Name, bool, std::optional<VkClearColorValue>>> input_attachments;
     std::vector<Name> texture_inputs;
+    std::vector<Name> storage_outputs;
     std::vector<std::pair<Name, Dependency>> dependencies;
     std::vector<std::pair<Name, Dependency>> dependents;
+    std::vector<std::pair<Name, BufferAccess>> buffer_inputs;
+    std::vector<std::pair<Name, BufferAccess>> buffer_outputs;
 
     std::function<void(FrameContext&, const class RenderGraph&, VkRenderPass)> pre_exec;
     std::function<void(FrameContext&, const class RenderGraph&, VkRenderPass)> exec;
+    std::function<bool()> predicate;
+
+    bool compute = false;
+    bool async = false;
+};
+
+// The pass order, barriers and render passes derived from a render graph, reused for as long as the graph topology doesn't change.
+// Images are referenced by name so that the schedule can be replayed against the attachments of each frame (e.g. the acquired swapchain image).
+struct CompiledRenderGraph final {
+    // Attachments that are views of the same image are synchronized per subresource, so barriers may cover only part of (or more than) the attachment
+    struct Barrier final {
+        Name name;
+        VkImageSubresourceRange subresource;
+        VkAccessFlags src_access;
+        VkAccessFlags dst_access;
+        VkImageLayout old_layout;
+        VkImageLayout new_layout;
+        // queue family ownership transfer, if any
+        uint32_t src_queue = VK_QUEUE_FAMILY_IGNORED;
+        uint32_t dst_queue = VK_QUEUE_FAMILY_IGNORED;
+    };
+
+    struct BufferBarrier final {
+        Name name;
+        VkAccessFlags src_access;
+        VkAccessFlags dst_access;
+    };
+
+    struct RenderingAttachment final {
+        Name name;
+        VkImageLayout layout;
+        VkAttachmentLoadOp load_op;
+        VkAttachmentStoreOp store_op;
+        VkClearValue clear;
+        std::optional<Name> resolve;
+    };
+
+    // Consecutive compatible passes are merged into the subpasses of a single render pass
+    struct Pass final {
+        std::vector<std::size_t> subpasses;
+
+        // pipeline barrier for dependencies on the previous pass (or on anything before the frame)
+        VkPipelineStageFlags src_stages;
+        VkPipelineStageFlags dst_stages;
+        std::vector<Barrier> barriers;
+        std::vector<BufferBarrier> buffer_barriers;
+
+        // split barrier for dependencies on earlier passes, which signal their event as soon as they finish
+        std::vector<std::size_t> wait_events;
+        VkPipelineStageFlags wait_src_stages;
+        VkPipelineStageFlags wait_dst_stages;
+        std::vector<Barrier> wait_barriers;
+        std::vector<BufferBarrier> wait_buffer_barriers;
+
+        std::optional<std::size_t> event;
+        VkPipelineStageFlags event_stages;
+
+        // the pass runs on the async compute queue; graphics passes wait on the latest compute pass they depend on with a semaphore
+        bool async;
+        std::optional<std::size_t> queue_wait;
+        VkPipelineStageFlags queue_wait_stages;
+        // graphics passes also wait on the compute work of the previous frame, where they're first to use a resource it may have used
+        VkPipelineStageFlags frame_wait_stages;
+
+        // ownership of attachments used next on the other queue is released after the pass
+        VkPipelineStageFlags release_stages;
+        std::vector<Barrier> releases;
+
+        // not created for compute passes, nor with dynamic rendering
+        VkRenderPass rp;
+        std::vector<Name> framebuffer_attachments;
+        std::vector<VkClearValue> clear_values;
+
+        // framebuffer of the last replay
+        VkFramebuffer fb;
+
+        // dynamic rendering
+        std::vector<RenderingAttachment> color_attachments;
+        std::optional<RenderingAttachment> depth_attachment;
+        VkSampleCountFlagBits samples;
+        PipelineTarget target;
+    };
+
+    std::vector<Pass> passes;
+    // Imported attachments are owned by the graphics queue outside of the graph
+    std::vector<Barrier> prologue;
+    std::vector<Barrier> epilogue;
+    std::vector<Barrier> output;
+    std::size_t event_count;
+    uint32_t elided_barriers;
+    // the scheduled pass order next to the declaration order, for debugging
+    std::string schedule;
+    // per pass, the versions of the transients it uses where they're not the first
+    std::vector<std::unordered_map<Name, Name>> versions;
+    // layouts imported attachments are left in, which history images start out in next frame
+    std::unordered_map<Name, VkImageLayout> final_layouts;
+    uint32_t culled_passes;
+    // the topology of the render graph the graph was compiled from, which cache lookups compare against
+    std::string topology;
+    // frame of the cache the graph was last executed in
+    uint64_t last_use;
+
+    // transient attachments are owned by the compiled graph, with attachments of non-overlapping lifetimes sharing memory
+    std::unordered_map<Name, PassAttachment> transients;
+    std::vector<VmaAllocation> heaps;
+};
+
+struct RenderGraphStats final {
+    uint32_t passes = 0;
+    uint32_t render_passes = 0;
+    uint32_t pipeline_barriers = 0;
+    uint32_t split_barriers = 0;
+    uint32_t image_barriers = 0;
+    uint32_t buffer_barriers = 0;
+    uint32_t elided_barriers = 0;
+    uint32_t queue_transfers = 0;
+    uint32_t compute_submits = 0;
+    uint32_t secondary_buffers = 0;
+    uint32_t culled_passes = 0;
 };
 
 class RenderGraphCache {
   public:
-    void init(VkDevice dev);
+    // Compiled graphs, render passes, and framebuffers that weren't used for this many frames are destroyed (once the GPU is done with them)
+    static constexpr uint64_t max_unused_frames = 8;
+
+    void init(Context& cx);
     void cleanup();
 
     void clear();
+    // Only destroys the compiled graphs (and their transient attachments), the framebuffers and the history images, e.g. when attachments are resized.
+    void clear_graphs();
 
     VkRenderPass create_pass(const VkRenderPassCreateInfo& rpci);
     VkFramebuffer create_framebuffer(const VkFramebufferCreateInfo& fbci);
 
+    VkEvent take_event();
+    void replace_event(VkEvent event);
+
+    // Makes the next submission of fcx wait at the stages on all compute work submitted by the graphs so far
+    void wait_compute(FrameContext& fcx, VkPipelineStageFlags stages) const;
+
+    // Barrier counts of the last executed graph
+    const RenderGraphStats& stats() const;
+    // Pass order of the last executed graph
+    const std::string& schedule() const;
+
   private:
     friend class RenderGraph;
 
-    VkDevice dev;
+    void destroy(CompiledRenderGraph& graph);
+    void evict(FrameContext& fcx);
+
+    // Owned copies of create infos; lookups compare against them in full, as different create infos may hash the same
+    struct StoredRenderPass final {
+        explicit StoredRenderPass(const VkRenderPassCreateInfo& rpci);
+        StoredRenderPass(StoredRenderPass&&) = default;
+        StoredRenderPass(const StoredRenderPass&) = delete;
+
+        StoredRenderPass& operator=(StoredRenderPass&&) = default;
+        StoredRenderPass& operator=(const StoredRenderPass&) = delete;
+
+        // points into the arrays below
+        VkRenderPassCreateInfo info;
+        std::vector<VkAttachmentDescription> attachments;
+        std::vector<VkSubpassDescription> subpasses;
+        std::vector<VkSubpassDependency> dependencies;
+        std::vector<VkAttachmentReference> references;
+        std::vector<uint32_t> preserved;
+    };
+
+    struct StoredFramebuffer final {
+        explicit StoredFramebuffer(const VkFramebufferCreateInfo& fbci);
+        StoredFramebuffer(StoredFramebuffer&&) = default;
+        StoredFramebuffer(const StoredFramebuffer&) = delete;
+
+        StoredFramebuffer& operator=(StoredFramebuffer&&) = default;
+        StoredFramebuffer& operator=(const StoredFramebuffer&) = delete;
+
+        // points into views
+        VkFramebufferCreateInfo info;
+        std::vector<VkImageView> views;
+    };
+
+    template <typename Stored, typename Handle>
+    struct Entry final {
+        Stored stored;
+        Handle handle;
+        uint64_t last_use;
+    };
+
+    template <typename Stored, typename Handle, typename Info, typename F>
+    Handle find_or_create(std::unordered_map<std::size_t, std::vector<Entry<Stored, Handle>>>& entries, const Info& info, F&& create);
+
+    // The images of a history resource, of which the current one is written this frame and the others in the frames before
+    struct History final {
+        std::size_t desc_hash;
+        std::vector<Texture> images;
+        std::vector<VkImageLayout> layouts;
+        uint32_t current;
+    };
+
+    Context* cx;
+
+    std::vector<VkEvent> events;
+    std::mutex events_m;
 
-    std::unordered_map<std::size_t, VkRenderPass> passes;
-    std::unordered_map<std::size_t, VkFramebuffer> framebuffers;
+    // Subpasses are recorded into secondary command buffers on the worker threads, each of which allocates from its own pool
+    std::vector<CommandPool> secondary_pools;
+
+    // Submissions of the graph to either queue signal increasing values of the queue's timeline
+    VkSemaphore gfx_timeline;
+    VkSemaphore compute_timeline;
+    uint64_t gfx_value = 0;
+    uint64_t compute_value = 0;
+    // the last value signalled by the compute work of the previous graph, if it had any
+    uint64_t previous_compute_value = 0;
+
+    RenderGraphStats last_stats;
+    std::string last_schedule;
+
+    // counts executed graphs
+    uint64_t frame = 0;
+
+    std::unordered_map<std::size_t, std::vector<Entry<StoredRenderPass, VkRenderPass>>> passes;
+    std::unordered_map<std::size_t, std::vector<Entry<StoredFramebuffer, VkFramebuffer>>> framebuffers;
+    // keyed by the hash of their topologies
+    std::unordered_multimap<std::size_t, CompiledRenderGraph> graphs;
+    std::unordered_map<Name, History> histories;
 };
 
 // Render graphs are a handy abstraction for automatically handling synchronization between render passes.
@@ -117,24 +348,65 @@ class RenderGraph final {
     void push_pass(RenderPass pass);
 
     void push_attachment(Name name, PassAttachment attachment);
+    // Transient attachments are created by the graph and only live for the duration of the frame; their contents are undefined at first use.
+    // Transients are only available from attachment() within pass callbacks. Clearing a transient that was already used starts a new version
+    // of it with its own image, so later passes don't wait on uses of the earlier contents; attachment() returns the version of the calling pass.
+    void push_transient(Name name, const TextureDesc& desc);
     void push_buffer(Name name, PassBuffer buffer);
     void push_initial_layout(Name name, VkImageLayout layout);
+    // History resources keep their images across frames: `name` is the image of this frame and history(name, n) the one of n frames ago.
+    // The images are rotated and carry their layouts over by the graph, and are recreated with undefined contents when the description changes.
+    void push_history(Name name, const TextureDesc& desc, uint32_t frames);
+    static Name history(const Name& name, uint32_t age = 1);
 
     PassAttachment attachment(Name name) const;
     PassBuffer buffer(Name name) const;
+    // Subpass index of the currently executing pass within its render pass, e.g. for pipeline creation.
+    // Passes record in parallel, so this is only valid within pass callbacks.
+    uint32_t subpass() const;
+    // Whatever the currently executing pass renders into, to retrieve pipelines for. Only valid within pass callbacks.
+    const PipelineTarget& target() const;
 
     void set_output(Name name, VkImageLayout layout);
+    // Passes that write neither to the output nor to a side effect are culled
+    void push_side_effect(Name name);
 
     void exec(FrameContext& fcx, RenderGraphCache& cache);
 
   private:
+    void rotate_histories(FrameContext& fcx, RenderGraphCache& cache);
+
+    CompiledRenderGraph compile(RenderGraphCache& cache) const;
+    std::vector<std::unordered_map<Name, Name>> version_transients(const std::vector<std::size_t>& pass_list);
+    CompiledRenderGraph build(RenderGraphCache& cache, CompiledRenderGraph graph, std::vector<std::size_t> pass_list) const;
+    std::vector<std::size_t> schedule(const std::vector<std::size_t>& pass_list) const;
+    std::vector<std::vector<std::size_t>> merge_passes(const std::vector<std::size_t>& pass_list, bool merge) const;
+    std::unordered_map<Name, Name> alias_transients(
+        CompiledRenderGraph& graph, RenderGraphCache& cache, const std::vector<std::vector<std::size_t>>& groups) const;
+    std::string topology() const;
+    VkImageMemoryBarrier image_barrier(const CompiledRenderGraph::Barrier& barrier) const;
+    VkBufferMemoryBarrier buffer_barrier(const CompiledRenderGraph::BufferBarrier& barrier) const;
+
+    template <typename F>
+    static void for_each_attachment(const RenderPass& pass, F&& f);
+    template <typename F>
+    static void for_each_buffer(const RenderPass& pass, F&& f);
+    static void rename(RenderPass& pass, const Name& from, const Name& to);
+    static bool discards(const RenderPass& pass, const Name& name);
+
     std::vector<std::size_t> find_all(std::function<bool(const RenderPass&)> pred) const;
+    // Whether both are the same resource, or views of the same image sharing any subresource
+    bool overlaps(const Name& a, const Name& b) const;
     void push_writers(std::vector<std::size_t>& writers, Name res) const;
 
     std::unordered_map<Name, PassAttachment> attachments;
+    std::unordered_map<Name, TextureDesc> transients;
     std::unordered_map<Name, PassBuffer> buffers;
     std::unordered_map<Name, VkImageLayout> initial_layouts;
+    std::unordered_map<Name, std::pair<TextureDesc, uint32_t>> histories;
     std::vector<RenderPass> passes;
+    std::vector<bool> enabled;
+    std::vector<Name> side_effects;
     Name output;
     VkImageLayout output_layout;
 };
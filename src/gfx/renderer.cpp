@@ -5,12 +5,36 @@
 #include "render_graph.hpp"
 
 #include <GLFW/glfw3.h>
+#include <imgui.h>
 
 #include <chrono>
+#include <fstream>
+#include <algorithm>
 #include <spdlog/spdlog.h>
+#include <spdlog/fmt/fmt.h>
 
 namespace gfx {
 
+// Binary PPM of the RGB channels of tightly packed RGBA8 pixels
+static void write_ppm(const std::string& path, uint32_t width, uint32_t height, const uint8_t* rgba) {
+    std::ofstream f{path, std::ios::binary};
+    if (!f) {
+        spdlog::error("failed to open {} to write the frame", path);
+        return;
+    }
+
+    f << fmt::format("P6\n{} {}\n255\n", width, height);
+
+    std::vector<uint8_t> row(width * 3);
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            const uint8_t* pixel = rgba + (y * width + x) * 4;
+            std::copy(pixel, pixel + 3, &row[x * 3]);
+        }
+        f.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+}
+
 void Renderer::init(Context& cx) {
     this->cx = &cx;
 
@@ -20,12 +44,26 @@ void Renderer::init(Context& cx) {
         frame_data[i].render_semaphore = vk_create_semaphore(cx.dev);
         frame_data[i].render_fence = vk_create_fence(cx.dev, true);
     }
+    frame_num = 0;
+
+    cx.uploads.init(cx, FRAMES_IN_FLIGHT);
 
     FrameContext fcx{cx};
     fcx.begin();
 
     cx.post_init(fcx);
 
+    if (cx.headless()) {
+        TextureDesc desc;
+        desc.width = cx.width;
+        desc.height = cx.height;
+        desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        // The composite pass writes linear colour, which is sRGB encoded on store like in the swapchain images
+        desc.format = VK_FORMAT_R8G8B8A8_SRGB;
+
+        offscreen = create_texture(cx, desc);
+    }
+
     pbr_pass.init(fcx);
     composite_pass.init(fcx);
     resolve_pass.init(fcx);
@@ -34,12 +72,24 @@ void Renderer::init(Context& cx) {
     prepass_pass.init(fcx);
 
     world.begin(fcx);
+    // the assets of the world become resident while the first frames render
+    cx.transfers.submit();
 
     fcx.end();
     std::move(fcx).submit(cx.gfx_queue).get();
 }
 
 void Renderer::cleanup() {
+    // the transfer queue may still be writing assets
+    vk_log(vkDeviceWaitIdle(cx->dev));
+
+    for (auto& frame : frame_data) {
+        if (frame.retired.has_value()) {
+            std::move(*frame.retired).release();
+            frame.retired.reset();
+        }
+    }
+
     FrameContext fcx{*cx};
     fcx.begin();
 
@@ -60,10 +110,15 @@ void Renderer::cleanup() {
         vkDestroyFence(cx->dev, frame.render_fence, nullptr);
     }
 
+    if (cx->headless())
+        destroy_texture(*cx, offscreen);
+
     cx->pre_cleanup(fcx);
 
     fcx.end();
     std::move(fcx).submit(cx->gfx_queue).get();
+
+    cx->uploads.cleanup();
 }
 
 void Renderer::run() {
@@ -76,21 +131,51 @@ void Renderer::run() {
     }
 }
 
-void Renderer::render() {
+void Renderer::run_headless(uint64_t frames, const std::string& capture_dir) {
+    time = 0.0;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < frames; ++i) {
+        render(capture_dir.empty() ? std::string{} : fmt::format("{}/frame_{:05}.ppm", capture_dir, i));
+    }
+    vk_log(vkDeviceWaitIdle(cx->dev));
+
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    spdlog::info("rendered {} frames of {}x{} in {:.2f} ms ({:.3f} ms per frame)", frames, cx->width, cx->height, elapsed.count(),
+        elapsed.count() / static_cast<double>(std::max<uint64_t>(frames, 1)));
+}
+
+void Renderer::render(const std::string& capture_path) {
     auto& frame = current_frame();
 
     vk_log(vkWaitForFences(cx->dev, 1, &frame.render_fence, true, 1000000000));
     vk_log(vkResetFences(cx->dev, 1, &frame.render_fence));
 
+    if (frame.retired.has_value()) {
+        std::move(*frame.retired).release();
+        frame.retired.reset();
+    }
+
     uint32_t swap_idx = 0;
-    vk_log(vkAcquireNextImageKHR(cx->dev, cx->swapchain, 1000000000, frame.present_semaphore, nullptr, &swap_idx));
+    if (!cx->headless())
+        vk_log(vkAcquireNextImageKHR(cx->dev, cx->swapchain, 1000000000, frame.present_semaphore, nullptr, &swap_idx));
+
+    cx->descriptor_cache.set_frame_slot(frame_num % FRAMES_IN_FLIGHT);
+    cx->uploads.begin_frame(frame_num % FRAMES_IN_FLIGHT);
 
     FrameContext fcx{*cx};
     fcx.begin();
 
-    composite_pass.ui = &ui;
+    cx->transfers.submit();
+    cx->transfers.acquire(fcx);
+
+    composite_pass.ui = cx->headless() ? nullptr : &ui;
 
-    if (ui.begin()) {
+    if (cx->headless()) {
+        world.update(fcx, HEADLESS_DT);
+        time += HEADLESS_DT;
+    } else if (ui.begin()) {
         const double new_time = glfwGetTime();
         double frame_time = new_time - curr_time;
         curr_time = new_time;
@@ -102,6 +187,38 @@ void Renderer::render() {
         }
 
         world.ui();
+
+        const RenderGraphStats& stats = cx->rg_cache.stats();
+
+        ImGui::Begin("Render graph");
+
+        ImGui::Text("Passes: %u", stats.passes);
+        ImGui::Text("Render passes: %u", stats.render_passes);
+        ImGui::Text("Pipeline barriers: %u", stats.pipeline_barriers);
+        ImGui::Text("Split barriers: %u", stats.split_barriers);
+        ImGui::Text("Image barriers: %u", stats.image_barriers);
+        ImGui::Text("Buffer barriers: %u", stats.buffer_barriers);
+        ImGui::Text("Elided barriers: %u", stats.elided_barriers);
+        ImGui::Text("Queue transfers: %u", stats.queue_transfers);
+        ImGui::Text("Compute submits: %u", stats.compute_submits);
+        ImGui::Text("Secondary command buffers: %u", stats.secondary_buffers);
+        ImGui::Text("Culled passes: %u", stats.culled_passes);
+
+        for (const auto& [label, arena] : {
+                 std::make_pair("Vertex arena", cx->scene.storage.vertex_stats()),
+                 std::make_pair("Index arena", cx->scene.storage.index_stats()),
+             }) {
+            ImGui::Text("%s: %.1f / %.1f MiB free in %u blocks, %.1f%% fragmented", label, arena.free / (1024.0 * 1024.0), arena.size / (1024.0 * 1024.0),
+                arena.blocks, arena.fragmentation * 100.0);
+        }
+
+        ImGui::Checkbox("Shadows", &shadow_pass.enabled);
+        ImGui::Checkbox("SSAO", &ssao_pass.enabled);
+
+        if (ImGui::CollapsingHeader("Schedule"))
+            ImGui::TextUnformatted(cx->rg_cache.schedule().c_str());
+
+        ImGui::End();
     }
 
     cx->scene.update(fcx);
@@ -109,46 +226,90 @@ void Renderer::render() {
     RenderGraph graph;
 
     PassAttachment attachment = {};
-    attachment.tex.image.image = cx->swapchain_images[swap_idx];
-    attachment.tex.image.format = cx->swapchain_format;
-    attachment.tex.image.samples = VK_SAMPLE_COUNT_1_BIT;
-    attachment.tex.view = cx->swapchain_views[swap_idx];
+    if (cx->headless()) {
+        attachment.tex = offscreen;
+    } else {
+        attachment.tex.image.image = cx->swapchain_images[swap_idx];
+        attachment.tex.image.format = cx->swapchain_format;
+        attachment.tex.image.samples = VK_SAMPLE_COUNT_1_BIT;
+        attachment.tex.view = cx->swapchain_views[swap_idx];
+    }
     attachment.subresource = vk_subresource_range(0, 1, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
     graph.push_attachment({"composite.out"}, attachment);
 
-    for (GFXPass* pass : {
-             static_cast<GFXPass*>(&pbr_pass),
-             static_cast<GFXPass*>(&composite_pass),
-             static_cast<GFXPass*>(&resolve_pass),
-             static_cast<GFXPass*>(&shadow_pass),
-             static_cast<GFXPass*>(&prepass_pass),
-             static_cast<GFXPass*>(&ssao_pass),
-         }) {
-        pass->add_resources(fcx, graph);
-        for (RenderPass p : pass->pass(fcx))
-            graph.push_pass(p);
+    for (const View& view : cx->scene.views) {
+        for (GFXPass* pass : {
+                 static_cast<GFXPass*>(&cx->scene),
+                 static_cast<GFXPass*>(&pbr_pass),
+                 static_cast<GFXPass*>(&composite_pass),
+                 static_cast<GFXPass*>(&resolve_pass),
+                 static_cast<GFXPass*>(&shadow_pass),
+                 static_cast<GFXPass*>(&prepass_pass),
+                 static_cast<GFXPass*>(&ssao_pass),
+             }) {
+            pass->add_resources(fcx, graph, view);
+            for (RenderPass& p : pass->pass(fcx, view))
+                graph.push_pass(std::move(p));
+        }
     }
 
-    graph.set_output({"composite.out"}, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    // Everything staged while updating the scene and building the graph
+    cx->uploads.flush(fcx);
 
-    graph.exec(fcx, cx->rg_cache);
+    if (cx->headless()) {
+        graph.set_output({"composite.out"}, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        graph.exec(fcx, cx->rg_cache);
 
-    fcx.end();
+        if (!capture_path.empty()) {
+            VkBufferCreateInfo bci = {};
+            bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bci.size = static_cast<VkDeviceSize>(cx->width) * cx->height * 4;
+            bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            const Buffer readback = cx->alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_TO_CPU, true);
 
-    VkSubmitInfo submit = {};
+            VkBufferImageCopy copy = {};
+            copy.bufferOffset = readback.offset;
+            copy.imageSubresource = vk_subresource_layers(0, 1, 0, VK_IMAGE_ASPECT_COLOR_BIT);
+            copy.imageExtent = {cx->width, cx->height, 1};
 
-    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            vkCmdCopyImageToBuffer(fcx.cmd, offscreen.image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, 1, &copy);
 
-    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit.pWaitDstStageMask = &wait_stage;
-    submit.waitSemaphoreCount = 1;
-    submit.pWaitSemaphores = &frame.present_semaphore;
-    submit.signalSemaphoreCount = 1;
-    submit.pSignalSemaphores = &frame.render_semaphore;
-    submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &fcx.cmd;
+            VkMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+            vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+            // Written once the frame has finished
+            fcx.bind([cx = cx, readback, capture_path] {
+                vk_log(vmaInvalidateAllocation(cx->alloc.allocator, readback.allocation, readback.offset, readback.size));
+                write_ppm(capture_path, cx->width, cx->height, static_cast<const uint8_t*>(readback.pmap));
+                cx->alloc.destroy(readback);
+            });
+        }
+
+        fcx.end();
+        fcx.submit_cmd(cx->gfx_queue, frame.render_fence);
+
+        frame.retired.emplace(std::move(fcx));
+        frame_num++;
+        return;
+    }
+
+    graph.set_output({"composite.out"}, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+    // The graph may split the frame into several submissions, the first of which has to wait on the swapchain image
+    fcx.wait_semaphore(frame.present_semaphore, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+    graph.exec(fcx, cx->rg_cache);
+
+    fcx.end();
 
-    vk_log(vkQueueSubmit(cx->gfx_queue, 1, &submit, frame.render_fence));
+    fcx.signal_semaphore(frame.render_semaphore, 0);
+    fcx.submit_cmd(cx->gfx_queue, frame.render_fence);
 
     VkPresentInfoKHR present = {};
     present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -160,7 +321,8 @@ void Renderer::render() {
 
     vk_log(vkQueuePresentKHR(cx->gfx_queue, &present));
 
-    std::move(fcx).wait(frame.render_fence);
+    frame.retired.emplace(std::move(fcx));
+    frame_num++;
 }
 
 Renderer::FrameData& Renderer::current_frame() {
@@ -8,9 +8,12 @@
 #include "ssao.hpp"
 #include "prepass.hpp"
 #include "ui.hpp"
+#include "frame_context.hpp"
 
 #include <vector>
 #include <array>
+#include <string>
+#include <optional>
 
 namespace gfx {
 
@@ -25,6 +28,9 @@ class Renderer final {
     void cleanup();
 
     void run();
+    // Renders a fixed number of frames into an offscreen target, each advancing the world by the same step, and logs the time they took.
+    // Unless capture_dir is empty, every frame is also written there as a PPM image.
+    void run_headless(uint64_t frames, const std::string& capture_dir);
 
     PBRGraphicsPass pbr_pass;
     CompositePass composite_pass;
@@ -40,15 +46,21 @@ class Renderer final {
         VkSemaphore present_semaphore;
         VkSemaphore render_semaphore;
         VkFence render_fence;
+        // The frame last rendered in this slot; its command buffers and bound resources are released once render_fence is next waited on
+        std::optional<FrameContext> retired;
     };
 
-    void render();
+    static constexpr double HEADLESS_DT = 1.0 / 60.0;
+
+    void render(const std::string& capture_path = {});
     FrameData& current_frame();
 
     Context* cx;
     std::vector<FrameData> frame_data;
     world::World world;
     uint64_t frame_num;
+    // Stands in for the swapchain images when headless
+    Texture offscreen;
 
     double time;
     double curr_time;
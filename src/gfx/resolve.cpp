@@ -3,6 +3,7 @@
 #include "render_graph.hpp"
 #include "frame_context.hpp"
 #include "context.hpp"
+#include "view.hpp"
 
 namespace gfx {
 
@@ -13,31 +14,46 @@ void ResolvePass::init(FrameContext& fcx) {
 void ResolvePass::cleanup(FrameContext& fcx) {
 }
 
-void ResolvePass::add_resources(FrameContext& fcx, RenderGraph& rg) {
+void ResolvePass::add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) {
+    // The main view resolves into the input of the composite pass
+    if (view.main())
+        return;
+
+    TextureDesc desc;
+    desc.width = view.width;
+    desc.height = view.height;
+    desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    desc.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    desc.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    rg.push_history(view.output(), desc, 1);
+    rg.push_side_effect(view.output());
 }
 
-std::vector<RenderPass> ResolvePass::pass(FrameContext& fcx) {
+std::vector<RenderPass> ResolvePass::pass(FrameContext& fcx, const View& view) {
+    keys.get(view.name);
+
     RenderPass pass;
 
-    pass.width = fcx.cx.width;
-    pass.height = fcx.cx.height;
+    pass.width = view.width;
+    pass.height = view.height;
     pass.layers = 1;
+    pass.name = view.resource("resolve").name;
 
-    pass.push_texture_input({"pbr.out"});
-    pass.push_color_output({"composite.in"}, vk_clear_color({0.f, 0.f, 0.f, 1.f}));
+    pass.push_input_attachment(view.resource("pbr.out"), false, {});
+    pass.push_color_output(view.output(), vk_clear_color({0.f, 0.f, 0.f, 1.f}));
 
-    pass.set_exec([this](FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) { render(fcx, rg, rp); });
+    pass.set_exec([this, &view](FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) { render(fcx, rg, rp, view); });
 
     return {pass};
 }
 
-void ResolvePass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) {
-    const VkViewport viewport = vk_viewport(0.f, 0.f, static_cast<float>(fcx.cx.width), static_cast<float>(fcx.cx.height), 0.f, 1.f);
-    const VkRect2D scissor = vk_rect(0, 0, fcx.cx.width, fcx.cx.height);
+void ResolvePass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp, const View& view) {
+    const VkViewport viewport = vk_viewport(0.f, 0.f, static_cast<float>(view.width), static_cast<float>(view.height), 0.f, 1.f);
+    const VkRect2D scissor = vk_rect(0, 0, view.width, view.height);
 
     DescriptorSetInfo set_info;
-    set_info.bind_texture(
-        rg.attachment({"pbr.out"}).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    set_info.bind_texture(rg.attachment(view.resource("pbr.out")).tex, VK_NULL_HANDLE, VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT);
 
     if (!fcx.cx.pipeline_cache.contains("resolve.pipeline")) {
         VkPipelineRasterizationStateCreateInfo prsci = vk_rasterization_state_create_info(VK_POLYGON_MODE_FILL);
@@ -56,10 +72,10 @@ void ResolvePass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass
         fcx.cx.pipeline_cache.add("resolve.pipeline", builder.info());
     }
 
-    const Pipeline pipeline = fcx.cx.pipeline_cache.get(rp, 0, "resolve.pipeline");
-    const DescriptorSet set = fcx.cx.descriptor_cache.get_set(key, set_info);
+    const Pipeline pipeline = fcx.cx.pipeline_cache.get(rg.target(), "resolve.pipeline");
+    const DescriptorSet set = fcx.cx.descriptor_cache.get_set(keys.get(view.name), set_info);
 
-    const glm::vec2 dims = {static_cast<float>(fcx.cx.width), static_cast<float>(fcx.cx.height)};
+    const glm::vec2 dims = {static_cast<float>(view.width), static_cast<float>(view.height)};
 
     vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
     vkCmdBindDescriptorSets(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout, 0, 1, &set.set, 0, nullptr);
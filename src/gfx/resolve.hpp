@@ -10,13 +10,13 @@ class ResolvePass final : public GFXPass {
     void init(FrameContext& fcx) override;
     void cleanup(FrameContext& fcx) override;
 
-    void add_resources(FrameContext& fcx, RenderGraph& rg) override;
-    std::vector<RenderPass> pass(FrameContext& fcx) override;
+    void add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) override;
+    std::vector<RenderPass> pass(FrameContext& fcx, const View& view) override;
 
-    void render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp);
+    void render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp, const View& view);
 
   private:
-    DescriptorKey key;
+    DescriptorKeyList<std::string> keys;
 };
 
 } // namespace gfx
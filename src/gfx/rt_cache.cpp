@@ -14,6 +14,8 @@ void RenderTargetCache::cleanup() {
 }
 
 Texture RenderTargetCache::get(std::string_view name, const TextureDesc& desc) {
+    std::scoped_lock<std::mutex> lock{m};
+
     const uint64_t key = std::hash<std::string_view>{}(name);
     if (cache.count(key) == 0) {
         const Texture tex = create_texture(*cx, desc);
@@ -25,6 +27,8 @@ Texture RenderTargetCache::get(std::string_view name, const TextureDesc& desc) {
 }
 
 void RenderTargetCache::remove(std::string_view name) {
+    std::scoped_lock<std::mutex> lock{m};
+
     const uint64_t key = std::hash<std::string_view>{}(name);
     PK_ASSERT(cache.count(key) == 1);
     destroy_texture(*cx, cache.at(key));
@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <string>
 #include <string_view>
+#include <mutex>
 
 namespace gfx {
 
@@ -23,6 +24,7 @@ class RenderTargetCache final {
 
   private:
     Context* cx;
+    std::mutex m;
     std::unordered_map<uint64_t, Texture> cache;
 };
 
@@ -30,6 +30,8 @@ VkSampler SamplerCache::basic() {
 }
 
 VkSampler SamplerCache::get(const VkSamplerCreateInfo& sci) {
+    std::scoped_lock<std::mutex> lock{m};
+
     if (!cache.count(sci)) {
         VkSampler sampler;
         vk_log(vkCreateSampler(dev, &sci, nullptr, &sampler));
@@ -4,6 +4,7 @@
 
 #include <volk.h>
 #include <unordered_map>
+#include <mutex>
 
 namespace gfx {
 
@@ -17,6 +18,7 @@ class SamplerCache final {
 
   private:
     VkDevice dev;
+    std::mutex m;
     std::unordered_map<VkSamplerCreateInfo, VkSampler> cache;
 };
 
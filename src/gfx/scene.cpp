@@ -2,33 +2,75 @@
 
 #include "context.hpp"
 #include "frame_context.hpp"
+#include "render_graph.hpp"
+
+#include <algorithm>
 
 namespace gfx {
 
 void Scene::init(FrameContext& fcx) {
-    passes.init(fcx);
     storage.init(fcx);
 
-    VkBufferCreateInfo bci = {};
-    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bci.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    bci.size = sizeof(Uniforms);
-    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    ubo = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
+    views.emplace_back().init(fcx, "", fcx.cx.width, fcx.cx.height);
 }
 
 void Scene::cleanup(FrameContext& fcx) {
-    fcx.cx.alloc.destroy(ubo);
+    for (View& view : views) {
+        passes.remove_view(fcx, view);
+        view.cleanup(fcx);
+    }
+
+    views.clear();
 
     storage.cleanup(fcx);
-    passes.cleanup(fcx);
 }
 
 void Scene::update(FrameContext& fcx) {
-    storage.update(fcx);
-    passes.prepare(fcx);
-    fcx.stage(ubo, &uniforms);
+    main_view().width = fcx.cx.width;
+    main_view().height = fcx.cx.height;
+
+    for (View& view : views) {
+        view.update(fcx, sun_dir, sun_radiant_flux);
+    }
+
+    // Announces the finished moves before the draws are built from the mesh keys
+    storage.compact(fcx);
+    storage.upload(fcx.cx.uploads);
+    passes.upload(fcx.cx.uploads, storage);
+}
+
+void Scene::add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) {
+    if (view.main())
+        storage.add_resources(rg);
+    passes.add_resources(rg, view);
+}
+
+std::vector<RenderPass> Scene::pass(FrameContext& fcx, const View& view) {
+    std::vector<RenderPass> out;
+    passes.push_passes(out, view);
+    return out;
+}
+
+View& Scene::add_view(FrameContext& fcx, std::string name, uint32_t width, uint32_t height) {
+    PK_ASSERT(!name.empty());
+
+    View& view = views.emplace_back();
+    view.init(fcx, std::move(name), width, height);
+    passes.add_view(fcx, view);
+    return view;
+}
+
+void Scene::remove_view(FrameContext& fcx, const View& view) {
+    PK_ASSERT(!view.main());
+
+    auto it = std::find_if(views.begin(), views.end(), [&](const View& v) { return &v == &view; });
+    passes.remove_view(fcx, *it);
+    it->cleanup(fcx);
+    views.erase(it);
+}
+
+View& Scene::main_view() {
+    return views.front();
 }
 
 } // namespace gfx
@@ -2,31 +2,40 @@
 
 #include "indirect.hpp"
 #include "material.hpp"
+#include "gfx_pass.hpp"
+#include "view.hpp"
+
+#include <list>
 
 namespace gfx {
 
 struct Context;
 class FrameContext;
 
-struct Scene final {
-    struct Uniforms final {
-        glm::vec4 cam_pos;
-        glm::vec4 sun_dir;
-        glm::vec4 sun_radiant_flux;
-        glm::mat4 cam_proj;
-        glm::mat4 cam_view;
-    };
-
-    void init(FrameContext& fcx);
-    void cleanup(FrameContext& fcx);
+// The scene's uploads are staged into the upload ring when it's updated, its culling is recorded as passes of the frame graph
+struct Scene final : public GFXPass {
+    void init(FrameContext& fcx) override;
+    void cleanup(FrameContext& fcx) override;
 
     void update(FrameContext& fcx);
 
-    IndirectStorage storage;
-    Uniforms uniforms;
-    Buffer ubo;
+    void add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) override;
+    std::vector<RenderPass> pass(FrameContext& fcx, const View& view) override;
+
+    // Secondary views are rendered every frame along with the main view, until they're removed
+    View& add_view(FrameContext& fcx, std::string name, uint32_t width, uint32_t height);
+    void remove_view(FrameContext& fcx, const View& view);
+    View& main_view();
 
+    IndirectStorage storage;
     MaterialPass passes;
+
+    // the main view comes first
+    std::list<View> views;
+
+    // The sun is shared by all views, and so are its shadow maps
+    glm::vec4 sun_dir;
+    glm::vec4 sun_radiant_flux;
 };
 
 } // namespace gfx
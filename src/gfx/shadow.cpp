@@ -5,6 +5,7 @@
 #include "context.hpp"
 #include "renderer.hpp"
 #include "helpers.hpp"
+#include "view.hpp"
 
 #include <spdlog/fmt/fmt.h>
 #include <array>
@@ -63,7 +64,7 @@ ShadowPass::Uniforms ShadowPass::compute_cascades(Context& cx, glm::vec3 jitter)
         };
 
         // Project frustum corners into world space
-        glm::mat4 inv_cam = glm::inverse(cx.scene.uniforms.cam_proj);
+        glm::mat4 inv_cam = glm::inverse(cx.scene.main_view().uniforms.cam_proj);
         for (glm::vec3& corner : frustum_corners) {
             glm::vec4 inv_corner = inv_cam * glm::vec4{corner, 1.0f};
             corner = glm::vec3{inv_corner / inv_corner.w};
@@ -91,7 +92,7 @@ ShadowPass::Uniforms ShadowPass::compute_cascades(Context& cx, glm::vec3 jitter)
         glm::vec3 max_extents = glm::vec3{radius};
         glm::vec3 min_extents = -max_extents;
 
-        glm::mat4 light_view_matrix = glm::lookAt(frustum_center - glm::vec3{cx.scene.uniforms.sun_dir} * -min_extents.z, frustum_center, {0.f, 1.f, 0.f}) *
+        glm::mat4 light_view_matrix = glm::lookAt(frustum_center - glm::vec3{cx.scene.sun_dir} * -min_extents.z, frustum_center, {0.f, 1.f, 0.f}) *
                                       glm::eulerAngleXYZ(jitter.x, jitter.y, jitter.z);
         glm::mat4 light_ortho_matrix = glm::ortho(min_extents.x, max_extents.x, min_extents.y, max_extents.y, 0.f, max_extents.z - min_extents.z);
 
@@ -111,10 +112,8 @@ void ShadowPass::init(FrameContext& fcx) {
     load_shader(fcx.cx.shader_cache, "fullscreen.vs", VK_SHADER_STAGE_VERTEX_BIT);
     load_shader(fcx.cx.shader_cache, "shadow_accum.fs", VK_SHADER_STAGE_FRAGMENT_BIT);
 
-    fcx.cx.on_resize.connect_delegate(delegate<&ShadowPass::resize>(this));
-
-    use_a = true;
-    first = true;
+    const uint8_t lit = 255;
+    unshadowed = create_pixel_texture(fcx, VK_FORMAT_R8_UNORM, &lit, sizeof(lit));
 
     TextureDesc depth_desc;
     depth_desc.width = DIM;
@@ -151,9 +150,6 @@ void ShadowPass::init(FrameContext& fcx) {
 
     ubo = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
 
-    bci.size = sizeof(glm::mat4) * 3;
-    buf_ubo = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
-
     jitter_range = 0.01f;
 }
 
@@ -163,15 +159,41 @@ void ShadowPass::cleanup(FrameContext& fcx) {
     }
 
     destroy_texture(fcx.cx, depths);
+    destroy_texture(fcx.cx, unshadowed);
 
     fcx.cx.alloc.destroy(ubo);
-    fcx.cx.alloc.destroy(buf_ubo);
 }
 
-void ShadowPass::add_resources(FrameContext& fcx, RenderGraph& rg) {
+void ShadowPass::add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) {
+    if (view.main()) {
+        PassAttachment map_pa;
+        map_pa.tex = depths;
+        map_pa.subresource = vk_subresource_range(0, NUM_CASCADES, 0, 1, VK_IMAGE_ASPECT_DEPTH_BIT);
+        rg.push_attachment({"shadow.map"}, map_pa);
+
+        for (uint8_t i = 0; i < NUM_CASCADES; ++i) {
+            PassAttachment map_view_pa;
+            map_view_pa.tex = depth_views[i];
+            map_view_pa.subresource = vk_subresource_range(i, 1, 0, 1, VK_IMAGE_ASPECT_DEPTH_BIT);
+            rg.push_attachment({fmt::format("shadow.map.cascade.{}", i)}, map_view_pa);
+        }
+
+        rg.push_buffer({"shadow.ubo"}, {ubo});
+    }
+
+    // The cascades are culled along with the disabled buffer passes, as nothing else reads the shadow map
+    if (!enabled) {
+        PassAttachment unshadowed_pa;
+        unshadowed_pa.tex = unshadowed;
+        unshadowed_pa.subresource = vk_subresource_range(0, 1, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
+        rg.push_attachment(view.resource("shadow.buffer"), unshadowed_pa);
+        rg.push_initial_layout(view.resource("shadow.buffer"), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        return;
+    }
+
     TextureDesc buf_desc;
-    buf_desc.width = fcx.cx.width;
-    buf_desc.height = fcx.cx.height;
+    buf_desc.width = view.width;
+    buf_desc.height = view.height;
     buf_desc.layers = 1;
     buf_desc.depth = 1;
     buf_desc.mips = 1;
@@ -182,84 +204,53 @@ void ShadowPass::add_resources(FrameContext& fcx, RenderGraph& rg) {
     buf_desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     buf_desc.view_type = VK_IMAGE_VIEW_TYPE_2D;
 
-    const Texture buffer_a = fcx.cx.rt_cache.get("shadow.buffer.a", buf_desc);
-    const Texture buffer_b = fcx.cx.rt_cache.get("shadow.buffer.b", buf_desc);
-
-    PassAttachment map_pa;
-    map_pa.tex = depths;
-    map_pa.subresource = vk_subresource_range(0, NUM_CASCADES, 0, 1, VK_IMAGE_ASPECT_DEPTH_BIT);
-    rg.push_attachment({"shadow.map"}, map_pa);
-
-    for (uint8_t i = 0; i < NUM_CASCADES; ++i) {
-        PassAttachment map_view_pa;
-        map_view_pa.tex = depth_views[i];
-        map_view_pa.subresource = vk_subresource_range(i, 1, 0, 1, VK_IMAGE_ASPECT_DEPTH_BIT);
-        rg.push_attachment({fmt::format("shadow.map.cascade.{}", i)}, map_view_pa);
-    }
-
-    PassAttachment buf_pa;
-    buf_pa.tex = use_a ? buffer_a : buffer_b;
-    buf_pa.subresource = vk_subresource_range(0, 1, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
-    rg.push_attachment({"shadow.buffer"}, buf_pa);
-
-    if (!first) {
-        rg.push_initial_layout({"shadow.buffer.input"}, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    } else {
-        first = false;
-    }
-
-    PassAttachment prev_buf_pa;
-    prev_buf_pa.tex = use_a ? buffer_b : buffer_a;
-    prev_buf_pa.subresource = vk_subresource_range(0, 1, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
-    rg.push_attachment({"shadow.buffer.input"}, prev_buf_pa);
-
-    rg.push_buffer({"shadow.ubo"}, {ubo});
-
-    use_a = !use_a;
+    rg.push_history(view.resource("shadow.buffer"), buf_desc, 1);
 }
 
-std::vector<RenderPass> ShadowPass::pass(FrameContext& fcx) {
-    static std::uniform_real_distribution<float> dist{-1.f, 1.f};
-    static std::mt19937_64 mt{std::random_device{}()};
-
-    if (ImGui::GetCurrentContext() && ImGui::GetCurrentContext()->WithinFrameScope) {
-        ImGui::Begin("Shadows");
-
-        ImGui::SliderFloat("Shadow jitter range", &jitter_range, 0.f, 0.1f, "%.3f", 1.f);
+std::vector<RenderPass> ShadowPass::pass(FrameContext& fcx, const View& view) {
+    std::vector<RenderPass> passes;
 
-        ImGui::End();
-    }
+    if (view.main()) {
+        static std::uniform_real_distribution<float> dist{-1.f, 1.f};
+        static std::mt19937_64 mt{std::random_device{}()};
 
-    const Uniforms uniforms = compute_cascades(fcx.cx, glm::vec3{dist(mt), dist(mt), dist(mt)} * jitter_range);
-    fcx.stage(ubo, &uniforms);
+        if (ImGui::GetCurrentContext() && ImGui::GetCurrentContext()->WithinFrameScope) {
+            ImGui::Begin("Shadows");
 
-    const std::array<glm::mat4, 3> view_mats = {glm::inverse(fcx.cx.scene.uniforms.cam_proj), fcx.cx.scene.uniforms.cam_view, prev_vp};
-    fcx.stage(buf_ubo, view_mats.data());
-    prev_vp = fcx.cx.scene.uniforms.cam_proj;
+            ImGui::SliderFloat("Shadow jitter range", &jitter_range, 0.f, 0.1f, "%.3f", 1.f);
 
-    std::vector<RenderPass> passes;
+            ImGui::End();
+        }
 
-    for (uint8_t i = 0; i < NUM_CASCADES; ++i) {
-        RenderPass pass;
-        pass.width = DIM;
-        pass.height = DIM;
-        pass.layers = 1;
-        pass.set_depth_stencil({fmt::format("shadow.map.cascade.{}", i)}, vk_clear_depth(1.f, 0));
-        pass.push_dependent({"shadow.map"}, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
-        pass.set_exec(std::bind(&ShadowPass::render, this, i, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
-        passes.push_back(pass);
+        const Uniforms uniforms = compute_cascades(fcx.cx, glm::vec3{dist(mt), dist(mt), dist(mt)} * jitter_range);
+        fcx.cx.uploads.stage(ubo, &uniforms);
+
+        for (uint8_t i = 0; i < NUM_CASCADES; ++i) {
+            RenderPass pass;
+            pass.width = DIM;
+            pass.height = DIM;
+            pass.layers = 1;
+            pass.name = fmt::format("shadow.cascade.{}", i);
+            pass.set_depth_stencil({fmt::format("shadow.map.cascade.{}", i)}, vk_clear_depth(1.f, 0));
+            fcx.cx.scene.passes.pass("pbr").pass("pbr_textured").push_inputs(pass, view);
+            pass.set_exec(std::bind(&ShadowPass::render, this, i, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+            passes.push_back(pass);
+        }
     }
 
+    buf_desc_keys.get(view.name);
+
     RenderPass buf_pass;
-    buf_pass.width = fcx.cx.width;
-    buf_pass.height = fcx.cx.height;
+    buf_pass.width = view.width;
+    buf_pass.height = view.height;
     buf_pass.layers = 1;
-    buf_pass.push_color_output({"shadow.buffer"}, vk_clear_color(glm::vec4{0.f}));
+    buf_pass.name = view.resource("shadow.buffer").name;
+    buf_pass.push_color_output(view.resource("shadow.buffer"), vk_clear_color(glm::vec4{0.f}));
     buf_pass.push_texture_input({"shadow.map"});
-    buf_pass.push_texture_input({"shadow.buffer.input"});
-    buf_pass.push_texture_input({"prepass.depth_normal"});
-    buf_pass.set_exec(std::bind(&ShadowPass::render_buffer, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    buf_pass.push_texture_input(RenderGraph::history(view.resource("shadow.buffer")));
+    buf_pass.push_texture_input(view.resource("prepass.depth_normal"));
+    buf_pass.set_predicate([this] { return enabled; });
+    buf_pass.set_exec([this, &view](FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) { render_buffer(fcx, rg, rp, view); });
     passes.push_back(buf_pass);
 
     return passes;
@@ -272,7 +263,7 @@ void ShadowPass::render(uint32_t cascade, FrameContext& fcx, const RenderGraph&
     DescriptorSetInfo set_info;
     set_info.bind_buffer(fcx.cx.scene.passes.pass("pbr").pass("pbr_textured").instance_buffer(), VK_SHADER_STAGE_VERTEX_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
     set_info.bind_buffer(
-        fcx.cx.scene.passes.pass("pbr").pass("pbr_textured").instance_indices_buffer(), VK_SHADER_STAGE_VERTEX_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        fcx.cx.scene.passes.pass("pbr").pass("pbr_textured").instance_indices_buffer(fcx.cx.scene.main_view()), VK_SHADER_STAGE_VERTEX_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
     set_info.bind_buffer(ubo, VK_SHADER_STAGE_VERTEX_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
     const DescriptorSet set = fcx.cx.descriptor_cache.get_set(desc_key, set_info);
@@ -295,7 +286,7 @@ void ShadowPass::render(uint32_t cascade, FrameContext& fcx, const RenderGraph&
         fcx.cx.pipeline_cache.add("shadow.pipeline", builder.info());
     }
 
-    const Pipeline pipeline = fcx.cx.pipeline_cache.get(pass, 0, "shadow.pipeline");
+    const Pipeline pipeline = fcx.cx.pipeline_cache.get(rg.target(), "shadow.pipeline");
 
     vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
     vkCmdBindDescriptorSets(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout, 0, 1, &set.set, 0, nullptr);
@@ -304,12 +295,12 @@ void ShadowPass::render(uint32_t cascade, FrameContext& fcx, const RenderGraph&
     vkCmdSetScissor(fcx.cmd, 0, 1, &scissor);
     vkCmdPushConstants(fcx.cmd, pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &cascade);
 
-    fcx.cx.scene.passes.pass("pbr").pass("pbr_textured").execute(fcx.cmd, fcx.cx.scene.storage);
+    fcx.cx.scene.passes.pass("pbr").pass("pbr_textured").execute(fcx.cmd, fcx.cx.scene.storage, fcx.cx.scene.main_view());
 }
 
-void ShadowPass::render_buffer(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass) {
-    const VkViewport viewport = vk_viewport(0.f, 0.f, static_cast<float>(fcx.cx.width), static_cast<float>(fcx.cx.height), 0.f, 1.f);
-    const VkRect2D scissor = vk_rect(0, 0, fcx.cx.width, fcx.cx.height);
+void ShadowPass::render_buffer(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass, const View& view) {
+    const VkViewport viewport = vk_viewport(0.f, 0.f, static_cast<float>(view.width), static_cast<float>(view.height), 0.f, 1.f);
+    const VkRect2D scissor = vk_rect(0, 0, view.width, view.height);
 
     VkSamplerCreateInfo shadow_sci = {};
     shadow_sci.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -328,15 +319,15 @@ void ShadowPass::render_buffer(FrameContext& fcx, const RenderGraph& rg, VkRende
 
     DescriptorSetInfo set_info;
     set_info.bind_buffer(ubo, VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    set_info.bind_buffer(buf_ubo, VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    set_info.bind_buffer(view.reprojection_ubo, VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
     set_info.bind_texture(
         rg.attachment({"shadow.map"}).tex, fcx.cx.sampler_cache.get(shadow_sci), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     set_info.bind_texture(
-        rg.attachment({"shadow.buffer.input"}).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        rg.attachment(RenderGraph::history(view.resource("shadow.buffer"))).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     set_info.bind_texture(
-        rg.attachment({"prepass.depth_normal"}).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        rg.attachment(view.resource("prepass.depth_normal")).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
-    const DescriptorSet set = fcx.cx.descriptor_cache.get_set(buf_desc_key, set_info);
+    const DescriptorSet set = fcx.cx.descriptor_cache.get_set(buf_desc_keys.get(view.name), set_info);
 
     if (!fcx.cx.pipeline_cache.contains("shadow.buffer.pipeline")) {
         VkPipelineRasterizationStateCreateInfo prsci = vk_rasterization_state_create_info(VK_POLYGON_MODE_FILL);
@@ -354,7 +345,7 @@ void ShadowPass::render_buffer(FrameContext& fcx, const RenderGraph& rg, VkRende
         fcx.cx.pipeline_cache.add("shadow.buffer.pipeline", builder.info());
     }
 
-    const Pipeline pipeline = fcx.cx.pipeline_cache.get(pass, 0, "shadow.buffer.pipeline");
+    const Pipeline pipeline = fcx.cx.pipeline_cache.get(rg.target(), "shadow.buffer.pipeline");
 
     vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
     vkCmdBindDescriptorSets(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout, 0, 1, &set.set, 0, nullptr);
@@ -365,8 +356,4 @@ void ShadowPass::render_buffer(FrameContext& fcx, const RenderGraph& rg, VkRende
     vkCmdDraw(fcx.cmd, 3, 1, 0, 0);
 }
 
-void ShadowPass::resize(int32_t, int32_t) {
-    first = true;
-}
-
 } // namespace gfx
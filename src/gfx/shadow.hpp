@@ -16,10 +16,13 @@ class ShadowPass final : public GFXPass {
     void init(FrameContext& fcx) override;
     void cleanup(FrameContext& fcx) override;
 
-    void add_resources(FrameContext& fcx, RenderGraph& rg) override;
-    std::vector<RenderPass> pass(FrameContext& fcx) override;
+    // The cascades are fit to the main view and shared by all views, each of which filters them into its own shadow buffer
+    void add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) override;
+    std::vector<RenderPass> pass(FrameContext& fcx, const View& view) override;
 
     Buffer ubo;
+    // Disabled shadows leave every light unoccluded
+    bool enabled = true;
 
   private:
     struct Uniforms final {
@@ -30,17 +33,13 @@ class ShadowPass final : public GFXPass {
 
     static Uniforms compute_cascades(Context& cx, glm::vec3 jitter);
     void render(uint32_t cascade, FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass);
-    void render_buffer(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass);
-    void resize(int32_t, int32_t);
+    void render_buffer(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass, const View& view);
 
     DescriptorKey desc_key;
-    DescriptorKey buf_desc_key;
+    DescriptorKeyList<std::string> buf_desc_keys;
     std::array<Texture, NUM_CASCADES> depth_views;
     Texture depths;
-    bool use_a;
-    bool first;
-    Buffer buf_ubo;
-    glm::mat4 prev_vp;
+    Texture unshadowed;
     float jitter_range;
 };
 
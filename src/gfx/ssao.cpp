@@ -4,6 +4,7 @@
 #include "frame_context.hpp"
 #include "context.hpp"
 #include "renderer.hpp"
+#include "view.hpp"
 
 #include <glm/ext/scalar_constants.hpp>
 #include <random>
@@ -11,31 +12,63 @@
 namespace gfx {
 
 void SSAOPass::init(FrameContext& fcx) {
-    load_shader(fcx.cx.shader_cache, "fullscreen.vs", VK_SHADER_STAGE_VERTEX_BIT);
-    load_shader(fcx.cx.shader_cache, "hbao.fs", VK_SHADER_STAGE_FRAGMENT_BIT);
-
-    fcx.cx.on_resize.connect_delegate(delegate<&SSAOPass::resize>(this));
-
-    VkBufferCreateInfo bci = {};
-    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bci.size = sizeof(glm::mat4) * 3;
-    bci.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    ubo = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_CPU_TO_GPU, true);
-
-    use_a = true;
-    first = true;
+    load_shader(fcx.cx.shader_cache, "hbao.comp", VK_SHADER_STAGE_COMPUTE_BIT);
+
+    DescriptorSetInfo set_layout_info;
+    set_layout_info.bind_texture({}, nullptr, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    set_layout_info.bind_texture({}, nullptr, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    set_layout_info.bind_texture({}, nullptr, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_IMAGE_LAYOUT_GENERAL);
+    set_layout_info.bind_buffer({}, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+
+    const VkDescriptorSetLayout set_layout = fcx.cx.descriptor_cache.get_layout(set_layout_info);
+
+    VkPushConstantRange pcr = {};
+    pcr.offset = 0;
+    pcr.size = sizeof(float);
+    pcr.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo plci = {};
+    plci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    plci.setLayoutCount = 1;
+    plci.pSetLayouts = &set_layout;
+    plci.pPushConstantRanges = &pcr;
+    plci.pushConstantRangeCount = 1;
+
+    vk_log(vkCreatePipelineLayout(fcx.cx.dev, &plci, nullptr, &layout));
+
+    VkComputePipelineCreateInfo cpci = {};
+    cpci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    cpci.layout = layout;
+    cpci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    cpci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    cpci.stage.pName = "main";
+    cpci.stage.module = fcx.cx.shader_cache.get("hbao.comp");
+
+    vk_log(vkCreateComputePipelines(fcx.cx.dev, nullptr, 1, &cpci, nullptr, &pipeline));
+
+    const uint8_t visible = 255;
+    unoccluded = create_pixel_texture(fcx, VK_FORMAT_R8_UNORM, &visible, sizeof(visible));
 }
 
 void SSAOPass::cleanup(FrameContext& fcx) {
-    fcx.cx.alloc.destroy(ubo);
+    vkDestroyPipeline(fcx.cx.dev, pipeline, nullptr);
+    vkDestroyPipelineLayout(fcx.cx.dev, layout, nullptr);
+    destroy_texture(fcx.cx, unoccluded);
 }
 
-void SSAOPass::add_resources(FrameContext& fcx, RenderGraph& rg) {
+void SSAOPass::add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) {
+    if (!enabled || !view.ssao) {
+        PassAttachment pa;
+        pa.tex = unoccluded;
+        pa.subresource = vk_subresource_range(0, 1, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
+        rg.push_attachment(view.resource("ssao.out"), pa);
+        rg.push_initial_layout(view.resource("ssao.out"), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        return;
+    }
+
     TextureDesc desc;
-    desc.width = static_cast<uint32_t>(static_cast<float>(fcx.cx.width) * RESOLUTION);
-    desc.height = static_cast<uint32_t>(static_cast<float>(fcx.cx.height) * RESOLUTION);
+    desc.width = static_cast<uint32_t>(static_cast<float>(view.width) * RESOLUTION);
+    desc.height = static_cast<uint32_t>(static_cast<float>(view.height) * RESOLUTION);
     desc.layers = 1;
     desc.depth = 1;
     desc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -44,100 +77,54 @@ void SSAOPass::add_resources(FrameContext& fcx, RenderGraph& rg) {
     desc.samples = VK_SAMPLE_COUNT_1_BIT;
     desc.type = VK_IMAGE_TYPE_2D;
     desc.view_type = VK_IMAGE_VIEW_TYPE_2D;
-    desc.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-
-    const Texture out_a = fcx.cx.rt_cache.get("ssao.out.a", desc);
-    const Texture out_b = fcx.cx.rt_cache.get("ssao.out.b", desc);
-
-    PassAttachment pa;
-    pa.tex = use_a ? out_a : out_b;
-    pa.subresource = vk_subresource_range(0, 1, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
-    rg.push_attachment({"ssao.out"}, pa);
-
-    PassAttachment prev_pa;
-    prev_pa.tex = use_a ? out_b : out_a;
-    prev_pa.subresource = vk_subresource_range(0, 1, 0, 1, VK_IMAGE_ASPECT_COLOR_BIT);
-    rg.push_attachment({"ssao.prev"}, prev_pa);
+    desc.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 
-    if (!first) {
-        rg.push_initial_layout({"ssao.prev"}, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    } else {
-        first = false;
-    }
-
-    use_a = !use_a;
+    rg.push_history(view.resource("ssao.out"), desc, 1);
 }
 
-std::vector<RenderPass> SSAOPass::pass(FrameContext& fcx) {
-    const glm::mat4 mats[3] = {glm::inverse(fcx.cx.scene.uniforms.cam_proj), fcx.cx.scene.uniforms.cam_view, prev_vp};
-    vk_mapped_write(fcx.cx.alloc, ubo, &mats[0], sizeof(glm::mat4) * 3);
-    prev_vp = fcx.cx.scene.uniforms.cam_proj;
-
-    const Texture out_a = fcx.cx.rt_cache.get("ssao.out.a", {});
+std::vector<RenderPass> SSAOPass::pass(FrameContext& fcx, const View& view) {
+    desc_keys.get(view.name);
 
+    // The targets aren't created while disabled
     RenderPass pass;
-    pass.width = out_a.image.extent.width;
-    pass.height = out_a.image.extent.height;
+    pass.width = static_cast<uint32_t>(static_cast<float>(view.width) * RESOLUTION);
+    pass.height = static_cast<uint32_t>(static_cast<float>(view.height) * RESOLUTION);
     pass.layers = 1;
-    pass.push_color_output({"ssao.out"}, vk_clear_color({0.f, 0.f, 0.f, 0.f}));
-    pass.push_texture_input({"ssao.prev"});
-    pass.push_texture_input({"prepass.depth_normal"});
-    pass.set_exec(std::bind(&SSAOPass::render, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    pass.name = view.resource("ssao").name;
+    pass.push_storage_output(view.resource("ssao.out"));
+    pass.push_texture_input(RenderGraph::history(view.resource("ssao.out")));
+    pass.push_texture_input(view.resource("prepass.depth_normal"));
+    pass.set_compute(true);
+    pass.set_predicate([this, &view] { return enabled && view.ssao; });
+    pass.set_exec([this, &view](FrameContext& fcx, const RenderGraph& rg, VkRenderPass rp) { render(fcx, rg, rp, view); });
 
     return {pass};
 }
 
-void SSAOPass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass) {
-    const Texture out_a = fcx.cx.rt_cache.get("ssao.out.a", {});
-
-    const VkViewport viewport = vk_viewport(0.f, 0.f, static_cast<float>(out_a.image.extent.width), static_cast<float>(out_a.image.extent.height), 0.f, 1.f);
-    const VkRect2D scissor = vk_rect(0, 0, out_a.image.extent.width, out_a.image.extent.height);
+void SSAOPass::render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass, const View& view) {
+    const Texture out = rg.attachment(view.resource("ssao.out")).tex;
 
     DescriptorSetInfo set_info;
     set_info.bind_texture(
-        rg.attachment({"prepass.depth_normal"}).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        rg.attachment(view.resource("prepass.depth_normal")).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     set_info.bind_texture(
-        rg.attachment({"ssao.prev"}).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    set_info.bind_buffer(ubo, VK_SHADER_STAGE_FRAGMENT_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-
-    const DescriptorSet set = fcx.cx.descriptor_cache.get_set(desc_key, set_info);
-
-    if (!fcx.cx.pipeline_cache.contains("ssao.pipeline")) {
-        VkPipelineRasterizationStateCreateInfo prsci = vk_rasterization_state_create_info(VK_POLYGON_MODE_FILL);
-        prsci.cullMode = VK_CULL_MODE_NONE;
-
-        SimplePipelineBuilder builder = SimplePipelineBuilder::begin(fcx.cx.dev, nullptr, fcx.cx.descriptor_cache, fcx.cx.pipeline_cache);
-        builder.add_shader(fcx.cx.shader_cache.get("fullscreen.vs"), VK_SHADER_STAGE_VERTEX_BIT);
-        builder.add_shader(fcx.cx.shader_cache.get("hbao.fs"), VK_SHADER_STAGE_FRAGMENT_BIT);
-        builder.set_rasterization_state(prsci);
-        builder.add_attachment(vk_color_blend_attachment_state());
-        builder.set_primitive_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-        builder.set_samples(VK_SAMPLE_COUNT_1_BIT);
-        builder.push_desc_set(set_info);
-        builder.push_constant(0, sizeof(float), VK_SHADER_STAGE_FRAGMENT_BIT);
-
-        fcx.cx.pipeline_cache.add("ssao.pipeline", builder.info());
-    }
+        rg.attachment(RenderGraph::history(view.resource("ssao.out"))).tex, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    set_info.bind_texture(out, fcx.cx.sampler_cache.basic(), VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_IMAGE_LAYOUT_GENERAL);
+    set_info.bind_buffer(view.reprojection_ubo, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
-    const Pipeline pipeline = fcx.cx.pipeline_cache.get(pass, 0, "ssao.pipeline");
+    const DescriptorSet set = fcx.cx.descriptor_cache.get_set(desc_keys.get(view.name), set_info);
 
-    vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
-    vkCmdBindDescriptorSets(fcx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout, 0, 1, &set.set, 0, nullptr);
+    vkCmdBindPipeline(fcx.cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(fcx.cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &set.set, 0, nullptr);
 
-    static std::uniform_real_distribution<float> dist{0.f, 2.f * glm::pi<float>()};
-    static std::mt19937_64 mt{std::random_device{}()};
+    // The views record their SSAO in parallel
+    thread_local std::uniform_real_distribution<float> dist{0.f, 2.f * glm::pi<float>()};
+    thread_local std::mt19937_64 mt{std::random_device{}()};
     const float jitter = dist(mt);
 
-    vkCmdPushConstants(fcx.cmd, pipeline.layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &jitter);
-
-    vkCmdSetViewport(fcx.cmd, 0, 1, &viewport);
-    vkCmdSetScissor(fcx.cmd, 0, 1, &scissor);
-
-    vkCmdDraw(fcx.cmd, 3, 1, 0, 0);
-}
+    vkCmdPushConstants(fcx.cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(float), &jitter);
 
-void SSAOPass::resize(int32_t, int32_t) {
-    first = true;
+    vkCmdDispatch(fcx.cmd, (out.image.extent.width + 7) / 8, (out.image.extent.height + 7) / 8, 1);
 }
 
 } // namespace gfx
@@ -15,18 +15,19 @@ class SSAOPass final : public GFXPass {
     void init(FrameContext& fcx) override;
     void cleanup(FrameContext& fcx) override;
 
-    void add_resources(FrameContext& fcx, RenderGraph& rg) override;
-    std::vector<RenderPass> pass(FrameContext& fcx) override;
+    void add_resources(FrameContext& fcx, RenderGraph& rg, const View& view) override;
+    std::vector<RenderPass> pass(FrameContext& fcx, const View& view) override;
+
+    // Disabled SSAO leaves ambient light unoccluded, in every view or in those that opt out of it
+    bool enabled = true;
 
   private:
-    void render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass);
-    void resize(int32_t, int32_t);
-
-    DescriptorKey desc_key;
-    bool use_a;
-    bool first;
-    Buffer ubo;
-    glm::mat4 prev_vp;
+    void render(FrameContext& fcx, const RenderGraph& rg, VkRenderPass pass, const View& view);
+
+    DescriptorKeyList<std::string> desc_keys;
+    VkPipelineLayout layout;
+    VkPipeline pipeline;
+    Texture unoccluded;
 };
 
 } // namespace gfx
@@ -0,0 +1,370 @@
+#include "suballocator.hpp"
+
+#include <algorithm>
+
+namespace gfx {
+
+SlabAllocator::SlabAllocator(uint32_t num_blocks, VkDeviceSize slab_size) : num_blocks{num_blocks}, slab_size{slab_size} {
+    slabs.reserve(num_blocks);
+    for (uint32_t i = 0; i < num_blocks; ++i) {
+        slabs.push_back(i * slab_size);
+    }
+}
+
+bool SlabAllocator::alloc(VkDeviceSize size, ContiguousAllocation& out) {
+    if (slabs.empty())
+        return false;
+    out.offset = slabs.back();
+    out.size = slab_size;
+    slabs.pop_back();
+    return true;
+}
+
+void SlabAllocator::free(ContiguousAllocation alloc) {
+    slabs.push_back(alloc.offset);
+}
+
+VkDeviceSize SlabAllocator::size_hint() const {
+    return num_blocks * slab_size;
+}
+
+// index of the most significant set bit, x != 0
+static uint32_t msb(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(x);
+#else
+    uint32_t bit = 0;
+    while (x >>= 1)
+        ++bit;
+    return bit;
+#endif
+}
+
+// index of the least significant set bit, x != 0
+static uint32_t lsb(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    uint32_t bit = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+TLSFAllocator::TLSFAllocator(VkDeviceSize size, VkDeviceSize alignment) : size{size - size % alignment}, alignment{alignment} {
+    PK_ASSERT(alignment > 0);
+
+    free_bytes = this->size;
+    fl_bitmap = 0;
+    sl_bitmaps.fill(0);
+    for (auto& sl_heads : heads)
+        sl_heads.fill(NONE);
+
+    // initially all the memory is a single free block
+    if (this->size > 0) {
+        blocks.push_back(Block{0, this->size, NONE, NONE, NONE, NONE, true});
+        insert_free(0);
+    }
+}
+
+bool TLSFAllocator::alloc(VkDeviceSize size, ContiguousAllocation& out) {
+    return alloc(size, alignment, out);
+}
+
+bool TLSFAllocator::alloc(VkDeviceSize size, VkDeviceSize alignment, ContiguousAllocation& out) {
+    PK_ASSERT(alignment > 0 && alignment % this->alignment == 0);
+
+    if (size == 0)
+        return false;
+    size = (size + this->alignment - 1) / this->alignment * this->alignment;
+
+    // any block this large can be aligned within
+    const VkDeviceSize padded = size + alignment - this->alignment;
+    if (padded > free_bytes)
+        return false;
+
+    uint32_t block = find_free(padded);
+    if (block == NONE)
+        return false;
+    remove_free(block);
+
+    // the free block before an aligned allocation stays free
+    const VkDeviceSize offset = (blocks[block].offset + alignment - 1) / alignment * alignment;
+    if (offset > blocks[block].offset) {
+        const uint32_t aligned = split(block, offset - blocks[block].offset);
+        insert_free(block);
+        block = aligned;
+    }
+
+    if (blocks[block].size > size)
+        insert_free(split(block, size));
+
+    blocks[block].free = false;
+    used.emplace(offset, block);
+    free_bytes -= size;
+
+    out = {offset, size};
+    return true;
+}
+
+void TLSFAllocator::free(ContiguousAllocation alloc) {
+    auto it = used.find(alloc.offset);
+    PK_ASSERT(it != used.end());
+
+    uint32_t block = it->second;
+    used.erase(it);
+
+    free_bytes += blocks[block].size;
+    blocks[block].free = true;
+
+    // free blocks never neighbour each other, so merging both sides is all there is to it
+    const uint32_t next = blocks[block].next;
+    if (next != NONE && blocks[next].free) {
+        remove_free(next);
+        merge(block, next);
+    }
+    const uint32_t prev = blocks[block].prev;
+    if (prev != NONE && blocks[prev].free) {
+        remove_free(prev);
+        merge(prev, block);
+        block = prev;
+    }
+
+    insert_free(block);
+}
+
+VkDeviceSize TLSFAllocator::size_hint() const {
+    return size;
+}
+
+VkDeviceSize TLSFAllocator::free_size() const {
+    return free_bytes;
+}
+
+std::vector<ContiguousAllocation> TLSFAllocator::allocations() const {
+    std::vector<ContiguousAllocation> out;
+    out.reserve(used.size());
+
+    // the first block in memory is never merged into another
+    for (uint32_t block = blocks.empty() ? NONE : 0; block != NONE; block = blocks[block].next) {
+        if (!blocks[block].free)
+            out.push_back({blocks[block].offset, blocks[block].size});
+    }
+
+    return out;
+}
+
+float TLSFAllocator::fragmentation() const {
+    if (free_bytes == 0)
+        return 0.f;
+
+    // the largest free block is in the highest non empty size class
+    const uint32_t fl = msb(fl_bitmap);
+    const uint32_t sl = msb(sl_bitmaps[fl]);
+
+    VkDeviceSize largest = 0;
+    for (uint32_t block = heads[fl][sl]; block != NONE; block = blocks[block].next_free)
+        largest = std::max(largest, blocks[block].size);
+
+    return 1.f - static_cast<float>(largest) / static_cast<float>(free_bytes);
+}
+
+void TLSFAllocator::mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl) {
+    // small sizes are binned linearly
+    if (size < SL_COUNT) {
+        fl = 0;
+        sl = static_cast<uint32_t>(size);
+        return;
+    }
+
+    const uint32_t bit = msb(size);
+    fl = bit - SL_BITS + 1;
+    sl = static_cast<uint32_t>(size >> (bit - SL_BITS)) - SL_COUNT;
+}
+
+uint32_t TLSFAllocator::find_free(VkDeviceSize size) const {
+    uint32_t fl;
+    uint32_t sl;
+    mapping(size, fl, sl);
+
+    // Rounded up to the next size class, every block of which fits
+    VkDeviceSize rounded = size;
+    if (size >= SL_COUNT)
+        rounded += (VkDeviceSize{1} << (msb(size) - SL_BITS)) - 1;
+
+    uint32_t search_fl;
+    uint32_t search_sl;
+    mapping(rounded, search_fl, search_sl);
+
+    uint32_t sl_map = search_fl < FL_COUNT ? sl_bitmaps[search_fl] & (~0u << search_sl) : 0;
+    if (!sl_map) {
+        const uint64_t fl_map = search_fl + 1 < FL_COUNT ? fl_bitmap & (~uint64_t{0} << (search_fl + 1)) : 0;
+        if (fl_map) {
+            search_fl = lsb(fl_map);
+            sl_map = sl_bitmaps[search_fl];
+        }
+    }
+    if (sl_map)
+        return heads[search_fl][lsb(sl_map)];
+
+    // Nothing is certain to fit, but a block in the class of the size itself still might when the memory runs low
+    for (uint32_t block = heads[fl][sl]; block != NONE; block = blocks[block].next_free) {
+        if (blocks[block].size >= size)
+            return block;
+    }
+    return NONE;
+}
+
+void TLSFAllocator::insert_free(uint32_t block) {
+    uint32_t fl;
+    uint32_t sl;
+    mapping(blocks[block].size, fl, sl);
+
+    const uint32_t head = heads[fl][sl];
+    blocks[block].prev_free = NONE;
+    blocks[block].next_free = head;
+    if (head != NONE)
+        blocks[head].prev_free = block;
+
+    heads[fl][sl] = block;
+    sl_bitmaps[fl] |= 1u << sl;
+    fl_bitmap |= uint64_t{1} << fl;
+}
+
+void TLSFAllocator::remove_free(uint32_t block) {
+    uint32_t fl;
+    uint32_t sl;
+    mapping(blocks[block].size, fl, sl);
+
+    const uint32_t prev = blocks[block].prev_free;
+    const uint32_t next = blocks[block].next_free;
+    if (prev != NONE)
+        blocks[prev].next_free = next;
+    if (next != NONE)
+        blocks[next].prev_free = prev;
+
+    if (heads[fl][sl] == block) {
+        heads[fl][sl] = next;
+        if (next == NONE) {
+            sl_bitmaps[fl] &= ~(1u << sl);
+            if (!sl_bitmaps[fl])
+                fl_bitmap &= ~(uint64_t{1} << fl);
+        }
+    }
+
+    blocks[block].prev_free = NONE;
+    blocks[block].next_free = NONE;
+}
+
+uint32_t TLSFAllocator::split(uint32_t block, VkDeviceSize size) {
+    PK_ASSERT(size < blocks[block].size);
+
+    const uint32_t rest = create_block();
+    const uint32_t next = blocks[block].next;
+
+    blocks[rest] = Block{blocks[block].offset + size, blocks[block].size - size, block, next, NONE, NONE, true};
+    if (next != NONE)
+        blocks[next].prev = rest;
+
+    blocks[block].next = rest;
+    blocks[block].size = size;
+    return rest;
+}
+
+void TLSFAllocator::merge(uint32_t block, uint32_t next) {
+    const uint32_t after = blocks[next].next;
+
+    blocks[block].size += blocks[next].size;
+    blocks[block].next = after;
+    if (after != NONE)
+        blocks[after].prev = block;
+
+    unused_blocks.push_back(next);
+}
+
+uint32_t TLSFAllocator::create_block() {
+    if (!unused_blocks.empty()) {
+        const uint32_t block = unused_blocks.back();
+        unused_blocks.pop_back();
+        return block;
+    }
+
+    blocks.emplace_back();
+    return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+
+BuddyAllocator::BuddyAllocator(VkDeviceSize size, VkDeviceSize min_block) : min_block{min_block} {
+    PK_ASSERT(min_block > 0 && size >= min_block);
+
+    max_order = msb(size / min_block);
+    free_bytes = min_block << max_order;
+
+    // the nodes of order o span 2^(max_order - o) nodes of the level, each one starts out as a free block
+    largest.resize((size_t{2} << max_order) - 1);
+    for (uint32_t depth = 0; depth <= max_order; ++depth) {
+        const size_t first = (size_t{1} << depth) - 1;
+        std::fill_n(largest.begin() + first, size_t{1} << depth, static_cast<uint8_t>(max_order - depth + 1));
+    }
+}
+
+bool BuddyAllocator::alloc(VkDeviceSize size, ContiguousAllocation& out) {
+    if (size == 0)
+        return false;
+
+    const VkDeviceSize blocks = (size + min_block - 1) / min_block;
+    const uint32_t order = blocks == 1 ? 0 : msb(blocks - 1) + 1;
+    if (order > max_order || largest[0] < order + 1)
+        return false;
+
+    // Prefer the left child, so that the memory is packed towards the start
+    size_t node = 0;
+    for (uint32_t depth = 0; depth < max_order - order; ++depth) {
+        const size_t left = 2 * node + 1;
+        node = largest[left] >= order + 1 ? left : left + 1;
+    }
+    largest[node] = 0;
+
+    const size_t index = node + 1 - (size_t{1} << (max_order - order));
+    out = {index * (min_block << order), min_block << order};
+    free_bytes -= out.size;
+
+    while (node > 0) {
+        node = (node - 1) / 2;
+        largest[node] = std::max(largest[2 * node + 1], largest[2 * node + 2]);
+    }
+
+    return true;
+}
+
+void BuddyAllocator::free(ContiguousAllocation alloc) {
+    const uint32_t order = msb(alloc.size / min_block);
+    PK_ASSERT(alloc.size == min_block << order && alloc.offset % alloc.size == 0);
+
+    size_t node = (size_t{1} << (max_order - order)) - 1 + alloc.offset / alloc.size;
+    PK_ASSERT(largest[node] == 0);
+
+    largest[node] = static_cast<uint8_t>(order + 1);
+    free_bytes += alloc.size;
+
+    // A node whose children are both entirely free is free as a whole
+    for (uint32_t parent_order = order + 1; node > 0; ++parent_order) {
+        node = (node - 1) / 2;
+        const uint8_t left = largest[2 * node + 1];
+        const uint8_t right = largest[2 * node + 2];
+        largest[node] = left == parent_order && right == parent_order ? static_cast<uint8_t>(parent_order + 1) : std::max(left, right);
+    }
+}
+
+VkDeviceSize BuddyAllocator::size_hint() const {
+    return min_block << max_order;
+}
+
+VkDeviceSize BuddyAllocator::free_size() const {
+    return free_bytes;
+}
+
+} // namespace gfx
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "def.hpp"
+
+#include <volk.h>
+#include <vector>
+#include <array>
+#include <unordered_map>
+
+namespace gfx {
+
+// Allocators of ranges within a larger block of memory, which only do the bookkeeping: see BufferArena
+
+struct ContiguousAllocation final {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+class SlabAllocator final {
+  public:
+    SlabAllocator(uint32_t num_blocks, VkDeviceSize slab_size);
+
+    bool alloc(VkDeviceSize size, ContiguousAllocation& out);
+    void free(ContiguousAllocation alloc);
+
+    VkDeviceSize size_hint() const;
+
+  private:
+    uint32_t num_blocks;
+    VkDeviceSize slab_size;
+    std::vector<VkDeviceSize> slabs;
+};
+
+// Two-level segregated fit: free blocks are binned by the power of two of their size, then linearly within it,
+// so that both allocating and freeing take constant time. Freed blocks are merged with their free neighbours right away.
+class TLSFAllocator final {
+  public:
+    // Every offset is a multiple of alignment, e.g. the size of a vertex so that offsets can be turned into indices
+    TLSFAllocator(VkDeviceSize size, VkDeviceSize alignment = 1);
+
+    bool alloc(VkDeviceSize size, ContiguousAllocation& out);
+    // alignment must be a multiple of the one the allocator was created with
+    bool alloc(VkDeviceSize size, VkDeviceSize alignment, ContiguousAllocation& out);
+    void free(ContiguousAllocation alloc);
+
+    VkDeviceSize size_hint() const;
+    VkDeviceSize free_size() const;
+    // The allocations in use, in order of their offsets
+    std::vector<ContiguousAllocation> allocations() const;
+    // 1 - largest free block / free memory: 0 while the free memory is contiguous, towards 1 as it's split into ever smaller blocks
+    float fragmentation() const;
+
+  private:
+    static constexpr uint32_t SL_BITS = 5;
+    static constexpr uint32_t SL_COUNT = 1 << SL_BITS;
+    static constexpr uint32_t FL_COUNT = 64 - SL_BITS + 1;
+    static constexpr uint32_t NONE = ~0u;
+
+    struct Block final {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        // neighbours in memory
+        uint32_t prev;
+        uint32_t next;
+        // neighbours in the free list of its size class
+        uint32_t prev_free;
+        uint32_t next_free;
+        bool free;
+    };
+
+    static void mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl);
+
+    uint32_t find_free(VkDeviceSize size) const;
+    void insert_free(uint32_t block);
+    void remove_free(uint32_t block);
+    // Splits the block at size, returning the block of the remainder
+    uint32_t split(uint32_t block, VkDeviceSize size);
+    // Absorbs the next block in memory into block
+    void merge(uint32_t block, uint32_t next);
+    uint32_t create_block();
+
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+    VkDeviceSize free_bytes;
+
+    std::vector<Block> blocks;
+    std::vector<uint32_t> unused_blocks;
+    // blocks in use by their offset
+    std::unordered_map<VkDeviceSize, uint32_t> used;
+
+    uint64_t fl_bitmap;
+    std::array<uint32_t, FL_COUNT> sl_bitmaps;
+    std::array<std::array<uint32_t, SL_COUNT>, FL_COUNT> heads;
+};
+
+
+// Hands out blocks of a power of two multiple of a minimum block size, split from and merged back into their buddies.
+// The blocks form an implicit binary tree stored breadth first, in which every node keeps the order of the largest free block below it:
+// an allocation descends from the root and a free climbs back up to it, so both take O(log n) and touch the top levels, which share cache lines, the most.
+class BuddyAllocator final {
+  public:
+    // size is rounded down to a power of two multiple of min_block
+    BuddyAllocator(VkDeviceSize size, VkDeviceSize min_block);
+
+    // The size of the allocation is rounded up to a power of two multiple of min_block, and so is its alignment
+    bool alloc(VkDeviceSize size, ContiguousAllocation& out);
+    void free(ContiguousAllocation alloc);
+
+    VkDeviceSize size_hint() const;
+    VkDeviceSize free_size() const;
+
+  private:
+    // the order of the root, whose block is the whole memory
+    uint32_t max_order;
+    VkDeviceSize min_block;
+    VkDeviceSize free_bytes;
+    // 1 + the order of the largest free block in the subtree of each node, 0 when it's all allocated
+    std::vector<uint8_t> largest;
+};
+
+} // namespace gfx
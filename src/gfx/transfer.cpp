@@ -0,0 +1,277 @@
+#include "transfer.hpp"
+
+#include "context.hpp"
+#include "frame_context.hpp"
+#include "vk_helpers.hpp"
+#include "def.hpp"
+
+#include <cstring>
+#include <iterator>
+
+namespace gfx {
+
+void TransferUploader::init(Context& cx) {
+    this->cx = &cx;
+    value = 0;
+
+    pool.init(cx, cx.transfer_queue_idx);
+
+    VkSemaphoreTypeCreateInfo stci = {};
+    stci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    stci.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    stci.initialValue = 0;
+
+    VkSemaphoreCreateInfo sci = {};
+    sci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    sci.pNext = &stci;
+
+    vk_log(vkCreateSemaphore(cx.dev, &sci, nullptr, &timeline));
+}
+
+void TransferUploader::cleanup() {
+    submit();
+
+    VkSemaphoreWaitInfo swi = {};
+    swi.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    swi.semaphoreCount = 1;
+    swi.pSemaphores = &timeline;
+    swi.pValues = &value;
+
+    vk_log(vkWaitSemaphores(cx->dev, &swi, UINT64_MAX));
+
+    for (Batch& batch : submitted) {
+        free(batch);
+    }
+    submitted.clear();
+
+    pool.cleanup();
+    vkDestroySemaphore(cx->dev, timeline, nullptr);
+}
+
+void TransferUploader::upload(Buffer dst, const void* data, std::function<void()> on_resident) {
+    std::scoped_lock<std::mutex> lock{m};
+
+    begin_batch();
+
+    const Buffer staging = create_staging(data, dst.size);
+
+    VkBufferCopy copy;
+    copy.srcOffset = staging.offset;
+    copy.dstOffset = dst.offset;
+    copy.size = dst.size;
+
+    vkCmdCopyBuffer(recording.cmd, staging.buffer, dst.buffer, 1, &copy);
+
+    recording.buffers.push_back(dst);
+    if (on_resident)
+        recording.on_resident.push_back(std::move(on_resident));
+}
+
+void TransferUploader::upload(
+    Image img, const void* data, VkDeviceSize size, uint32_t bytes_per_pixel, bool generate_mipmaps, std::function<void()> on_resident) {
+    std::scoped_lock<std::mutex> lock{m};
+
+    begin_batch();
+
+    const Buffer staging = create_staging(data, size);
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.image = img.image;
+    barrier.subresourceRange = vk_subresource_range(0, img.layers, 0, img.num_mips, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    vkCmdPipelineBarrier(recording.cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // the layers follow each other in data
+    VkBufferImageCopy copy = {};
+    copy.bufferOffset = staging.offset;
+    copy.imageSubresource = vk_subresource_layers(0, img.layers, 0, VK_IMAGE_ASPECT_COLOR_BIT);
+    copy.imageExtent = img.extent;
+
+    PK_ASSERT(size == static_cast<VkDeviceSize>(bytes_per_pixel) * img.extent.width * img.extent.height * img.extent.depth * img.layers);
+
+    vkCmdCopyBufferToImage(recording.cmd, staging.buffer, img.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+
+    recording.images.push_back(ImageUpload{img, generate_mipmaps && img.num_mips > 1});
+    if (on_resident)
+        recording.on_resident.push_back(std::move(on_resident));
+}
+
+void TransferUploader::submit() {
+    std::scoped_lock<std::mutex> lock{m};
+
+    if (recording.cmd == VK_NULL_HANDLE)
+        return;
+
+    std::vector<VkBufferMemoryBarrier> buffer_barriers;
+    std::vector<VkImageMemoryBarrier> image_barriers;
+    ownership_barriers(recording, true, buffer_barriers, image_barriers);
+
+    vkCmdPipelineBarrier(recording.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, buffer_barriers.size(),
+        buffer_barriers.data(), image_barriers.size(), image_barriers.data());
+
+    vk_log(vkEndCommandBuffer(recording.cmd));
+
+    recording.value = ++value;
+
+    VkTimelineSemaphoreSubmitInfo tssi = {};
+    tssi.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    tssi.signalSemaphoreValueCount = 1;
+    tssi.pSignalSemaphoreValues = &recording.value;
+
+    VkSubmitInfo si = {};
+    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    si.pNext = &tssi;
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &recording.cmd;
+    si.signalSemaphoreCount = 1;
+    si.pSignalSemaphores = &timeline;
+
+    vk_log(vkQueueSubmit(cx->transfer_queue, 1, &si, VK_NULL_HANDLE));
+
+    submitted.push_back(std::move(recording));
+    recording = Batch{};
+}
+
+void TransferUploader::acquire(FrameContext& fcx) {
+    std::vector<std::function<void()>> resident;
+
+    {
+        std::scoped_lock<std::mutex> lock{m};
+
+        if (submitted.empty())
+            return;
+
+        uint64_t completed = 0;
+        vk_log(vkGetSemaphoreCounterValue(cx->dev, timeline, &completed));
+
+        // Only the batches that already finished are taken over, so that the frame never waits on the transfer queue
+        std::vector<VkBufferMemoryBarrier> buffer_barriers;
+        std::vector<VkImageMemoryBarrier> image_barriers;
+        std::vector<ImageUpload> mipmapped;
+        uint64_t acquired = 0;
+
+        for (; !submitted.empty() && submitted.front().value <= completed; submitted.pop_front()) {
+            Batch& batch = submitted.front();
+
+            ownership_barriers(batch, false, buffer_barriers, image_barriers);
+            for (const ImageUpload& upload : batch.images) {
+                if (upload.generate_mipmaps)
+                    mipmapped.push_back(upload);
+            }
+
+            std::move(batch.on_resident.begin(), batch.on_resident.end(), std::back_inserter(resident));
+            acquired = batch.value;
+
+            free(batch);
+        }
+
+        if (acquired == 0)
+            return;
+
+        // The wait is already satisfied, but still makes the writes of the transfer queue visible
+        fcx.wait_semaphore(timeline, acquired, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+        vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, buffer_barriers.size(),
+            buffer_barriers.data(), image_barriers.size(), image_barriers.data());
+
+        for (const ImageUpload& upload : mipmapped) {
+            for (uint32_t layer = 0; layer < upload.img.layers; ++layer) {
+                generate_mipmaps(fcx, upload.img, upload.img.format, upload.img.num_mips, layer);
+            }
+        }
+    }
+
+    // outside of the lock, so that the callbacks may upload again
+    for (const std::function<void()>& fn : resident) {
+        fn();
+    }
+}
+
+std::size_t TransferUploader::pending() const {
+    std::scoped_lock<std::mutex> lock{m};
+    return submitted.size() + (recording.cmd != VK_NULL_HANDLE ? 1 : 0);
+}
+
+void TransferUploader::begin_batch() {
+    if (recording.cmd != VK_NULL_HANDLE)
+        return;
+
+    recording.cmd = pool.take();
+
+    VkCommandBufferBeginInfo cbbi = {};
+    cbbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cbbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vk_log(vkBeginCommandBuffer(recording.cmd, &cbbi));
+}
+
+Buffer TransferUploader::create_staging(const void* data, VkDeviceSize size) {
+    VkBufferCreateInfo bci = {};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.size = size;
+    bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    const Buffer staging = cx->alloc.create_buffer(bci, VMA_MEMORY_USAGE_CPU_ONLY, true);
+
+    ::memcpy(staging.pmap, data, size);
+    vk_log(vmaFlushAllocation(cx->alloc.allocator, staging.allocation, staging.offset, size));
+
+    recording.staging.push_back(staging);
+    return staging;
+}
+
+void TransferUploader::ownership_barriers(
+    const Batch& batch, bool release, std::vector<VkBufferMemoryBarrier>& buffers, std::vector<VkImageMemoryBarrier>& images) const {
+    // Without a queue family dedicated to transfers there's no ownership to hand over, the release alone transitions the images
+    const bool transfer_ownership = cx->transfer_queue_idx != cx->gfx_queue_idx;
+    const uint32_t src_family = transfer_ownership ? cx->transfer_queue_idx : VK_QUEUE_FAMILY_IGNORED;
+    const uint32_t dst_family = transfer_ownership ? cx->gfx_queue_idx : VK_QUEUE_FAMILY_IGNORED;
+
+    for (const Buffer& buffer : batch.buffers) {
+        VkBufferMemoryBarrier barrier = vk_buffer_barrier(buffer);
+        barrier.srcAccessMask = release ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+        barrier.dstAccessMask = release ? 0 : VK_ACCESS_MEMORY_READ_BIT;
+        barrier.srcQueueFamilyIndex = src_family;
+        barrier.dstQueueFamilyIndex = dst_family;
+
+        if (release || transfer_ownership)
+            buffers.push_back(barrier);
+    }
+
+    for (const ImageUpload& upload : batch.images) {
+        const VkImageLayout layout = upload.generate_mipmaps ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = release || transfer_ownership ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : layout;
+        barrier.newLayout = layout;
+        barrier.srcAccessMask = release ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+        barrier.dstAccessMask = release ? 0 : upload.generate_mipmaps ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+        barrier.srcQueueFamilyIndex = src_family;
+        barrier.dstQueueFamilyIndex = dst_family;
+        barrier.image = upload.img.image;
+        barrier.subresourceRange = vk_subresource_range(0, upload.img.layers, 0, upload.img.num_mips, VK_IMAGE_ASPECT_COLOR_BIT);
+
+        images.push_back(barrier);
+    }
+}
+
+void TransferUploader::free(Batch& batch) {
+    for (const Buffer& staging : batch.staging) {
+        cx->alloc.destroy(staging);
+    }
+    batch.staging.clear();
+
+    if (batch.cmd != VK_NULL_HANDLE)
+        pool.replace(batch.cmd);
+    batch.cmd = VK_NULL_HANDLE;
+}
+
+} // namespace gfx
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "types.hpp"
+#include "cmd_pool.hpp"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <volk.h>
+
+namespace gfx {
+
+struct Context;
+class FrameContext;
+
+/*
+  Uploads assets (meshes, textures) on the transfer queue while the graphics queue keeps rendering.
+
+  Uploads are recorded into a batch that submit() hands to the transfer queue, which signals the batch's value of a timeline semaphore
+  and releases the ownership of the written resources. Every frame, acquire() takes over the batches that have finished on the transfer queue
+  into the graphics command buffer, generates the mipmaps of their images, and then calls back that their resources are resident:
+  commands recorded into that frame context after acquire() may use them.
+
+  Uploading is thread-safe, so assets may be streamed in from other threads.
+*/
+class TransferUploader final {
+  public:
+    void init(Context& cx);
+    // Waits on the batches still in flight
+    void cleanup();
+
+    void upload(Buffer dst, const void* data, std::function<void()> on_resident = {});
+    // Writes the first mip level of every layer (tightly packed in data), and fills the rest with the mipmaps of the first once acquired.
+    // img is in SHADER_READ_ONLY_OPTIMAL once resident.
+    void upload(Image img, const void* data, VkDeviceSize size, uint32_t bytes_per_pixel, bool generate_mipmaps, std::function<void()> on_resident = {});
+
+    void submit();
+    void acquire(FrameContext& fcx);
+
+    // Batches recorded or in flight
+    std::size_t pending() const;
+
+  private:
+    struct ImageUpload final {
+        Image img;
+        bool generate_mipmaps;
+    };
+
+    struct Batch final {
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        uint64_t value = 0;
+        std::vector<Buffer> staging;
+        std::vector<Buffer> buffers;
+        std::vector<ImageUpload> images;
+        std::vector<std::function<void()>> on_resident;
+    };
+
+    void begin_batch();
+    Buffer create_staging(const void* data, VkDeviceSize size);
+    // Barriers of the ownership transfer, which the transfer queue releases and the graphics queue acquires
+    void ownership_barriers(const Batch& batch, bool release, std::vector<VkBufferMemoryBarrier>& buffers, std::vector<VkImageMemoryBarrier>& images) const;
+    void free(Batch& batch);
+
+    Context* cx;
+    CommandPool pool;
+    VkSemaphore timeline;
+    uint64_t value;
+
+    mutable std::mutex m;
+    Batch recording;
+    std::deque<Batch> submitted;
+};
+
+} // namespace gfx
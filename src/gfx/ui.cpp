@@ -12,7 +12,7 @@ namespace gfx {
 
 void style();
 
-void UIRenderer::late_init(FrameContext& fcx, VkRenderPass rp) {
+void UIRenderer::late_init(FrameContext& fcx, VkRenderPass rp, uint32_t subpass) {
     if (initialized)
         return;
     else
@@ -61,6 +61,7 @@ void UIRenderer::late_init(FrameContext& fcx, VkRenderPass rp) {
     init.MinImageCount = 3;
     init.ImageCount = 3;
     init.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+    init.Subpass = subpass;
 
     ImGui_ImplVulkan_Init(&init, rp);
     ImGui_ImplVulkan_CreateFontsTexture(fcx.cmd);
@@ -68,6 +69,9 @@ void UIRenderer::late_init(FrameContext& fcx, VkRenderPass rp) {
 }
 
 void UIRenderer::cleanup(Context& cx) {
+    if (!initialized)
+        return;
+
     vkDestroyDescriptorPool(cx.dev, pool, nullptr);
     ImGui_ImplVulkan_Shutdown();
 }
@@ -9,7 +9,7 @@ class FrameContext;
 
 class UIRenderer final {
   public:
-    void late_init(FrameContext& fcx, VkRenderPass rp);
+    void late_init(FrameContext& fcx, VkRenderPass rp, uint32_t subpass);
     void cleanup(Context& cx);
 
     bool begin();
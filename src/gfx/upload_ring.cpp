@@ -0,0 +1,143 @@
+#include "upload_ring.hpp"
+
+#include "context.hpp"
+#include "frame_context.hpp"
+#include "vk_helpers.hpp"
+#include "def.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <spdlog/spdlog.h>
+
+namespace gfx {
+
+static constexpr VkDeviceSize UPLOAD_ALIGNMENT = 16;
+
+void UploadRing::init(Context& cx, uint32_t frames) {
+    this->cx = &cx;
+    this->frames = frames;
+
+    VkBufferCreateInfo bci = {};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.size = FRAME_SIZE * frames;
+    bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    ring = cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_CPU_ONLY, true);
+
+    base = 0;
+    head = 0;
+    flushed = 0;
+}
+
+void UploadRing::cleanup() {
+    cx->alloc.destroy(ring);
+}
+
+void UploadRing::begin_frame(uint32_t slot) {
+    std::scoped_lock<std::mutex> lock{m};
+
+    PK_ASSERT(slot < frames);
+    PK_ASSERT(uploads.empty());
+
+    base = FRAME_SIZE * slot;
+    head = 0;
+    flushed = 0;
+}
+
+void UploadRing::stage(Buffer dst, const void* data) {
+    std::scoped_lock<std::mutex> lock{m};
+
+    const VkDeviceSize offset = (head + UPLOAD_ALIGNMENT - 1) & ~(UPLOAD_ALIGNMENT - 1);
+
+    if (offset + dst.size <= FRAME_SIZE) {
+        ::memcpy(static_cast<uint8_t*>(ring.pmap) + base + offset, data, dst.size);
+        uploads.push_back(Upload{dst, base + offset, false});
+        head = offset + dst.size;
+    } else {
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        uploads.push_back(Upload{dst, spill.size(), true});
+        spill.insert(spill.end(), bytes, bytes + dst.size);
+    }
+}
+
+void UploadRing::flush(FrameContext& fcx) {
+    std::scoped_lock<std::mutex> lock{m};
+
+    if (uploads.empty())
+        return;
+
+    if (head > flushed)
+        vk_log(vmaFlushAllocation(cx->alloc.allocator, ring.allocation, ring.offset + base + flushed, head - flushed));
+    flushed = head;
+
+    Buffer spill_buffer = {};
+    if (!spill.empty()) {
+        spdlog::warn("staged {} bytes past the {} byte upload ring region of the frame", spill.size(), FRAME_SIZE);
+        spill_buffer = fcx.staging_buffer(spill.data(), spill.size());
+        spill.clear();
+    }
+
+    // Copies into the same buffer are issued together, and merged where both sides are contiguous
+    std::stable_sort(uploads.begin(), uploads.end(), [](const Upload& a, const Upload& b) {
+        if (a.dst.buffer != b.dst.buffer)
+            return a.dst.buffer < b.dst.buffer;
+        return a.dst.offset < b.dst.offset;
+    });
+
+    // The regions of a copy may not overlap, only the last of the writes to the same range is kept
+    std::vector<Upload> unique;
+    unique.reserve(uploads.size());
+    for (const Upload& upload : uploads) {
+        if (!unique.empty() && unique.back().dst.buffer == upload.dst.buffer && unique.back().dst.offset == upload.dst.offset) {
+            PK_ASSERT(unique.back().dst.size == upload.dst.size);
+            unique.back() = upload;
+        } else {
+            PK_ASSERT(unique.empty() || unique.back().dst.buffer != upload.dst.buffer || unique.back().dst.offset + unique.back().dst.size <= upload.dst.offset);
+            unique.push_back(upload);
+        }
+    }
+    uploads = std::move(unique);
+
+    std::stable_partition(uploads.begin(), uploads.end(), [](const Upload& upload) { return !upload.spilled; });
+
+    // Buffers rewritten every frame (e.g. the view uniforms) may still be read by the previous frame, on either queue
+    vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+    cx->rg_cache.wait_compute(fcx, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    std::vector<VkBufferCopy> copies;
+    for (std::size_t i = 0; i < uploads.size(); ++i) {
+        const Upload& upload = uploads[i];
+        const Buffer& src = upload.spilled ? spill_buffer : ring;
+
+        VkBufferCopy copy;
+        copy.srcOffset = src.offset + upload.src_offset;
+        copy.dstOffset = upload.dst.offset;
+        copy.size = upload.dst.size;
+
+        if (!copies.empty() && copies.back().srcOffset + copies.back().size == copy.srcOffset &&
+            copies.back().dstOffset + copies.back().size == copy.dstOffset) {
+            copies.back().size += copy.size;
+        } else {
+            copies.push_back(copy);
+        }
+
+        const bool last = i + 1 == uploads.size() || uploads[i + 1].spilled != upload.spilled || uploads[i + 1].dst.buffer != upload.dst.buffer;
+        if (last) {
+            vkCmdCopyBuffer(fcx.cmd, src.buffer, upload.dst.buffer, copies.size(), copies.data());
+            copies.clear();
+        }
+    }
+
+    uploads.clear();
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT |
+                            VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+
+    vkCmdPipelineBarrier(fcx.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+} // namespace gfx
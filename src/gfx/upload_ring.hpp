@@ -0,0 +1,55 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <vector>
+#include <mutex>
+#include <volk.h>
+
+namespace gfx {
+
+struct Context;
+class FrameContext;
+
+/*
+  Staging memory for the small CPU to GPU writes made every frame (uniforms, instances, draw templates, materials).
+  A single persistently mapped buffer is split into one region per frame in flight, of which the current one is sub-allocated linearly,
+  so that staging doesn't allocate. The writes are copied at once by flush(), behind a single barrier.
+
+  Larger one-off uploads (meshes, textures) still go through FrameContext::stage.
+*/
+class UploadRing final {
+  public:
+    static constexpr VkDeviceSize FRAME_SIZE = 8 * 1024 * 1024;
+
+    void init(Context& cx, uint32_t frames);
+    void cleanup();
+
+    // The region of the slot is reused, so the frame last rendered in it must have finished
+    void begin_frame(uint32_t slot);
+
+    void stage(Buffer dst, const void* data);
+    // Records the copies of everything staged since the last flush, which are visible to all reads after it
+    void flush(FrameContext& fcx);
+
+  private:
+    struct Upload final {
+        Buffer dst;
+        VkDeviceSize src_offset;
+        // past the end of the region, copied from a staging buffer of the frame context instead
+        bool spilled;
+    };
+
+    Context* cx;
+    Buffer ring;
+    uint32_t frames;
+
+    std::mutex m;
+    VkDeviceSize base;
+    VkDeviceSize head;
+    VkDeviceSize flushed;
+    std::vector<Upload> uploads;
+    std::vector<uint8_t> spill;
+};
+
+} // namespace gfx
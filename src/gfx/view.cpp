@@ -0,0 +1,86 @@
+#include "view.hpp"
+
+#include "context.hpp"
+#include "frame_context.hpp"
+
+#include <spdlog/fmt/fmt.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace gfx {
+
+static glm::vec4 v3norm(glm::vec4 p) {
+    return p / glm::length(glm::vec3{p});
+}
+
+void View::init(FrameContext& fcx, std::string name, uint32_t width, uint32_t height) {
+    this->name = std::move(name);
+    this->width = width;
+    this->height = height;
+
+    ssao = main();
+    prev_vp = glm::mat4{1.f};
+
+    VkBufferCreateInfo bci = {};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    bci.size = sizeof(Uniforms);
+    bci.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    ubo = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
+
+    bci.size = sizeof(CullUniforms);
+    cull_ubo = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
+
+    bci.size = sizeof(glm::mat4) * 3;
+    reprojection_ubo = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_GPU_ONLY, false);
+}
+
+void View::cleanup(FrameContext& fcx) {
+    fcx.bind(ubo);
+    fcx.bind(cull_ubo);
+    fcx.bind(reprojection_ubo);
+}
+
+void View::set_camera(glm::vec3 pos, glm::vec3 forward, glm::vec3 up, const glm::mat4& perspective, float near_clip, float far_clip) {
+    uniforms.cam_pos = {pos, 0.f};
+    uniforms.cam_view = glm::lookAt(pos, pos + forward, up);
+    uniforms.cam_proj = perspective * uniforms.cam_view;
+
+    const glm::mat4 projtrans = glm::transpose(perspective);
+    const glm::vec4 frustum_x = v3norm(projtrans[3] + projtrans[0]);
+    const glm::vec4 frustum_y = v3norm(projtrans[3] + projtrans[1]);
+
+    cull_uniforms.frustum[0] = frustum_x.x;
+    cull_uniforms.frustum[1] = frustum_x.z;
+    cull_uniforms.frustum[2] = frustum_y.y;
+    cull_uniforms.frustum[3] = frustum_y.z;
+    cull_uniforms.near_far = glm::vec2{near_clip, far_clip};
+    cull_uniforms.view = uniforms.cam_view;
+}
+
+void View::update(FrameContext& fcx, glm::vec4 sun_dir, glm::vec4 sun_radiant_flux) {
+    uniforms.sun_dir = sun_dir;
+    uniforms.sun_radiant_flux = sun_radiant_flux;
+    fcx.cx.uploads.stage(ubo, &uniforms);
+    fcx.cx.uploads.stage(cull_ubo, &cull_uniforms);
+
+    const glm::mat4 reprojection[3] = {glm::inverse(uniforms.cam_proj), uniforms.cam_view, prev_vp};
+    fcx.cx.uploads.stage(reprojection_ubo, &reprojection[0]);
+    prev_vp = uniforms.cam_proj;
+}
+
+bool View::main() const {
+    return name.empty();
+}
+
+Name View::resource(std::string_view name) const {
+    if (main())
+        return {std::string{name}};
+    return {fmt::format("{}.{}", this->name, name)};
+}
+
+Name View::output() const {
+    return main() ? Name{"composite.in"} : resource("out");
+}
+
+} // namespace gfx
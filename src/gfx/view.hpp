@@ -0,0 +1,64 @@
+#pragma once
+
+#include "types.hpp"
+#include "render_graph.hpp"
+
+#include <string>
+#include <string_view>
+#include <glm/mat4x4.hpp>
+
+namespace gfx {
+
+class FrameContext;
+
+// A camera the frame is rendered from, with its own uniforms, culling output and render targets.
+// The main view is presented to the swapchain. Secondary views (e.g. picture-in-picture, reflection or probe captures) resolve into output(),
+// and reuse the work of the main view that doesn't depend on the camera, such as the uploads and the shadow maps of the sun.
+class View final {
+  public:
+    struct Uniforms final {
+        glm::vec4 cam_pos;
+        glm::vec4 sun_dir;
+        glm::vec4 sun_radiant_flux;
+        glm::mat4 cam_proj;
+        glm::mat4 cam_view;
+    };
+
+    struct CullUniforms final {
+        glm::vec4 frustum;
+        glm::vec2 near_far;
+        glm::mat4 view;
+    };
+
+    void init(FrameContext& fcx, std::string name, uint32_t width, uint32_t height);
+    void cleanup(FrameContext& fcx);
+
+    void set_camera(glm::vec3 pos, glm::vec3 forward, glm::vec3 up, const glm::mat4& perspective, float near_clip, float far_clip);
+    // Uploads the uniforms of this frame, with the sun shared by all views
+    void update(FrameContext& fcx, glm::vec4 sun_dir, glm::vec4 sun_radiant_flux);
+
+    bool main() const;
+    // Graph resources of secondary views are prefixed with the view name, those of the main view keep their plain names
+    Name resource(std::string_view name) const;
+    // The resolved image of the view; that of a secondary view is kept across frames, so it can also be sampled as its history
+    Name output() const;
+
+    std::string name;
+    uint32_t width;
+    uint32_t height;
+    // Secondary views leave out SSAO by default, so that they cost about as much as their raster passes
+    bool ssao;
+
+    Uniforms uniforms;
+    CullUniforms cull_uniforms;
+
+    Buffer ubo;
+    Buffer cull_ubo;
+    // inverse view-projection, view, and the view-projection of the previous frame
+    Buffer reprojection_ubo;
+
+  private:
+    glm::mat4 prev_vp;
+};
+
+} // namespace gfx
@@ -21,7 +21,8 @@ void vk_log(VkResult result) {
 #endif
 }
 
-Image load_image(FrameContext& fcx, const ImageLoadInfo& info) {
+// Decodes the pixels of the image, and describes the image they're loaded into
+static void* decode_image(const ImageLoadInfo& info, VkImageCreateInfo& ici) {
     int32_t width = 0, height = 0, chans = 0;
     stbi_set_flip_vertically_on_load(info.flip);
 
@@ -35,7 +36,6 @@ Image load_image(FrameContext& fcx, const ImageLoadInfo& info) {
 
     const uint32_t mip_levels = info.generate_mipmaps ? static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1 : 1;
 
-    VkImageCreateInfo ici = {};
     ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     ici.imageType = VK_IMAGE_TYPE_2D;
     ici.arrayLayers = 1;
@@ -53,6 +53,16 @@ Image load_image(FrameContext& fcx, const ImageLoadInfo& info) {
     if (info.generate_mipmaps)
         ici.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
+    return pixels;
+}
+
+Image load_image(FrameContext& fcx, const ImageLoadInfo& info) {
+    VkImageCreateInfo ici = {};
+    void* pixels = decode_image(info, ici);
+    const uint32_t width = ici.extent.width;
+    const uint32_t height = ici.extent.height;
+    const uint32_t mip_levels = ici.mipLevels;
+
     Image img = fcx.cx.alloc.create_image(ici, VMA_MEMORY_USAGE_GPU_ONLY);
 
     VkBufferCreateInfo bci = {};
@@ -87,6 +97,19 @@ Image load_image(FrameContext& fcx, const ImageLoadInfo& info) {
     return img;
 }
 
+Image load_image(Context& cx, const ImageLoadInfo& info, std::function<void()> on_resident) {
+    VkImageCreateInfo ici = {};
+    void* pixels = decode_image(info, ici);
+
+    const Image img = cx.alloc.create_image(ici, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    cx.transfers.upload(img, pixels, static_cast<VkDeviceSize>(info.bytes_per_pixel) * ici.extent.width * ici.extent.height, info.bytes_per_pixel,
+        info.generate_mipmaps, std::move(on_resident));
+    stbi_image_free(pixels);
+
+    return img;
+}
+
 void generate_mipmaps(FrameContext& fcx, Image img, VkFormat format, uint32_t mip_levels, uint32_t layer) {
     VkImageMemoryBarrier barrier = {};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -160,30 +183,39 @@ Texture create_texture(VkDevice device, Image image, const VkImageViewCreateInfo
 }
 
 Texture create_texture(Context& cx, const TextureDesc& desc) {
-    VkImageCreateInfo ici = image_desc();
-    ici.flags = desc.flags;
-    ici.imageType = desc.type;
-    ici.extent.width = desc.width;
-    ici.extent.height = desc.height;
-    ici.extent.depth = desc.depth;
-    ici.arrayLayers = desc.layers;
-    ici.mipLevels = desc.mips;
-    ici.usage = desc.usage;
-    ici.samples = desc.samples;
-    ici.usage = desc.usage;
-    ici.format = desc.format;
+    const Image img = cx.alloc.create_image(vk_image_create_info(desc), VMA_MEMORY_USAGE_GPU_ONLY);
+    return create_texture(cx.dev, img, vk_image_view_create_info(desc, img.image));
+}
+
+Texture create_pixel_texture(FrameContext& fcx, VkFormat format, const void* pixel, uint32_t bytes_per_pixel) {
+    TextureDesc desc;
+    desc.width = 1;
+    desc.height = 1;
+    desc.depth = 1;
+    desc.layers = 1;
+    desc.mips = 1;
+    desc.samples = VK_SAMPLE_COUNT_1_BIT;
+    desc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    desc.format = format;
+    desc.type = VK_IMAGE_TYPE_2D;
+    desc.view_type = VK_IMAGE_VIEW_TYPE_2D;
+    desc.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+    const Texture tex = create_texture(fcx.cx, desc);
 
-    Image img = cx.alloc.create_image(ici, VMA_MEMORY_USAGE_GPU_ONLY);
+    VkBufferCreateInfo bci = {};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    bci.size = bytes_per_pixel;
+    bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 
-    VkImageViewCreateInfo ivci = {};
-    ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    ivci.image = img.image;
-    ivci.viewType = desc.view_type;
-    ivci.components = vk_no_swizzle();
-    ivci.format = ici.format;
-    ivci.subresourceRange = vk_subresource_range(0, desc.layers, 0, desc.mips, desc.aspect);
+    Buffer staging = fcx.cx.alloc.create_buffer(bci, VMA_MEMORY_USAGE_CPU_ONLY, true);
+    fcx.bind(staging);
 
-    return create_texture(cx.dev, img, ivci);
+    vk_mapped_write(fcx.cx.alloc, staging, pixel, bytes_per_pixel);
+    fcx.copy_to_image(staging, tex.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, bytes_per_pixel, vk_subresource_layers(0, 1, 0, VK_IMAGE_ASPECT_COLOR_BIT));
+
+    return tex;
 }
 
 void destroy_texture(Context& cx, Texture tex) {
@@ -422,6 +454,32 @@ VkImageCreateInfo image_desc() {
     return ici;
 }
 
+VkImageCreateInfo vk_image_create_info(const TextureDesc& desc) {
+    VkImageCreateInfo ici = image_desc();
+    ici.flags = desc.flags;
+    ici.imageType = desc.type;
+    ici.extent.width = desc.width;
+    ici.extent.height = desc.height;
+    ici.extent.depth = desc.depth;
+    ici.arrayLayers = desc.layers;
+    ici.mipLevels = desc.mips;
+    ici.samples = desc.samples;
+    ici.usage = desc.usage;
+    ici.format = desc.format;
+    return ici;
+}
+
+VkImageViewCreateInfo vk_image_view_create_info(const TextureDesc& desc, VkImage image) {
+    VkImageViewCreateInfo ivci = {};
+    ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    ivci.image = image;
+    ivci.viewType = desc.view_type;
+    ivci.components = vk_no_swizzle();
+    ivci.format = desc.format;
+    ivci.subresourceRange = vk_subresource_range(0, desc.layers, 0, desc.mips, desc.aspect);
+    return ivci;
+}
+
 VkBufferMemoryBarrier vk_buffer_barrier(Buffer buffer) {
     VkBufferMemoryBarrier barrier = {};
     barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
@@ -433,6 +491,11 @@ VkBufferMemoryBarrier vk_buffer_barrier(Buffer buffer) {
     return barrier;
 }
 
+bool vk_has_stencil(VkFormat format) {
+    return format == VK_FORMAT_S8_UINT || format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT ||
+           format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
 } // namespace gfx
 
 bool operator==(const VkRenderPassCreateInfo& lhs, const VkRenderPassCreateInfo& rhs) {
@@ -453,9 +516,9 @@ bool operator==(const VkSubpassDescription& lhs, const VkSubpassDescription& rhs
            HashSpan{lhs.pPreserveAttachments, lhs.preserveAttachmentCount} == HashSpan{rhs.pPreserveAttachments, rhs.preserveAttachmentCount} &&
            ((lhs.pResolveAttachments != nullptr && rhs.pResolveAttachments != nullptr)
                    ? HashSpan{lhs.pResolveAttachments, lhs.colorAttachmentCount} == HashSpan{rhs.pResolveAttachments, rhs.colorAttachmentCount}
-                   : false) &&
+                   : lhs.pResolveAttachments == rhs.pResolveAttachments) &&
            ((lhs.pDepthStencilAttachment != nullptr && rhs.pDepthStencilAttachment != nullptr) ? (*lhs.pDepthStencilAttachment == *rhs.pDepthStencilAttachment)
-                                                                                               : false);
+                                                                                               : lhs.pDepthStencilAttachment == rhs.pDepthStencilAttachment);
 }
 
 bool operator==(const VkAttachmentDescription& lhs, const VkAttachmentDescription& rhs) {
@@ -6,6 +6,7 @@
 #include <volk.h>
 #include <utility>
 #include <string>
+#include <functional>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 
@@ -51,9 +52,13 @@ struct LoadedMesh final {
 };
 
 Image load_image(FrameContext& fcx, const ImageLoadInfo& info);
+// Uploads the image on the transfer queue instead, it may only be used once on_resident was called
+Image load_image(Context& cx, const ImageLoadInfo& info, std::function<void()> on_resident);
 void generate_mipmaps(FrameContext& fcx, Image img, VkFormat format, uint32_t mip_levels, uint32_t layer);
 Texture create_texture(VkDevice device, Image image, const VkImageViewCreateInfo& ivci);
 Texture create_texture(Context& cx, const TextureDesc& desc);
+// 1x1 sampled texture holding a single pixel, in SHADER_READ_ONLY_OPTIMAL once the frame executes
+Texture create_pixel_texture(FrameContext& fcx, VkFormat format, const void* pixel, uint32_t bytes_per_pixel);
 void destroy_texture(Context& cx, Texture tex);
 void load_shader(class ShaderCache& sc, const std::string& name, VkShaderStageFlags stage);
 LoadedMesh load_mesh(const std::string& file);
@@ -77,7 +82,10 @@ VkPipelineMultisampleStateCreateInfo vk_multisampling_state_create_info(VkSample
 VkPipelineColorBlendAttachmentState vk_color_blend_attachment_state();
 VkPipelineDepthStencilStateCreateInfo vk_depth_stencil_create_info(bool depth_test, bool depth_write, VkCompareOp compare_op);
 VkImageCreateInfo image_desc();
+VkImageCreateInfo vk_image_create_info(const TextureDesc& desc);
+VkImageViewCreateInfo vk_image_view_create_info(const TextureDesc& desc, VkImage image);
 VkBufferMemoryBarrier vk_buffer_barrier(Buffer buffer);
+bool vk_has_stencil(VkFormat format);
 
 } // namespace gfx
 
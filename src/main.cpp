@@ -4,6 +4,9 @@
 #include <GLFW/glfw3.h>
 #include <spdlog/spdlog.h>
 #include <spdlog/pattern_formatter.h>
+#include <cstdlib>
+#include <string>
+#include <string_view>
 
 struct LevelFormatter : public spdlog::custom_flag_formatter {
     void format(const spdlog::details::log_msg& msg, const std::tm&, spdlog::memory_buf_t& dest) override {
@@ -33,26 +36,86 @@ struct LevelFormatter : public spdlog::custom_flag_formatter {
     }
 };
 
-int main() {
+// Usage: parkbox [--headless] [--frames N] [--width W] [--height H] [--capture DIR]
+// Headless runs render N frames without a window and exit; for a software rasterizer, point VK_ICD_FILENAMES at e.g. lavapipe's ICD.
+struct Options final {
+    bool headless = false;
+    uint64_t frames = 60;
+    uint32_t width = 800;
+    uint32_t height = 600;
+    std::string capture_dir;
+};
+
+static bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--headless") {
+            options.headless = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            spdlog::error("missing value for {}", arg);
+            return false;
+        }
+
+        const char* value = argv[++i];
+        if (arg == "--frames") {
+            options.frames = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--width") {
+            options.width = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--height") {
+            options.height = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--capture") {
+            options.capture_dir = value;
+        } else {
+            spdlog::error("unknown option {}", arg);
+            return false;
+        }
+    }
+
+    if (options.width == 0 || options.height == 0) {
+        spdlog::error("invalid resolution {}x{}", options.width, options.height);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
     std::unique_ptr<spdlog::pattern_formatter> formatter = std::make_unique<spdlog::pattern_formatter>();
     formatter->add_flag<LevelFormatter>('y').set_pattern("%^[%y]%$ %v");
     spdlog::set_formatter(std::move(formatter));
 
+    Options options;
+    if (!parse_options(argc, argv, options))
+        return 1;
+
     gfx::vk_log(volkInitialize());
-    glfwInit();
 
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    gfx::Context cx;
 
-    GLFWwindow* window = glfwCreateWindow(800, 600, "Parkbox", nullptr, nullptr);
+    if (options.headless) {
+        if (!cx.init_headless(options.width, options.height))
+            return 1;
+    } else {
+        glfwInit();
 
-    gfx::Context cx;
-    cx.init(window);
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+        GLFWwindow* window = glfwCreateWindow(options.width, options.height, "Parkbox", nullptr, nullptr);
+
+        cx.init(window);
+    }
 
     gfx::Renderer renderer;
     cx.renderer = &renderer;
     renderer.init(cx);
 
-    renderer.run();
+    if (options.headless)
+        renderer.run_headless(options.frames, options.capture_dir);
+    else
+        renderer.run();
 
     gfx::vk_log(vkDeviceWaitIdle(cx.dev));
 
@@ -43,7 +43,8 @@ void set_camera_position(CameraComponent& camera) {
 void camera_system(gfx::FrameContext& fcx, World& world, float dt) {
     static constexpr auto MOVE_SPEED = 5.f;
 
-    if (ImGui::GetIO().WantCaptureKeyboard)
+    // There's no input without a window, the cameras stay where they are
+    if (fcx.cx.headless() || ImGui::GetIO().WantCaptureKeyboard)
         return;
 
     for (auto [e, camera] : world.reg.view<CameraComponent>().each()) {
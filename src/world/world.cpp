@@ -9,6 +9,8 @@
 #include "gfx/renderer.hpp"
 
 #include <fstream>
+#include <memory>
+#include <functional>
 #include <spdlog/fmt/fmt.h>
 #include <tiny_obj_loader.h>
 #include <glm/gtc/matrix_transform.hpp>
@@ -18,11 +20,8 @@
 
 namespace world {
 
-glm::vec4 v3norm(glm::vec4 p) {
-    return p / glm::length(glm::vec3{p});
-}
-
-gfx::Texture load_local_texture(gfx::FrameContext& fcx, std::string_view file, bool mipped, VkFormat format) {
+// Uploaded on the transfer queue, on_resident is called once the texture may be sampled
+gfx::Texture load_local_texture(gfx::Context& cx, std::string_view file, bool mipped, VkFormat format, std::function<void()> on_resident) {
     std::ifstream f{fmt::format("{}/textures/{}", PK_RESOURCE_DIR, file), std::ios::binary};
     const std::vector<uint8_t> buf{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
     f.close();
@@ -33,7 +32,7 @@ gfx::Texture load_local_texture(gfx::FrameContext& fcx, std::string_view file, b
     info.data_size = buf.size();
     info.generate_mipmaps = mipped;
 
-    const gfx::Image img = gfx::load_image(fcx, info);
+    const gfx::Image img = gfx::load_image(cx, info, std::move(on_resident));
 
     VkImageViewCreateInfo ivci = {};
     ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -43,7 +42,18 @@ gfx::Texture load_local_texture(gfx::FrameContext& fcx, std::string_view file, b
     ivci.format = img.format;
     ivci.subresourceRange = gfx::vk_subresource_range(0, 1, 0, img.num_mips, VK_IMAGE_ASPECT_COLOR_BIT);
 
-    return gfx::create_texture(fcx.cx.dev, img, ivci);
+    return gfx::create_texture(cx.dev, img, ivci);
+}
+
+// Static meshes are drawn by a single indirect pass
+static gfx::IndirectMeshPass& static_mesh_pass(gfx::Context& cx) {
+    return cx.scene.passes.pass("pbr").pass("pbr_textured");
+}
+
+static std::pair<glm::vec3, float> bounding_sphere(glm::vec3 min, glm::vec3 max) {
+    const glm::vec3 center = (min + max) / 2.f;
+    const float radius = std::sqrt(std::max(glm::length2(center - min), glm::length2(center - max)));
+    return {center, radius};
 }
 
 void World::begin(gfx::FrameContext& fcx) {
@@ -53,6 +63,7 @@ void World::begin(gfx::FrameContext& fcx) {
 
     on_mouse_move = {fcx.cx.on_mouse_move, fcx.cx.on_mouse_move.connect_delegate<&World::mouse_move>(this)};
     on_scroll = {fcx.cx.on_scroll, fcx.cx.on_scroll.connect_delegate<&World::scroll>(this)};
+    on_relocate = {fcx.cx.scene.storage.on_relocate, fcx.cx.scene.storage.on_relocate.connect_delegate<&World::relocate>(this)};
 
     main_camera = spawn_camera(*this);
     set_perspective(fcx.cx.width, fcx.cx.height);
@@ -159,8 +170,11 @@ void World::add_object(gfx::Context& cx, std::string_view shader_type, std::stri
 }
 
 uint32_t World::add_texture(gfx::FrameContext& fcx, const std::string& name, std::string_view file, bool mipped, VkFormat format) {
-    const gfx::Texture tex = load_local_texture(fcx, file, mipped, format);
-    const uint32_t id = fcx.cx.scene.storage.push_texture(tex);
+    // The id is only known once the texture is pushed, after which the upload may finish at any frame
+    auto id_ptr = std::make_shared<uint32_t>();
+    const gfx::Texture tex = load_local_texture(fcx.cx, file, mipped, format, [&cx = fcx.cx, id_ptr] { cx.scene.storage.make_resident(*id_ptr); });
+    const uint32_t id = fcx.cx.scene.storage.push_pending_texture(tex);
+    *id_ptr = id;
 
     textures.emplace(name, id);
 
@@ -216,16 +230,16 @@ gfx::IndirectMeshKey World::add_static_mesh(gfx::FrameContext& fcx, const std::s
         }
     }
 
-    const glm::vec3 center = (min + max) / 2.f;
-    const float radius = std::sqrt(std::max(glm::length2(center - min), glm::length2(center - max)));
+    const auto [center, radius] = bounding_sphere(min, max);
 
     StaticMesh mesh{fcx.cx.scene.storage.allocate_vertices(vertices.size()), fcx.cx.scene.storage.allocate_indices(indices.size()), min, max};
 
-    fcx.stage(mesh.vertices.buffer, vertices.data());
-    fcx.stage(mesh.indices.buffer, indices.data());
-
     const gfx::IndirectMeshKey mk = gfx::indirect_mesh_key(mesh.vertices, mesh.indices);
-    fcx.cx.scene.passes.pass("pbr").pass("pbr_textured").push_mesh(mk, center, radius);
+    static_mesh_pass(fcx.cx).push_mesh(mk, center, radius, false);
+
+    // Batches become resident in order, so the vertices are resident along with the indices
+    fcx.cx.transfers.upload(mesh.vertices.buffer, vertices.data());
+    fcx.cx.transfers.upload(mesh.indices.buffer, indices.data(), [&cx = fcx.cx, mk] { static_mesh_pass(cx).make_resident(mk); });
 
     static_meshes.emplace(name, std::move(mesh));
 
@@ -252,20 +266,7 @@ void World::update(gfx::FrameContext& fcx, float dt) {
     camera_system(fcx, *this, dt);
 
     const CameraComponent cam = reg.get<CameraComponent>(main_camera);
-    fcx.cx.scene.uniforms.cam_pos = {cam.pos, 0.f};
-    fcx.cx.scene.uniforms.cam_view = glm::lookAt(cam.pos, cam.pos + cam.forward, cam.up);
-    fcx.cx.scene.uniforms.cam_proj = perspective * fcx.cx.scene.uniforms.cam_view;
-
-    const glm::mat4 projtrans = glm::transpose(perspective);
-    const glm::vec4 frustum_x = v3norm(projtrans[3] + projtrans[0]);
-    const glm::vec4 frustum_y = v3norm(projtrans[3] + projtrans[1]);
-
-    fcx.cx.scene.passes.uniforms.frustum[0] = frustum_x.x;
-    fcx.cx.scene.passes.uniforms.frustum[1] = frustum_x.z;
-    fcx.cx.scene.passes.uniforms.frustum[2] = frustum_y.y;
-    fcx.cx.scene.passes.uniforms.frustum[3] = frustum_y.z;
-    fcx.cx.scene.passes.uniforms.near_far = glm::vec2{0.1f, 100.f};
-    fcx.cx.scene.passes.uniforms.view = fcx.cx.scene.uniforms.cam_view;
+    fcx.cx.scene.main_view().set_camera(cam.pos, cam.forward, cam.up, perspective, 0.1f, 100.f);
 }
 
 void World::mouse_move(double x, double y) {
@@ -276,6 +277,31 @@ void World::scroll(double x, double y) {
     camera_zoom(*cx, *this, static_cast<float>(x), static_cast<float>(y));
 }
 
+void World::relocate(const gfx::BufferAllocation& from, const gfx::BufferAllocation& to) {
+    const auto moved = [&](const gfx::BufferAllocation& alloc) { return alloc->buffer == from->buffer && alloc.alloc.offset == from.alloc.offset; };
+
+    for (auto& [name, sm] : static_meshes) {
+        if (!moved(sm.vertices) && !moved(sm.indices))
+            continue;
+
+        const gfx::IndirectMeshKey old_key = gfx::indirect_mesh_key(sm.vertices, sm.indices);
+        (moved(sm.vertices) ? sm.vertices : sm.indices) = to;
+        const gfx::IndirectMeshKey new_key = gfx::indirect_mesh_key(sm.vertices, sm.indices);
+
+        const auto [center, radius] = bounding_sphere(sm.min, sm.max);
+        static_mesh_pass(*cx).update_mesh(old_key, new_key, center, radius);
+
+        for (auto [e, mesh] : reg.view<MeshComponent>().each()) {
+            if (mesh.mesh == old_key) {
+                mesh.mesh = new_key;
+                mesh.gpu_object.mesh = new_key;
+            }
+        }
+
+        return;
+    }
+}
+
 void World::set_perspective(int32_t w, int32_t h) {
     perspective = glm::perspective(glm::radians(60.f), static_cast<float>(w) / static_cast<float>(h), 0.1f, 100.f);
 }
@@ -54,6 +54,8 @@ class World final {
   private:
     void mouse_move(double x, double y);
     void scroll(double x, double y);
+    // Remaps the static mesh that was allocated from, after the storage compacted it
+    void relocate(const gfx::BufferAllocation& from, const gfx::BufferAllocation& to);
 
     void set_perspective(int32_t w, int32_t h);
 
@@ -63,6 +65,7 @@ class World final {
 
     ScopedSignalListener<double, double> on_mouse_move;
     ScopedSignalListener<double, double> on_scroll;
+    ScopedSignalListener<const gfx::BufferAllocation&, const gfx::BufferAllocation&> on_relocate;
 };
 
 } // namespace world